@@ -633,6 +633,14 @@ struct Node {
    */
   virtual bool supports_multibatch() const { return false; }
 
+  /**
+   * \brief Whether forward() points the output at memory held by this node.
+   * \details hltc fork: if true, the execution engines allocate no memory
+   * for the output, and the output is never written to after forward().
+   * Such a node must not be batched with other nodes (autobatch_sig() is 0).
+   */
+  virtual bool provides_forward_memory() const { return false; }
+
   /**
    * \brief Whether this node supports processing inputs/outputs on multiple
    * devices. \details DyNet will throw an error if you try to process inputs
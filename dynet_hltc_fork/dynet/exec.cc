@@ -16,6 +16,22 @@ using namespace std;
 
 namespace dynet {
 
+thread_local std::function<void(ParameterNodeBase* node, const Tensor& grad)> parameter_gradient_sink;
+
+thread_local std::function<void()> before_forward;
+
+thread_local int autobatch_strategy_override = 0;
+
+thread_local unsigned long num_backward_passes = 0;
+
+static void accumulate_parameter_gradient(ParameterNodeBase* node, const Tensor& grad) {
+  if (parameter_gradient_sink) {
+    parameter_gradient_sink(node, grad);
+  } else {
+    node->accumulate_grad(grad);
+  }
+}
+
 ExecutionEngine::ExecutionEngine(const ComputationGraph& cg)
     : device_manager(get_device_manager()), cg(cg), backward_computed(0) {}
 
@@ -86,6 +102,8 @@ const Tensor& SimpleExecutionEngine::incremental_forward(VariableIndex i) {
     "Out-of-bounds variable access in "
     "SimpleExecutionEngine::incremental_forward()");
 
+  if (i >= num_nodes_evaluated && before_forward) before_forward();
+
   // free any old memory if this is a new CG
   if (num_nodes_evaluated == 0)
     for (Device* dev : device_manager->get_devices())
@@ -127,6 +145,10 @@ const Tensor& SimpleExecutionEngine::incremental_forward(VariableIndex i) {
         DYNET_ASSERT(node->args.size() == 1,
                      "Inplacing only supported for arity-1 nodes");
         node_fx.v = nfxs[node->args[0]].v;
+      } else if (node->provides_forward_memory()) {
+        // hltc fork: forward() points node_fx at the node's own memory
+        node->aux_mem = nullptr;
+        node->forward(xs, node_fx);
       } else {
         node_fx.v = static_cast<float*>(
           node_fx_pools[(int)DeviceMempool::FXS]->allocate(
@@ -164,6 +186,7 @@ void SimpleExecutionEngine::backward(bool full) {
 }
 
 void SimpleExecutionEngine::backward(VariableIndex from_where, bool full) {
+  ++num_backward_passes;
   if (from_where >= nfxs.size()) { incremental_forward(from_where); }
   if (nfxs[from_where].d.size() != 1) {
     DYNET_INVALID_ARG(
@@ -277,7 +300,7 @@ void SimpleExecutionEngine::backward(VariableIndex from_where, bool full) {
   for (VariableIndex i : cg.parameter_nodes) {
     if (i <= from_where) {
       ParameterNodeBase* pnode = static_cast<ParameterNodeBase*>(cg.nodes[i]);
-      pnode->accumulate_grad(ndEdfs[i]);
+      accumulate_parameter_gradient(pnode, ndEdfs[i]);
     }
   }
   backward_computed = from_where+1;
@@ -740,9 +763,10 @@ const Tensor& BatchedExecutionEngine::incremental_forward_no_update(
         nfx.mem_pool = DeviceMempool::FXS;
         // Allocate memory
         auto mempool = node->device->pools[(int)DeviceMempool::FXS];
-        nfx.v = static_cast<float*>(
+        // hltc fork: unless forward() points nfx at the node's own memory
+        nfx.v = node->provides_forward_memory() ? nullptr : static_cast<float*>(
             mempool->allocate(node2size[curr_node] * sizeof(float)));
-        if (nfx.v == nullptr) {
+        if (nfx.v == nullptr && !node->provides_forward_memory()) {
           DYNET_RUNTIME_ERR("Ran out of memory when allocating for node "
                             << curr_node << ", allocating FWD memory.");
         }
@@ -897,10 +921,14 @@ const Tensor& BatchedExecutionEngine::incremental_forward_no_update(
 const Tensor& BatchedExecutionEngine::incremental_forward(VariableIndex i) {
   DYNET_ASSERT(i < cg.nodes.size(), "Out-of-bounds variable access in BatchedExecutionEngine::incremental_forward()");
 
+  if (i >= num_nodes_evaluated && before_forward) before_forward();
+
   if (num_nodes_evaluated == 0)
     garbage_collect();
 
-  if (autobatch_flag > 99) {
+  if (autobatch_strategy_override) {
+    incremental_forward_no_update(i, autobatch_strategy_override);
+  } else if (autobatch_flag > 99) {
     Timing timer;
     incremental_forward_no_update(i, 1);
     double best_speed = timer.stop();
@@ -928,6 +956,7 @@ void BatchedExecutionEngine::backward(bool full) {
 }
 
 void BatchedExecutionEngine::backward(VariableIndex from_where, bool full) {
+  ++num_backward_passes;
 
   if(!(from_where < node2batch.size()))
     incremental_forward(from_where);
@@ -1060,7 +1089,8 @@ void BatchedExecutionEngine::backward(VariableIndex from_where, bool full) {
         // No concatenation whatsoever
         if (my_batch.concat[ai] == 0) {
           if (needs_derivative[node2batch[arg]]) {
-            node->backward(xs, my_batch.nfx, batched_ndEdfs[i], ai, batched_ndEdfs[node2batch[arg]]);
+            // hltc fork: the argument may be one of several nodes in its own batch, so write at its offset within that batch
+            node->backward(xs, my_batch.nfx, batched_ndEdfs[i], ai, ndEdfs[arg]);
             // cerr << "batched backward[" << i << "](" << ai << ")->" << node2batch[arg] << " == " << print_vec(as_vector(batched_ndEdfs[node2batch[arg]])) << endl;
           }
         // Needs concatenation
@@ -1106,7 +1136,7 @@ void BatchedExecutionEngine::backward(VariableIndex from_where, bool full) {
   //       it would be nice to have.
   for (VariableIndex i : cg.parameter_nodes)
     if(i < (VariableIndex)ndEdfs.size() && ndEdfs[i].v != nullptr)
-      static_cast<ParameterNodeBase*>(cg.nodes[i])->accumulate_grad(ndEdfs[i]);
+      accumulate_parameter_gradient(static_cast<ParameterNodeBase*>(cg.nodes[i]), ndEdfs[i]);
   backward_computed = from_where + 1;
   // for(VariableIndex vi = (VariableIndex)0; vi <= backward_computed; ++vi) cerr << "ndEdfs[" << vi << "] == " << print_vec(as_vector(ndEdfs[vi])) << endl;
 
@@ -3,9 +3,29 @@
 
 #include "dynet/dynet.h"
 
+#include <functional>
+
 namespace dynet {
 
 class DeviceManager;
+struct ParameterNodeBase;
+
+// hltc fork: when set, the gradients of parameter nodes computed by backward() on this thread
+// are handed to this function instead of being accumulated into the parameters.
+// This allows each thread to keep its own gradient buffer.
+extern thread_local std::function<void(ParameterNodeBase* node, const Tensor& grad)> parameter_gradient_sink;
+
+// hltc fork: when set, called on this thread before a forward pass computes any node (and so reads the parameter values).
+// This allows a parameter update running on another thread to finish first.
+extern thread_local std::function<void()> before_forward;
+
+// hltc fork: when non-zero, the autobatching strategy that the batched execution engine uses on this thread,
+// instead of the global autobatch_flag. For example, 2 batches the nodes by their depth in the graph.
+extern thread_local int autobatch_strategy_override;
+
+// hltc fork: the number of backward passes started on this thread.
+// A node that calls backward() once per argument can tell by this whether it is still in the same backward pass.
+extern thread_local unsigned long num_backward_passes;
 
 class ExecutionEngine {
  public:
@@ -308,6 +308,7 @@ Expression to_device(const Expression & x, Device *device) {
 
 Expression affine_transform(const std::initializer_list<Expression> &xs) { return detail::f<AffineTransform>(xs); }
 Expression affine_transform(const std::vector<Expression> &xs) { return detail::f<AffineTransform>(xs); }
+Expression affine_transform_activation(const std::vector<Expression> &xs, AffineActivation activation) { return detail::f<AffineTransformActivation>(xs, activation); }
 
 Expression sum(const std::initializer_list<Expression> &xs) { return detail::f<Sum>(xs); }
 Expression sum(const std::vector<Expression> &xs) { return detail::f<Sum>(xs); }
@@ -693,6 +693,20 @@ Expression operator/(const Expression& x, const Expression& y);
 Expression affine_transform(const std::initializer_list<Expression> &xs);
 Expression affine_transform(const std::vector<Expression> &xs);
 
+enum class AffineActivation : unsigned char;
+
+/**
+ * \ingroup arithmeticoperations
+ * \brief Affine transform followed by an activation, in a single node
+ * \details hltc fork: identical to applying the activation on affine_transform(xs), without a separate node for the activation.
+ *
+ * \param xs An initializer list containing an odd number of expressions, as in affine_transform
+ * \param activation The activation
+ *
+ * \return An expression equal to: activation(xs[0] + xs[1]*xs[2] + xs[3]*xs[4] + ...)
+ */
+Expression affine_transform_activation(const std::vector<Expression> &xs, AffineActivation activation);
+
 /**
  * \ingroup arithmeticoperations
  * \brief Sum
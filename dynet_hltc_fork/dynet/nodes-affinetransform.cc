@@ -1,8 +1,11 @@
 #include "dynet/nodes-affinetransform.h"
 
+#include "dynet/exec.h"
 #include "dynet/nodes-impl-macros.h"
 #include "dynet/matrix-multiply.h"
 #include "dynet/tensor-eigen.h"
+#include "dynet/functors.h"
+#include "dynet/simd-functors.h"
 
 using namespace std;
 
@@ -37,11 +40,26 @@ Dim AffineTransform::dim_forward(const vector<Dim>& xs) const {
 }
 
 int AffineTransform::autobatch_sig(const ComputationGraph & cg, SigMap &sm) const {
-  Sig s(nt::affine);
+  return autobatch_sig(nt::affine, cg, sm);
+}
+
+// hltc fork: whether the bias is computed for every batch element separately (for example, an input projection hoisted out of a recurrence),
+// in which case it is concatenated across the batch like the right hand side arguments, instead of being shared.
+// Only when it has the shape of the result, since broadcasting a mini-batched bias over columns is not implemented.
+static bool is_per_element_bias(const ComputationGraph & cg, VariableIndex bias, const Dim & dim) {
+  const Node* node = cg.nodes[bias];
+  return !node->args.empty() && node->dim == dim;
+}
+
+int AffineTransform::autobatch_sig(nt::NodeType type, const ComputationGraph & cg, SigMap &sm) const {
+  Sig s(type);
   // This is a heuristic: we assume that we often have "b + W * x" shaped affine transforms
   // so when everything is batch size one, optimize for this case
   if(dim.bd == 1) {
-    s.add_node(args[0]);
+    if(args.size() > 1 && is_per_element_bias(cg, args[0], dim))
+      s.add_dim(dim);
+    else
+      s.add_node(args[0]);
     for(size_t i = 1; i < args.size(); i += 2) {
       s.add_node(args[i]);
       s.add_dim(cg.nodes[args[i+1]]->dim); // TODO: this is not the exact same as dim->print_profile
@@ -61,6 +79,8 @@ int AffineTransform::autobatch_sig(const ComputationGraph & cg, SigMap &sm) cons
 std::vector<int> AffineTransform::autobatch_concat(const ComputationGraph & cg) const {
   vector<int> ret(args.size(), 0);
   if(dim.bd == 1) {
+    if(args.size() > 1 && is_per_element_bias(cg, args[0], dim))
+      ret[0] = 1;
     for(size_t i = 2; i < ret.size(); i += 2)
       ret[i] = 1;
   } else {
@@ -155,4 +175,106 @@ void AffineTransform::backward_dev_impl(const MyDevice & dev,
 }
 DYNET_NODE_INST_DEV_IMPL(AffineTransform)
 
+// ************* AffineTransformActivation *************
+
+#ifndef __CUDACC__
+
+string AffineTransformActivation::as_string(const vector<string>& arg_names) const {
+  ostringstream s;
+  switch (activation) {
+    case AffineActivation::rectify: s << "ReLU("; break;
+    case AffineActivation::tanh: s << "tanh("; break;
+    case AffineActivation::logistic: s << "\\sigma("; break;
+    case AffineActivation::lstm_gates: s << "lstm_gates("; break;
+  }
+  s << AffineTransform::as_string(arg_names) << ')';
+  return s.str();
+}
+
+Dim AffineTransformActivation::dim_forward(const vector<Dim>& xs) const {
+  DYNET_ARG_CHECK(xs.size() > 1, "Bad number of inputs in AffineTransformActivation: " << xs);
+  Dim d = AffineTransform::dim_forward(xs);
+  if(activation == AffineActivation::lstm_gates) {
+    DYNET_ARG_CHECK(d.ndims() == 1 && d[0] % 4 == 0, "AffineTransformActivation: lstm_gates expects a vector of size 4H, got " << d);
+  }
+  return d;
+}
+
+int AffineTransformActivation::autobatch_sig(const ComputationGraph & cg, SigMap &sm) const {
+  switch (activation) {
+    case AffineActivation::rectify: return AffineTransform::autobatch_sig(nt::affine_rectify, cg, sm);
+    case AffineActivation::tanh: return AffineTransform::autobatch_sig(nt::affine_tanh, cg, sm);
+    case AffineActivation::lstm_gates: return AffineTransform::autobatch_sig(nt::affine_lstm_gates, cg, sm);
+    default: return AffineTransform::autobatch_sig(nt::affine_logistic, cg, sm);
+  }
+}
+
+size_t AffineTransformActivation::aux_storage_size() const {
+  return dim.size() * sizeof(float);
+}
+
+#endif
+
+template<class MyDevice>
+void AffineTransformActivation::forward_dev_impl(const MyDevice & dev, const vector<const Tensor*>& xs, Tensor& fx) const {
+  AffineTransform::forward_dev_impl(dev, xs, fx);
+  switch (activation) {
+    case AffineActivation::rectify:
+      tvec(fx).device(*dev.edevice) = tvec(fx).cwiseMax(0.f);
+      break;
+    case AffineActivation::tanh:
+      tvec(fx).device(*dev.edevice) = tvec(fx).tanh();
+      break;
+    case AffineActivation::logistic:
+      tvec(fx).device(*dev.edevice) = tvec(fx).unaryExpr(scalar_logistic_sigmoid_op<float>());
+      break;
+    case AffineActivation::lstm_gates: {
+      unsigned hidden_dim = fx.d[0] / 4;
+      Eigen::DSizes<ptrdiff_t, 2> indices_ifo(0, 0), indices_g(hidden_dim*3, 0);
+      Eigen::DSizes<ptrdiff_t, 2> sizes_ifo(hidden_dim*3, static_cast<ptrdiff_t>(fx.d.bd)), sizes_g(hidden_dim, static_cast<ptrdiff_t>(fx.d.bd));
+      tbvec(fx).slice(indices_ifo, sizes_ifo).device(*dev.edevice) = tbvec(fx).slice(indices_ifo, sizes_ifo).unaryExpr(scalar_logistic_sigmoid_op<float>());
+      tbvec(fx).slice(indices_g, sizes_g).device(*dev.edevice) = tbvec(fx).slice(indices_g, sizes_g).tanh();
+      break;
+    }
+  }
+}
+
+template<class MyDevice>
+void AffineTransformActivation::backward_dev_impl(const MyDevice & dev,
+                             const vector<const Tensor*>& xs,
+                             const Tensor& fx,
+                             const Tensor& dEdf,
+                             unsigned i,
+                             Tensor& dEdxi) const {
+  // the gradient with respect to the result of the affine transform, shared by the calls for all arguments in this backward pass
+  Tensor dEdz(dEdf.d, static_cast<float*>(aux_mem), fx.device, fx.mem_pool);
+  if (dEdz_backward_pass == num_backward_passes && dEdz_of == dEdf.v) {
+    AffineTransform::backward_dev_impl(dev, xs, fx, dEdz, i, dEdxi);
+    return;
+  }
+  dEdz_backward_pass = num_backward_passes;
+  dEdz_of = dEdf.v;
+  switch (activation) {
+    case AffineActivation::rectify:
+      tvec(dEdz).device(*dev.edevice) = tvec(fx).cast<bool>().cast<float>() * tvec(dEdf);
+      break;
+    case AffineActivation::tanh:
+      tvec(dEdz).device(*dev.edevice) = tvec(fx).binaryExpr(tvec(dEdf), scalar_tanh_backward_op<float>());
+      break;
+    case AffineActivation::logistic:
+      tvec(dEdz).device(*dev.edevice) = tvec(fx).binaryExpr(tvec(dEdf), scalar_logistic_sigmoid_backward_op<float>());
+      break;
+    case AffineActivation::lstm_gates: {
+      unsigned hidden_dim = fx.d[0] / 4;
+      Eigen::DSizes<ptrdiff_t, 2> indices_ifo(0, 0), indices_g(hidden_dim*3, 0);
+      Eigen::DSizes<ptrdiff_t, 2> sizes_ifo(hidden_dim*3, static_cast<ptrdiff_t>(fx.d.bd)), sizes_g(hidden_dim, static_cast<ptrdiff_t>(fx.d.bd));
+      tbvec(dEdz).slice(indices_ifo, sizes_ifo).device(*dev.edevice) = tbvec(fx).slice(indices_ifo, sizes_ifo).binaryExpr(tbvec(dEdf).slice(indices_ifo, sizes_ifo), scalar_logistic_sigmoid_backward_op<float>());
+      tbvec(dEdz).slice(indices_g, sizes_g).device(*dev.edevice) = tbvec(fx).slice(indices_g, sizes_g).binaryExpr(tbvec(dEdf).slice(indices_g, sizes_g), scalar_tanh_backward_op<float>());
+      break;
+    }
+  }
+  AffineTransform::backward_dev_impl(dev, xs, fx, dEdz, i, dEdxi);
+}
+DYNET_NODE_INST_DEV_IMPL(AffineTransformActivation)
+
 }
@@ -21,6 +21,27 @@ struct AffineTransform : public Node {
   }
   DYNET_NODE_DEFINE_DEV_IMPL()
   mutable float* dEdf_mem;
+ protected:
+  int autobatch_sig(nt::NodeType type, const ComputationGraph &cg, SigMap &sm) const;
+};
+
+// hltc fork: the activations that can be fused into an affine transform
+// lstm_gates applies the nonlinearities of vanilla_lstm_gates on a vector of size 4H: logistic on the first 3H, tanh on the last H
+enum class AffineActivation : unsigned char { rectify, tanh, logistic, lstm_gates };
+
+// hltc fork: fx = activation(xs[0] + \sum_{i=1, 3 ...} xs[i] * xs[i+1])
+// Applies the activation in place on the result of the affine transform, instead of in a separate node.
+// The backward pass scales dEdf by the derivative of the activation (which only depends on fx), then goes through the affine transform.
+// The scaled dEdf is kept in the auxiliary memory, and computed once per backward pass rather than once per argument.
+struct AffineTransformActivation : public AffineTransform {
+  template <typename T> explicit AffineTransformActivation(const T& a, AffineActivation activation) : AffineTransform(a), activation(activation) {}
+  virtual int autobatch_sig(const ComputationGraph &cg, SigMap &sm) const override;
+  virtual size_t aux_storage_size() const override;
+  DYNET_NODE_DEFINE_DEV_IMPL()
+  AffineActivation activation;
+  // the backward pass and the dEdf that the auxiliary memory holds the scaled dEdf of
+  mutable unsigned long dEdz_backward_pass = 0;
+  mutable const float* dEdz_of = nullptr;
 };
 
 } // namespace dynet
@@ -20,6 +20,10 @@ tensor_t backprop_trainable_parameter::as_tensor() const {
   return tensor_t::from_dynet_tensor(*v.values());
 }
 
+void backprop_trainable_parameter::set_value(const std::vector<float>& value) {
+  v.set_value(value);
+}
+
 backprop_trainable_parameter::backprop_trainable_parameter(const tensor_shape_t& dim) : backprop_trainable_parameter_base(), internal_pc_m(
   make_unique<dynet::ParameterCollection>()), v(internal_pc_m->add_parameters(to_dynet_dim(dim))) {
 
@@ -176,3 +180,29 @@ backprop_trainable_parameter_base::backprop_trainable_parameter_base(const backp
 backprop_trainable_parameter_base::backprop_trainable_parameter_base(backprop_trainable_parameter_base&& x) noexcept :path(std::move(x.path)) {
   all_parameters.insert(this);
 }
+
+thread_local detached_parameter_values* detached_parameter_values::active = nullptr;
+
+detached_parameter_values::detached_parameter_values() {
+  if(active) {
+    throw_with_nested(std::runtime_error("Cannot nest detached parameter values"));
+  }
+  active = this;
+}
+
+detached_parameter_values::~detached_parameter_values() {
+  active = nullptr;
+}
+
+void detached_parameter_values::add_decoder(unsigned long index, unsigned long num_values, std::function<void(const std::string&)> decoder) {
+  if(index >= decoders.size()) decoders.resize(index + 1);
+  if(decoders[index]) {
+    throw_with_nested(std::runtime_error("Corrupted model: duplicated parameter value index " + std::to_string(index)));
+  }
+  decoders[index] = [index, num_values, decoder = std::move(decoder)](const std::string& in) {
+    if(in.size() != num_values * sizeof(float)) {
+      throw_with_nested(std::runtime_error("Corrupted model: parameter value index " + std::to_string(index) + " has " + std::to_string(in.size()) + " bytes, expected " + std::to_string(num_values) + " floats"));
+    }
+    decoder(in);
+  };
+}
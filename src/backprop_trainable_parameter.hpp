@@ -11,6 +11,39 @@
 #include "include/lego_param_naming_guard.hpp"
 namespace tg {
   class optimizer_base;
+
+  /**
+   * \brief Collects parameter values out of a model archive, so that they can be saved and loaded as separate chunks in parallel.
+   *
+   * While a detached_parameter_values is active on a thread, parameters serialized on that thread write an index instead of their values.
+   * When saving, an encoder of the values is collected at that index. When loading, a decoder that fills in the values is collected at that index.
+   */
+  struct detached_parameter_values {
+    std::vector<std::function<void(std::string& out)>> encoders;
+    std::vector<std::function<void(const std::string& in)>> decoders;
+
+    /**
+     * \brief The instance that is active on the current thread, or nullptr when parameter values are serialized inline.
+     */
+    static thread_local detached_parameter_values* active;
+
+    /**
+     * \brief Make this instance active on the current thread, until destruction
+     */
+    detached_parameter_values();
+    detached_parameter_values(const detached_parameter_values&) = delete;
+    detached_parameter_values(detached_parameter_values&&) noexcept = delete;
+    detached_parameter_values& operator=(const detached_parameter_values&) = delete;
+    detached_parameter_values& operator=(detached_parameter_values&&) noexcept = delete;
+    ~detached_parameter_values();
+
+    /**
+     * \brief Collect a decoder at given index
+     *
+     * The decoder is only given a chunk of exactly num_values floats. A chunk of any other size throws, as the model archive is corrupted.
+     */
+    void add_decoder(unsigned long index, unsigned long num_values, std::function<void(const std::string& in)> decoder);
+  };
   /**
    * A dynet::Parameter must lives in a dynet::ParameterCollection.
    * However, this design conflicts with the human intuition that
@@ -105,6 +138,15 @@ namespace tg {
       if(!valid) return;
       auto&& values = v.values();
       ar(values->d);
+      if(auto detached = detached_parameter_values::active) {
+        unsigned long index = detached->encoders.size();
+        ar(index);
+        detached->encoders.emplace_back([p = v](std::string& out) mutable {
+          auto values = dynet::as_vector(*p.values());
+          out.append(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(float));
+        });
+        return;
+      }
       ar(dynet::as_vector(*values));
     }
 
@@ -121,6 +163,15 @@ namespace tg {
       ar(dim);
       v = internal_pc_m->add_parameters(dim);
 
+      if(auto detached = detached_parameter_values::active) {
+        unsigned long index{};
+        ar(index);
+        detached->add_decoder(index, dim.size(), [p = v](const std::string& in) mutable {
+          p.set_value(std::vector<float>(reinterpret_cast<const float*>(in.data()), reinterpret_cast<const float*>(in.data() + in.size())));
+        });
+        return;
+      }
+
       std::vector<float> values;
       ar(values);
       v.set_value(values);
@@ -153,6 +204,12 @@ namespace tg {
      */
     tensor_t as_tensor() const;
 
+    /**
+     * Overwrite the underlying parameter values.
+     * \param value the values, in the same (column-major) order as as_tensor()
+     */
+    void set_value(const std::vector<float>& value);
+
     virtual ~backprop_trainable_parameter();
   };
 
@@ -192,6 +249,17 @@ namespace tg {
       unsigned long n = num_entries();
       tensor_shape_t dim = embedding_dim();
       ar(n, dim);
+      if(auto detached = detached_parameter_values::active) {
+        unsigned long index = detached->encoders.size();
+        ar(index);
+        detached->encoders.emplace_back([p = v, n](std::string& out) mutable {
+          for(unsigned long i=0; i<n; ++i) {
+            auto values = dynet::as_vector(p.values()->at(i));
+            out.append(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(float));
+          }
+        });
+        return;
+      }
       for(unsigned long i=0; i<n; ++i) {
         ar(dynet::as_vector(v.values()->at(i)));
       }
@@ -210,6 +278,18 @@ namespace tg {
       ar(n, dim);
       internal_pc_m = std::make_unique<dynet::ParameterCollection>();
       v = internal_pc_m->add_lookup_parameters(n, to_dynet_dim(dim));
+      if(auto detached = detached_parameter_values::active) {
+        unsigned long index{};
+        ar(index);
+        auto row = to_dynet_dim(dim).size();
+        detached->add_decoder(index, n * row, [p = v, n, row](const std::string& in) {
+          auto values = reinterpret_cast<const float*>(in.data());
+          for(unsigned long i=0; i<n; ++i) {
+            p.initialize(i, std::vector<float>(values + i * row, values + (i + 1) * row));
+          }
+        });
+        return;
+      }
       for(unsigned long i=0; i<n; ++i) {
         std::vector<float> val;
         ar(val);
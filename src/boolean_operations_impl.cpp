@@ -77,6 +77,9 @@ std::string tg::gt_op::default_name() const {
 
 
 tg::value_t tg::eq_op::transduce(const tg::value_t& in0, const tg::value_t& in1) {
+  if(in0.is_interned_symbol() && in1.is_interned_symbol()) {
+    return value_t(in0.symbol_id() == in1.symbol_id());
+  }
   return value_t::visit_many([&](auto&& x, auto&& y) -> value_t {
     constexpr auto X = value_t::static_type_info<decltype(x)>();
     constexpr auto Y = value_t::static_type_info<decltype(y)>();
@@ -100,6 +103,9 @@ std::string tg::eq_op::default_name() const {
 }
 
 tg::value_t tg::ne_op::transduce(const tg::value_t& in0, const tg::value_t& in1) {
+  if(in0.is_interned_symbol() && in1.is_interned_symbol()) {
+    return value_t(in0.symbol_id() != in1.symbol_id());
+  }
   return value_t::visit_many([&](auto&& x, auto&& y) -> value_t {
     constexpr auto X = value_t::static_type_info<decltype(x)>();
     constexpr auto Y = value_t::static_type_info<decltype(y)>();
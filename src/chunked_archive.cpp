@@ -0,0 +1,199 @@
+//
+// Created by Dekai WU and YAN Yuchen on 20201221.
+//
+
+#include "chunked_archive.hpp"
+#include "include/lego_serialization_helper.hpp"
+#include "include/parallel_array_map.hpp"
+#include "include/transducer_typed_value.hpp"
+#include <cstring>
+#include <cstdint>
+#include <numeric>
+#include <algorithm>
+#include <exception>
+#include <limits>
+
+using namespace tg;
+using namespace std;
+
+namespace __private_chunked_archive {
+  unsigned long num_serialization_threads = std::max(std::thread::hardware_concurrency(), 1u);
+}
+
+void tg::set_num_serialization_threads(unsigned long num_threads) {
+  __private_chunked_archive::num_serialization_threads = std::max(num_threads, 1ul);
+}
+
+unsigned long tg::get_num_serialization_threads() {
+  return __private_chunked_archive::num_serialization_threads;
+}
+
+bool chunked_archive::is_chunked(std::istream& is, std::string& consumed) {
+  char buffer[8];
+  auto num_read = is.rdbuf() ? is.rdbuf()->sgetn(buffer, 8) : 0;
+  consumed.assign(buffer, num_read);
+  return num_read == 8 && memcmp(buffer, magic, 8) == 0;
+}
+
+chunked_archive::prefixed_streambuf::prefixed_streambuf(std::string prefix, std::streambuf* rest) : prefix_m(move(prefix)), rest_m(rest) {
+  setg(&prefix_m[0], &prefix_m[0], &prefix_m[0] + prefix_m.size());
+}
+
+// once the prefix is used up, reads go straight to the rest
+chunked_archive::prefixed_streambuf::int_type chunked_archive::prefixed_streambuf::underflow() {
+  if(gptr() < egptr()) return traits_type::to_int_type(*gptr());
+  return rest_m->sgetc();
+}
+
+chunked_archive::prefixed_streambuf::int_type chunked_archive::prefixed_streambuf::uflow() {
+  if(gptr() < egptr()) {
+    auto c = *gptr();
+    gbump(1);
+    return traits_type::to_int_type(c);
+  }
+  return rest_m->sbumpc();
+}
+
+std::streamsize chunked_archive::prefixed_streambuf::xsgetn(char* s, std::streamsize n) {
+  auto from_prefix = std::min<std::streamsize>(n, egptr() - gptr());
+  memcpy(s, gptr(), from_prefix);
+  gbump((int)from_prefix);
+  if(from_prefix == n) return n;
+  return from_prefix + rest_m->sgetn(s + from_prefix, n - from_prefix);
+}
+
+void chunked_archive::read_legacy(std::string consumed, std::istream& is, const std::function<void(cereal::BinaryInputArchive&)>& load) {
+  // the class version of value_t (0), followed by a null shared pointer
+  constexpr char primer[8] = {};
+  prefixed_streambuf buffer(string(primer, sizeof(primer)) + consumed, is.rdbuf());
+  istream rest(&buffer);
+  cereal::BinaryInputArchive ia(rest);
+  value_t null_value;
+  ia(null_value);
+  load(ia);
+}
+
+void chunked_archive::parallel_run(unsigned long num_tasks, const std::function<void(unsigned long)>& task) {
+  vector<unsigned long> tasks(num_tasks);
+  iota(tasks.begin(), tasks.end(), 0);
+  exception_ptr error;
+  mutex error_mtx;
+  parallel_for_each<unsigned long>(tasks, [&](const unsigned long& i) {
+    try {
+      task(i);
+    }
+    catch(...) {
+      lock_guard<mutex> lock(error_mtx);
+      if(!error) error = current_exception();
+    }
+  }, std::min(get_num_serialization_threads(), num_tasks));
+  if(error) rethrow_exception(error);
+}
+
+void chunked_archive::write(std::ostream& os, const std::vector<std::function<void(std::string&)>>& encoders) {
+  vector<string> chunks(encoders.size());
+  parallel_run(encoders.size(), [&](unsigned long i) {
+    encoders[i](chunks[i]);
+  });
+
+  os.write(magic, 8);
+  uint64_t num_chunks = chunks.size();
+  os.write(reinterpret_cast<const char*>(&num_chunks), sizeof(uint64_t));
+  for(auto&& chunk:chunks) {
+    uint64_t size = chunk.size();
+    os.write(reinterpret_cast<const char*>(&size), sizeof(uint64_t));
+  }
+  for(auto&& chunk:chunks) {
+    os.write(chunk.data(), chunk.size());
+  }
+  if(!os) {
+    throw_with_nested(std::runtime_error("Failed to write chunked archive"));
+  }
+}
+
+namespace __private_chunked_archive {
+  /**
+   * \brief No archive written by lego has nearly this many chunks, so a larger count means a corrupted archive
+   */
+  constexpr uint64_t MAX_NUM_CHUNKS = 1ul << 24;
+
+  /**
+   * \brief Bytes are read in pieces of at most this size, so the memory allocated never runs far ahead of the data actually read
+   */
+  constexpr uint64_t READ_PIECE_SIZE = 1ul << 24;
+
+  /**
+   * \brief The number of bytes left in a stream, or -1 if the stream cannot tell (for example, a pipe)
+   */
+  std::streamoff remaining_bytes(std::istream& is) {
+    auto cur = is.tellg();
+    if(cur == std::streampos(-1)) return -1;
+    is.seekg(0, std::ios::end);
+    auto end = is.tellg();
+    is.seekg(cur);
+    if(end == std::streampos(-1) || !is) {
+      is.clear();
+      is.seekg(cur);
+      return -1;
+    }
+    return end - cur;
+  }
+
+  /**
+   * \brief Read exactly n bytes, appending to out piece by piece
+   * \return False if the stream ends early
+   */
+  bool read_in_pieces(std::istream& is, std::string& out, uint64_t n) {
+    while(n > 0) {
+      auto piece = std::min(n, READ_PIECE_SIZE);
+      auto offset = out.size();
+      out.resize(offset + piece);
+      if(!is.read(&out[offset], piece)) return false;
+      n -= piece;
+    }
+    return true;
+  }
+}
+
+std::vector<std::string> chunked_archive::read(std::istream& is) {
+  using namespace __private_chunked_archive;
+  char buffer[8];
+  if(!is.read(buffer, 8) || memcmp(buffer, magic, 8) != 0) {
+    throw_with_nested(std::runtime_error("Not a chunked archive"));
+  }
+  uint64_t num_chunks;
+  if(!is.read(reinterpret_cast<char*>(&num_chunks), sizeof(uint64_t))) {
+    throw_with_nested(std::runtime_error("Corrupted chunked archive: cannot read the number of chunks"));
+  }
+
+  // every size read from the stream is checked against what the stream can hold, before anything is allocated for it
+  auto remaining = remaining_bytes(is);
+  if(num_chunks > MAX_NUM_CHUNKS || (remaining >= 0 && num_chunks > (uint64_t)remaining / sizeof(uint64_t))) {
+    throw_with_nested(std::runtime_error("Corrupted chunked archive: bad number of chunks " + to_string(num_chunks)));
+  }
+  string size_table;
+  if(!read_in_pieces(is, size_table, num_chunks * sizeof(uint64_t))) {
+    throw_with_nested(std::runtime_error("Corrupted chunked archive: cannot read the chunk sizes"));
+  }
+  vector<uint64_t> sizes(num_chunks);
+  if(num_chunks > 0) memcpy(sizes.data(), size_table.data(), size_table.size());
+
+  uint64_t total_size = 0;
+  for(auto&& size:sizes) {
+    if(size > std::numeric_limits<uint64_t>::max() - total_size) {
+      throw_with_nested(std::runtime_error("Corrupted chunked archive: the chunk sizes overflow"));
+    }
+    total_size += size;
+  }
+  if(remaining >= 0 && total_size > (uint64_t)remaining - size_table.size()) {
+    throw_with_nested(std::runtime_error("Corrupted chunked archive: the chunks take " + to_string(total_size) + " bytes, but only " + to_string(remaining - size_table.size()) + " bytes are left"));
+  }
+
+  vector<string> ret(num_chunks);
+  for(unsigned long i=0; i<num_chunks; ++i) {
+    if(!read_in_pieces(is, ret[i], sizes[i])) {
+      throw_with_nested(std::runtime_error("Corrupted chunked archive: chunk #" + to_string(i) + " is truncated"));
+    }
+  }
+  return ret;
+}
@@ -0,0 +1,100 @@
+//
+// Created by Dekai WU and YAN Yuchen on 20201221.
+//
+/// \cond SHOW_INTERNAL_IMPL
+#ifndef LEGO_CHUNKED_ARCHIVE_HPP
+#define LEGO_CHUNKED_ARCHIVE_HPP
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <functional>
+#include <cereal/archives/binary.hpp>
+
+namespace tg {
+
+  /**
+   * \brief A container of independently encoded chunks, so that chunks can be encoded and decoded in parallel.
+   *
+   * The layout is: the magic bytes, the number of chunks (64-bit), the byte size of every chunk (64-bit each),
+   * followed by the chunks themselves.
+   *
+   * The magic bytes are chosen such that they cannot be mistaken as the beginning of a plain cereal archive
+   * (which starts with a 64-bit size tag), so the old format can still be detected and read.
+   */
+  namespace chunked_archive {
+    constexpr char magic[] = "LEGOCHK1";
+
+    /**
+     * \brief Check whether a stream holds a chunked archive
+     *
+     * Works on streams that cannot seek (for example, a pipe or std::cin), so the bytes read while checking are consumed.
+     * Read the stream through a prefixed_streambuf over these bytes afterwards, whichever format it holds.
+     *
+     * \param is The input stream
+     * \param consumed Receives the bytes read while checking
+     * \return True if the stream starts with the magic bytes
+     */
+    bool is_chunked(std::istream& is, std::string& consumed);
+
+    /**
+     * \brief A stream buffer that gives back some bytes already consumed from another stream buffer, followed by the rest of it
+     */
+    class prefixed_streambuf : public std::streambuf {
+      std::string prefix_m;
+      std::streambuf* rest_m;
+    public:
+      prefixed_streambuf(std::string prefix, std::streambuf* rest);
+      prefixed_streambuf(const prefixed_streambuf&) = delete;
+      prefixed_streambuf& operator=(const prefixed_streambuf&) = delete;
+    protected:
+      int_type underflow() override;
+      int_type uflow() override;
+      std::streamsize xsgetn(char* s, std::streamsize n) override;
+    };
+
+    /**
+     * \brief Encode the chunks in parallel (see get_num_serialization_threads()), then write them out
+     * \param os The output stream
+     * \param encoders Every encoder appends the content of one chunk to the given buffer
+     */
+    void write(std::ostream& os, const std::vector<std::function<void(std::string&)>>& encoders);
+
+    /**
+     * \brief Read all chunks of a chunked archive
+     *
+     * The number of chunks and the chunk sizes are checked before anything is allocated for them:
+     * against the bytes left in the stream if it can tell, otherwise by reading in bounded pieces,
+     * so a corrupted archive fails with an exception instead of a huge allocation.
+     *
+     * \param is The input stream
+     * \return The content of every chunk
+     */
+    std::vector<std::string> read(std::istream& is);
+
+    /**
+     * \brief Read the old format, a plain cereal archive
+     *
+     * The old format predates the class version of value_t, so it does not carry one.
+     * Before handing the archive over, loads a null value_t from a primer that says version 0,
+     * so that the archive reads every value_t afterwards in the old layout.
+     *
+     * \param consumed The bytes read by is_chunked()
+     * \param is The input stream, after the consumed bytes
+     * \param load Loads the content of the archive
+     */
+    void read_legacy(std::string consumed, std::istream& is, const std::function<void(cereal::BinaryInputArchive&)>& load);
+
+    /**
+     * \brief Run a task on every chunk in parallel (see get_num_serialization_threads())
+     *
+     * If any task throws, the first exception is rethrown after all tasks are done.
+     *
+     * \param num_tasks The number of tasks
+     * \param task The task, receiving the task index
+     */
+    void parallel_run(unsigned long num_tasks, const std::function<void(unsigned long)>& task);
+  }
+}
+
+#endif //LEGO_CHUNKED_ARCHIVE_HPP
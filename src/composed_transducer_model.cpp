@@ -4,16 +4,28 @@
 
 #include "composed_transducer_model.hpp"
 #include "transducer_variant.hpp"
+#include "operator_fusion.hpp"
 
 using namespace tg;
 using namespace std;
 
 value_t composed_transducer_model::transduce(const value_t& x) {
   if(pipeline.empty()) return x;
-  auto itr = pipeline.begin();
-  value_t y = (*itr)->transduce(x);
-  for(++itr; itr != pipeline.end(); ++itr) {
-    y = (*itr)->transduce(y);
+  auto should_fuse = operator_fusion::is_enabled();
+  const value_t* y_ptr = &x;
+  value_t y;
+  for(auto itr = pipeline.begin(); itr != pipeline.end(); ++itr) {
+    auto next = std::next(itr);
+    if(should_fuse && next != pipeline.end() && operator_fusion::is_affine(**itr)) {
+      if(auto activation = operator_fusion::activation_of(**next)) {
+        y = operator_fusion::transduce(**itr, *activation, &y_ptr, 1);
+        y_ptr = &y;
+        itr = next;
+        continue;
+      }
+    }
+    y = (*itr)->transduce(*y_ptr);
+    y_ptr = &y;
   }
   return y;
 }
@@ -19,9 +19,22 @@ tg::symbolic_tensor_t tg::dense_model::transduce_impl(const tg::symbolic_tensor_
 }
 
 tg::value_t tg::dense_model::transduce(const tg::value_t& _x) {
+  auto&& x = _x.as_symbolic_tensor();
+  check_input(_x);
+  return value_t(transduce_impl(x));
+}
 
+tg::value_t tg::dense_model::transduce_fused(const tg::value_t& _x, dynet::AffineActivation activation) {
   auto&& x = _x.as_symbolic_tensor();
+  check_input(_x);
+  return value_t(dynet::affine_transform_activation({b_m.as_symbolic_tensor(), W_m.as_symbolic_tensor(), x}, activation));
+}
+
+bool tg::dense_model::has_bias() const {
+  return (bool)b_m;
+}
 
+void tg::dense_model::check_input(const tg::value_t& _x) const {
   auto dims = _x.tensor_shape();
 
   if (dims.size() == 1) {
@@ -43,8 +56,6 @@ tg::value_t tg::dense_model::transduce(const tg::value_t& _x) {
     ss << "Failed to apply " << default_name() << " on input tensor of shape " << _x.print_tensor_shape() << ".";
     std::throw_with_nested(std::runtime_error(ss.str()));
   }
-
-  return value_t(transduce_impl(x));
 }
 
 string tg::dense_model::default_name() const {
@@ -66,6 +77,14 @@ unsigned long dense_model::output_size() const {
   return dim_out_m;
 }
 
+const backprop_trainable_parameter& dense_model::weight() const {
+  return W_m;
+}
+
+const backprop_trainable_bias_parameter& dense_model::bias() const {
+  return b_m;
+}
+
 
 bool n_ary_dense_model::is_arity(unsigned long arity) const {
   return dim_ins_m.size() == arity;
@@ -80,6 +99,22 @@ value_t n_ary_dense_model::apply(const std::vector<value_t>& ins) {
   return value_t(apply_impl(_ins));
 }
 
+value_t n_ary_dense_model::apply_fused(const std::vector<value_t>& ins, dynet::AffineActivation activation) {
+  vector<dynet::Expression> args;
+  auto arity = dim_ins_m.size();
+  args.reserve(1 + 2 * arity);
+  args.push_back(b_m.as_symbolic_tensor());
+  for (unsigned long i = 0; i < arity; ++i) {
+    args.push_back(Ws_m[i].as_symbolic_tensor());
+    args.push_back(ins[i].as_symbolic_tensor());
+  }
+  return value_t(dynet::affine_transform_activation(args, activation));
+}
+
+bool n_ary_dense_model::has_bias() const {
+  return (bool)b_m;
+}
+
 symbolic_tensor_t n_ary_dense_model::apply_impl(const std::vector<symbolic_tensor_t>& ins) {
   vector<dynet::Expression> args;
   auto arity = dim_ins_m.size();
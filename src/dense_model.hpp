@@ -9,6 +9,7 @@
 
 #include "backprop_trainable_parameter.hpp"
 #include "include/transducer_typed_value.hpp"
+#include <dynet/nodes-affinetransform.h>
 
 namespace tg {
   class dense_model {
@@ -38,12 +39,31 @@ namespace tg {
 
     value_t transduce(const value_t& in0);
 
+    /**
+     * \brief Apply this layer followed by an activation, as a single computation graph node (see tg::operator_fusion)
+     *
+     * Requires the bias.
+     *
+     * \param in0 The input
+     * \param activation The activation
+     * \return The activated output
+     */
+    value_t transduce_fused(const value_t& in0, dynet::AffineActivation activation);
+
+    bool has_bias() const;
+
     symbolic_tensor_t transduce_impl(const symbolic_tensor_t& x);
 
     unsigned long input_size() const;
 
     unsigned long output_size() const;
 
+    const backprop_trainable_parameter& weight() const;
+
+    const backprop_trainable_bias_parameter& bias() const;
+
+  private:
+    void check_input(const value_t& x) const;
   };
 
   /**
@@ -76,6 +96,19 @@ namespace tg {
       return value_t(apply_impl({args.as_symbolic_tensor()...}));
     }
 
+    /**
+     * \brief Apply this layer followed by an activation, as a single computation graph node (see tg::operator_fusion)
+     *
+     * Requires the bias.
+     *
+     * \param ins The inputs
+     * \param activation The activation
+     * \return The activated output
+     */
+    value_t apply_fused(const std::vector<value_t>& ins, dynet::AffineActivation activation);
+
+    bool has_bias() const;
+
     symbolic_tensor_t apply_impl(const std::vector<symbolic_tensor_t>& ins);
 
     unsigned output_size() const;
@@ -4,6 +4,7 @@
 
 #include "dynet_computation_graph.hpp"
 #include "include/transducer_typed_value.hpp"
+#include "numerical_health.hpp"
 
 using namespace tg;
 using namespace std;
@@ -32,6 +33,7 @@ dynet::ComputationGraph* tg::dynet_computation_graph::p() {
 
 
 void dynet_computation_graph::discard() {
+  numerical_health::reset();
   if(!pcg) return;
   delete pcg;
   pcg = nullptr;
@@ -0,0 +1,77 @@
+//
+// Created by Dekai WU and YAN Yuchen on 20201221.
+//
+#include "../include/lego_transducer.hpp"
+#include <iostream>
+#include <sstream>
+using namespace std;
+using namespace tg;
+
+/**
+ * A dataset of arity 2 saved by the code before value_t was versioned, holding the datums:
+ *   (3, 1.5)
+ *   (tensor {1, 2, 3, 4, 5, 6} of shape {2, 3}, "hello")
+ *   ([7, "shared", [2.5]], "shared"), in which both "shared" are the same shared pointer
+ *   (null, -42)
+ */
+const signed char legacy_dataset_bytes[] = {      2,0,0,0,0,0,0,0,4,0,0,0,0,0,0,0,2,0,0,0,
+      0,0,0,0,1,0,0,-128,0,0,0,0,3,0,0,0,0,0,0,0,
+      2,0,0,-128,1,0,0,0,0,0,-64,63,2,0,0,0,0,0,0,0,
+      3,0,0,-128,2,0,0,0,6,0,0,0,0,0,0,0,0,0,-128,63,
+      0,0,0,64,0,0,64,64,0,0,-128,64,0,0,-96,64,0,0,-64,64,
+      2,0,0,0,0,0,0,0,2,0,0,0,0,0,0,0,3,0,0,0,
+      0,0,0,0,4,0,0,-128,3,0,0,0,5,0,0,0,0,0,0,0,
+      104,101,108,108,111,2,0,0,0,0,0,0,0,5,0,0,-128,4,0,0,
+      0,3,0,0,0,0,0,0,0,6,0,0,-128,0,0,0,0,7,0,0,
+      0,0,0,0,0,7,0,0,-128,3,0,0,0,6,0,0,0,0,0,0,
+      0,115,104,97,114,101,100,8,0,0,-128,4,0,0,0,1,0,0,0,0,
+      0,0,0,9,0,0,-128,1,0,0,0,0,0,32,64,7,0,0,0,2,
+      0,0,0,0,0,0,0,0,0,0,0,10,0,0,-128,0,0,0,0,-42,
+      -1,-1,-1,-1,-1,-1,-1
+};
+
+void ensure(bool condition, const string& what) {
+  if(!condition) throw runtime_error("legacy archive check failed: " + what);
+}
+
+void check_datums(const transducer_dataset& ds) {
+  ensure(ds.arity() == 2 && ds.size() == 4, "dataset size");
+  ensure(ds.at(0)[0].as_integer() == 3 && ds.at(0)[1].as_float() == 1.5f, "numbers");
+  auto t = ds.at(1)[0].as_tensor();
+  ensure(t.shape == tensor_shape_t{2, 3} && t.to_vector() == vector<float>{1, 2, 3, 4, 5, 6}, "tensor");
+  ensure(ds.at(1)[1].as_symbol() == "hello", "symbol");
+  auto l = ds.at(2)[0].as_list();
+  ensure(l.size() == 3 && l[0].as_integer() == 7 && l[1].as_symbol() == "shared", "list");
+  ensure(l[2].as_list().size() == 1 && l[2].as_list()[0].as_float() == 2.5f, "nested list");
+  ensure(ds.at(2)[1].as_symbol() == "shared", "shared symbol");
+  ensure(ds.at(3)[0].is_null() && ds.at(3)[1].as_integer() == -42, "null");
+}
+
+int main() {
+  lego_initialize();
+
+  stringstream legacy(string(reinterpret_cast<const char*>(legacy_dataset_bytes), sizeof(legacy_dataset_bytes)));
+  auto ds = transducer_dataset::load_from_stream(legacy);
+  check_datums(*ds);
+
+  // saving writes the current format, which must read back the same datums
+  stringstream current;
+  ds->save_to_stream(current);
+  check_datums(*transducer_dataset::load_from_stream(current));
+
+  // and so must a value_t saved through cereal, which carries the class version
+  stringstream archive;
+  {
+    cereal::BinaryOutputArchive oa(archive);
+    oa(ds->at(2)[0], ds->at(0)[1]);
+  }
+  value_t list, scalar;
+  {
+    cereal::BinaryInputArchive ia(archive);
+    ia(list, scalar);
+  }
+  ensure(list.as_list().size() == 3 && list.as_list()[1].as_symbol() == "shared" && scalar.as_float() == 1.5f, "versioned value_t");
+
+  cout << "legacy archive check passed" << endl;
+  return 0;
+}
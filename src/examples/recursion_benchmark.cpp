@@ -0,0 +1,107 @@
+//
+// Created by Dekai WU and YAN Yuchen on 20201229.
+//
+
+#include "../include/lego_transducer.hpp"
+#include "../include/wallclock_timer.hpp"
+#include <random>
+using namespace std;
+using namespace tg;
+
+/**
+ * Builds a chain of the given depth, where each node is (value child), and the last node is (value)
+ */
+value_t make_chain(unsigned long depth) {
+  value_t ret = value_t::make_list(1l);
+  for(unsigned long i = 1; i < depth; ++i) {
+    ret = value_t::make_list(1l, ret);
+  }
+  return ret;
+}
+
+/**
+ * Builds a random binary tree with the given number of leaves, where each leaf is (embedding), and each internal node is (left right)
+ */
+value_t make_random_tree(unsigned long num_leaves, unsigned long dim, std::mt19937& rng) {
+  if(num_leaves == 1) {
+    std::uniform_real_distribution<float> distribution(-1, 1);
+    std::vector<float> embedding(dim);
+    for(auto&& x:embedding) x = distribution(rng);
+    return value_t::make_list(value_t(tensor_t(embedding, tensor_shape_t{(long)dim})));
+  }
+  auto num_left = std::uniform_int_distribution<unsigned long>(1, num_leaves - 1)(rng);
+  return value_t::make_list(make_random_tree(num_left, dim, rng), make_random_tree(num_leaves - num_left, dim, rng));
+}
+
+int main() {
+  lego_initialize();
+
+  // A recursive transducer nested in another transducer, reading a value of the outer transducer at every level of recursion.
+  // The time per node should stay flat as the depth grows.
+  transducer_model weighted_sum([&](const value_placeholder& chain, const value_placeholder& weight) {
+    transducer_model visit;
+    visit = transducer_model([&](const value_placeholder& node) {
+      return lazy_ifelse(
+        list_size(node) == value_placeholder::constant(1),
+        node[0] * weight,
+        node[0] * weight + visit(node[1]));
+    });
+    return visit(chain);
+  });
+
+  for(unsigned long depth:{250ul, 500ul, 1000ul, 2000ul}) {
+    auto chain = make_chain(depth);
+    constexpr unsigned long NUM_REPEATS = 10;
+    value_t result;
+    wallclock_timer timer;
+    timer.start();
+    for(unsigned long i = 0; i < NUM_REPEATS; ++i) {
+      result = weighted_sum(chain, value_t(2l));
+    }
+    auto elapsed = timer.microseconds_elapsed();
+    cout << "depth " << depth << ": result " << result << ", " << elapsed / NUM_REPEATS << "us, " << (double)elapsed / NUM_REPEATS / depth << "us per node" << endl;
+  }
+
+  // A recursive tree encoder applied on a batch of trees of different shapes.
+  // Under tg::depth_scheduled_batching_guard, the nodes of all the trees are combined level by level.
+  constexpr unsigned long DIM = 64;
+  transducer_model combine = dense_structure.initialize(DIM * 2, DIM);
+  transducer_model encode;
+  encode = transducer_model([&](const value_placeholder& node) {
+    return lazy_ifelse(
+      list_size(node) == value_placeholder::constant(1),
+      node[0],
+      tg::tanh(combine(tensor_concat({encode(node[0]), encode(node[1])}))));
+  });
+  transducer_model encode_all([&](const value_placeholder& trees) {
+    return list_map(encode, trees);
+  });
+
+  std::mt19937 rng(0);
+  std::vector<value_t> trees;
+  for(unsigned long i = 0; i < 64; ++i) {
+    trees.push_back(make_random_tree(std::uniform_int_distribution<unsigned long>(8, 48)(rng), DIM, rng));
+  }
+  value_t batch(trees);
+
+  auto time_encode_all = [&]() {
+    constexpr unsigned long NUM_REPEATS = 5;
+    value_t encodings;
+    wallclock_timer timer;
+    timer.start();
+    for(unsigned long i = 0; i < NUM_REPEATS; ++i) {
+      encodings = encode_all(batch);
+    }
+    cout << timer.microseconds_elapsed() / NUM_REPEATS << "us, first encoding starts with " << encodings[0].as_tensor().to_vector()[0] << endl;
+  };
+
+  cout << "batch of " << trees.size() << " trees, agenda-based batching: ";
+  time_encode_all();
+  {
+    depth_scheduled_batching_guard _;
+    cout << "batch of " << trees.size() << " trees, depth-scheduled batching: ";
+    time_encode_all();
+  }
+
+  return 0;
+}
@@ -11,8 +11,13 @@ std::pair<std::vector<value_t>, value_t>
 generic_rnn_model::transduce_impl(const value_t& init_state, const std::vector<value_t>& xs) {
   auto state = init_state;
   vector<value_t> ys;
-  for (auto&& x:xs) {
-    auto [y, next_state] = rnn_cell_m->transduce_impl(rnn_cell_m->null_state_to_default_state(state), x);
+
+  // when the cell supports it, the input-to-hidden part of all timesteps is computed up front
+  auto projected_xs = rnn_cell_m->project_inputs(xs);
+  for (unsigned long t = 0; t < xs.size(); ++t) {
+    auto prev_state = rnn_cell_m->null_state_to_default_state(state);
+    auto [y, next_state] = projected_xs.empty() ? rnn_cell_m->transduce_impl(prev_state, xs[t])
+                                                : rnn_cell_m->transduce_projected_impl(prev_state, projected_xs[t]);
     ys.push_back(y);
     state = next_state;
   }
@@ -28,6 +33,10 @@ string generic_rnn_model::default_name() const {
   return "RNN";
 }
 
+void generic_rnn_model::fuse_gates() {
+  if(auto fused = rnn_cell_m->to_fused_gates()) rnn_cell_m = move(fused);
+}
+
 value_t generic_rnn_model::transduce(const value_t& init_state, const value_t& xs) {
   auto[ys, state] = transduce_impl(init_state, xs.as_list());
   return value_t({value_t(move(ys)), state});
@@ -72,10 +81,16 @@ unsigned long generic_stacked_rnn_model::num_stacks() const {
   return rnns_m.size();
 }
 
+void generic_stacked_rnn_model::fuse_gates() {
+  for(auto&& rnn:rnns_m) {
+    rnn.fuse_gates();
+  }
+}
+
 
 value_t generic_stacked_rnn_model::transduce(const value_t& init_state, const value_t& xs) {
   bool use_default_state = init_state.is_null();
-  auto[ys, final_state] = transduce_impl(use_default_state ? vector<value_t>(rnns_m.size()) : init_state.as_list(),
+  auto[ys, final_state] = transduce_impl(use_default_state ? vector<value_t>(rnns_m.size()) : vector<value_t>(init_state.as_list()),
                                          xs.as_list());
   return value_t({value_t(ys), value_t(final_state)});
 }
@@ -86,6 +101,11 @@ string generic_bidirectional_rnn_model::default_name() const {
   return "BiRNN";
 }
 
+void generic_bidirectional_rnn_model::fuse_gates() {
+  if(auto fused = forward_cell_m->to_fused_gates()) forward_cell_m = move(fused);
+  if(auto fused = backward_cell_m->to_fused_gates()) backward_cell_m = move(fused);
+}
+
 
 std::pair<std::vector<value_t>, std::pair<value_t, value_t>>
 generic_bidirectional_rnn_model::transduce_impl(const std::pair<value_t, value_t>& init_state,
@@ -93,9 +113,12 @@ generic_bidirectional_rnn_model::transduce_impl(const std::pair<value_t, value_t
   vector<value_t> forward_ys;
   value_t forward_state = init_state.first;
   {
-
-    for (auto&& x:xs) {
-      auto [y, next_state] = forward_cell_m->transduce_impl(forward_cell_m->null_state_to_default_state(forward_state), x);
+    // when the cell supports it, the input-to-hidden part of all timesteps is computed up front
+    auto projected_xs = forward_cell_m->project_inputs(xs);
+    for (unsigned long t = 0; t < xs.size(); ++t) {
+      auto prev_state = forward_cell_m->null_state_to_default_state(forward_state);
+      auto [y, next_state] = projected_xs.empty() ? forward_cell_m->transduce_impl(prev_state, xs[t])
+                                                  : forward_cell_m->transduce_projected_impl(prev_state, projected_xs[t]);
       forward_ys.push_back(y);
       forward_state = next_state;
     }
@@ -103,9 +126,11 @@ generic_bidirectional_rnn_model::transduce_impl(const std::pair<value_t, value_t
   vector<value_t> backward_ys_reversed;
   value_t backward_state = init_state.second;
   {
-
-    for (auto itr = xs.rbegin(); itr != xs.rend(); ++itr) {
-      auto [y, next_state] = backward_cell_m->transduce_impl(forward_cell_m->null_state_to_default_state(backward_state), *itr);
+    auto projected_xs = backward_cell_m->project_inputs(xs);
+    for (unsigned long t = xs.size(); t-- > 0;) {
+      auto prev_state = forward_cell_m->null_state_to_default_state(backward_state);
+      auto [y, next_state] = projected_xs.empty() ? backward_cell_m->transduce_impl(prev_state, xs[t])
+                                                  : backward_cell_m->transduce_projected_impl(prev_state, projected_xs[t]);
       backward_ys_reversed.push_back(y);
       backward_state = next_state;
     }
@@ -181,6 +206,12 @@ unsigned long generic_stacked_bidirectional_rnn_model::num_stacks() const {
   return birnns_m.size();
 }
 
+void generic_stacked_bidirectional_rnn_model::fuse_gates() {
+  for(auto&& birnn:birnns_m) {
+    birnn.fuse_gates();
+  }
+}
+
 
 value_t generic_stacked_bidirectional_rnn_model::transduce(const value_t& _init_state, const value_t& xs) {
   std::vector<std::pair<value_t, value_t>> init_state;
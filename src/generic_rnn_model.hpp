@@ -38,6 +38,10 @@ namespace tg {
 
     /**
      * Apply the RNN model on a sequence of inputs
+     *
+     * If the cell supports it (see rnn_cell_base::project_inputs()), the input-to-hidden part of all timesteps is computed up front,
+     * and each timestep only computes the hidden-to-hidden part.
+     *
      * \param init_state the initial state, pass NULL for default state.
      * \param xs the sequence of inputs
      * \return (1) the sequence of outputs
@@ -49,6 +53,11 @@ namespace tg {
 
     std::string default_name() const;
 
+    /**
+     * \brief Replace the RNN cells with their fused-gate counterparts (see rnn_cell_base::to_fused_gates()), keeping the weights
+     */
+    void fuse_gates();
+
   };
 
   /**
@@ -100,6 +109,11 @@ namespace tg {
 
     std::string default_name() const;
 
+    /**
+     * \brief Replace the RNN cells with their fused-gate counterparts (see rnn_cell_base::to_fused_gates()), keeping the weights
+     */
+    void fuse_gates();
+
   };
 
   /**
@@ -132,6 +146,9 @@ namespace tg {
 
     /**
      * Apply the bidirectional RNN on a sequence of inputs
+     *
+     * Same as generic_rnn_model::transduce_impl(), the input-to-hidden part of all timesteps is computed up front when the cells support it.
+     *
      * \param init_state the initial state for (1) forward RNN and (2) backward RNN.
      *                   Pass a pair of NULLs for default initial states.
      * \param xs the sequence of inputs
@@ -146,6 +163,11 @@ namespace tg {
 
     std::string default_name() const;
 
+    /**
+     * \brief Replace the RNN cells with their fused-gate counterparts (see rnn_cell_base::to_fused_gates()), keeping the weights
+     */
+    void fuse_gates();
+
   };
 
   /**
@@ -201,6 +223,11 @@ namespace tg {
 
     std::string default_name() const;
 
+    /**
+     * \brief Replace the RNN cells with their fused-gate counterparts (see rnn_cell_base::to_fused_gates()), keeping the weights
+     */
+    void fuse_gates();
+
   };
 }
 
@@ -0,0 +1,145 @@
+//
+// Created by Dekai WU and YAN Yuchen on 20201215.
+//
+
+#include "gradient_buffer.hpp"
+#include "include/parallel_array_map.hpp"
+#include <set>
+
+using namespace tg;
+using namespace std;
+
+namespace __private_gradient_buffer {
+  void add_to(vector<float>& buffer, const float* grad, unsigned long size) {
+    if(buffer.empty()) {
+      buffer.assign(grad, grad + size);
+      return;
+    }
+    for(unsigned long i=0; i<size; ++i) {
+      buffer[i] += grad[i];
+    }
+  }
+}
+using namespace __private_gradient_buffer;
+
+void gradient_buffer::accumulate(dynet::ParameterNodeBase* node, const dynet::Tensor& grad) {
+  auto values = dynet::as_vector(grad);
+  if(auto lookup_node = dynamic_cast<dynet::LookupNode*>(node)) {
+    auto& storage = lookup_node->params.get_storage();
+    auto row_size = storage.dim.size();
+    auto& rows = lookup_row_grads_m[&storage];
+    if(lookup_node->pindex) {
+      add_to(rows[*lookup_node->pindex], values.data(), row_size);
+    }
+    else {
+      auto&& indices = *lookup_node->pindices;
+      for(unsigned long k=0; k<indices.size(); ++k) {
+        add_to(rows[indices[k]], values.data() + k * row_size, row_size);
+      }
+    }
+  }
+  else if(auto param_node = dynamic_cast<dynet::ParameterNode*>(node)) {
+    if(param_node->params.p != nullptr) {
+      add_to(dense_grads_m[&param_node->params.get_storage()], values.data(), values.size());
+    }
+    else {
+      add_to(lookup_table_grads_m[&param_node->lparams.get_storage()], values.data(), values.size());
+    }
+  }
+  else {
+    node->accumulate_grad(grad);
+  }
+}
+
+void gradient_buffer::clear() {
+  dense_grads_m.clear();
+  lookup_table_grads_m.clear();
+  lookup_row_grads_m.clear();
+}
+
+bool gradient_buffer::empty() const {
+  return dense_grads_m.empty() && lookup_table_grads_m.empty() && lookup_row_grads_m.empty();
+}
+
+unsigned long gradient_buffer::for_each_gradient(
+  const std::function<bool(dynet::ParameterCollection*, float*, const std::vector<float>&)>& fn) const {
+  unsigned long num_rows = 0;
+  for(auto&& [storage, grad]:dense_grads_m) {
+    fn(storage->owner, storage->values.v, grad);
+  }
+  for(auto&& [storage, grad]:lookup_table_grads_m) {
+    if(fn(storage->owner, storage->all_values.v, grad)) num_rows += storage->values.size();
+  }
+  for(auto&& [storage, rows]:lookup_row_grads_m) {
+    for(auto&& [index, grad]:rows) {
+      if(fn(storage->owner, storage->values[index].v, grad)) ++num_rows;
+    }
+  }
+  return num_rows;
+}
+
+void gradient_buffer::reduce_into_parameters(std::vector<gradient_buffer>& buffers, parallel_map_thread_pool& workers) {
+  set<dynet::ParameterStorage*> dense_params;
+  set<dynet::LookupParameterStorage*> lookup_params;
+  for(auto&& buffer:buffers) {
+    for(auto&& [storage, _]:buffer.dense_grads_m) dense_params.insert(storage);
+    for(auto&& [storage, _]:buffer.lookup_table_grads_m) lookup_params.insert(storage);
+    for(auto&& [storage, _]:buffer.lookup_row_grads_m) lookup_params.insert(storage);
+  }
+
+  // every parameter is reduced by exactly one task, so tasks never write to the same parameter
+  vector<function<void()>> tasks;
+  for(auto storage:dense_params) {
+    tasks.emplace_back([&buffers, storage]() {
+      vector<float> sum;
+      for(auto&& buffer:buffers) {
+        auto found = buffer.dense_grads_m.find(storage);
+        if(found == buffer.dense_grads_m.end()) continue;
+        add_to(sum, found->second.data(), found->second.size());
+      }
+      storage->accumulate_grad(dynet::Tensor(storage->dim, sum.data(), storage->values.device, dynet::DeviceMempool::NONE));
+    });
+  }
+  for(auto storage:lookup_params) {
+    tasks.emplace_back([&buffers, storage]() {
+      vector<float> table_sum;
+      map<unsigned, vector<float>> row_sums;
+      for(auto&& buffer:buffers) {
+        auto found_table = buffer.lookup_table_grads_m.find(storage);
+        if(found_table != buffer.lookup_table_grads_m.end()) {
+          add_to(table_sum, found_table->second.data(), found_table->second.size());
+        }
+        auto found_rows = buffer.lookup_row_grads_m.find(storage);
+        if(found_rows != buffer.lookup_row_grads_m.end()) {
+          for(auto&& [index, grad]:found_rows->second) {
+            add_to(row_sums[index], grad.data(), grad.size());
+          }
+        }
+      }
+      if(!table_sum.empty()) {
+        storage->accumulate_grad(dynet::Tensor(storage->all_dim, table_sum.data(), storage->all_values.device, dynet::DeviceMempool::NONE));
+      }
+      for(auto&& [index, grad]:row_sums) {
+        storage->accumulate_grad(index, dynet::Tensor(storage->dim, grad.data(), storage->all_values.device, dynet::DeviceMempool::NONE));
+      }
+    });
+  }
+
+  workers.for_each<function<void()>>(tasks, [](const function<void()>& task) {
+    task();
+  });
+
+  for(auto&& buffer:buffers) {
+    buffer.clear();
+  }
+}
+
+gradient_buffer_guard::gradient_buffer_guard(gradient_buffer& buffer) : prev_sink_m(std::move(dynet::parameter_gradient_sink)) {
+  dynet::parameter_gradient_sink = [&buffer](dynet::ParameterNodeBase* node, const dynet::Tensor& grad) {
+    buffer.accumulate(node, grad);
+  };
+}
+
+gradient_buffer_guard::~gradient_buffer_guard() {
+  dynet::parameter_gradient_sink = std::move(prev_sink_m);
+}
@@ -0,0 +1,86 @@
+//
+// Created by Dekai WU and YAN Yuchen on 20201215.
+//
+/// \cond SHOW_INTERNAL_IMPL
+#ifndef LEGO_GRADIENT_BUFFER_HPP
+#define LEGO_GRADIENT_BUFFER_HPP
+
+#include <dynet/exec.h>
+#include <dynet/param-nodes.h>
+#include <unordered_map>
+#include <vector>
+#include <map>
+#include <functional>
+
+namespace tg {
+  class parallel_map_thread_pool;
+
+  /**
+   * \brief Holds the parameter gradients of a batch, separately from the gradients stored inside the parameters.
+   *
+   * During synchronous data-parallel training, every batch in flight writes into its own gradient buffer,
+   * so that concurrent backward passes never race on the shared parameter gradients.
+   * The buffers are then summed up into the parameters by reduce_into_parameters().
+   */
+  class gradient_buffer {
+    std::unordered_map<dynet::ParameterStorage*, std::vector<float>> dense_grads_m;
+    std::unordered_map<dynet::LookupParameterStorage*, std::vector<float>> lookup_table_grads_m;
+    std::unordered_map<dynet::LookupParameterStorage*, std::map<unsigned, std::vector<float>>> lookup_row_grads_m;
+
+  public:
+
+    /**
+     * \brief Accumulate the gradient of a parameter node into this buffer
+     * \param node The parameter node
+     * \param grad The gradient of the parameter node
+     */
+    void accumulate(dynet::ParameterNodeBase* node, const dynet::Tensor& grad);
+
+    /**
+     * \brief Discard all gradients in this buffer
+     */
+    void clear();
+
+    /**
+     * \brief Check if this buffer holds no gradient
+     * \return True if no gradient has been accumulated since the last clear()
+     */
+    bool empty() const;
+
+    /**
+     * \brief Visit every parameter (or every lookup table row) that has a gradient in this buffer
+     * \param fn Receives the parameter collection that owns the parameter, a pointer to the parameter values, and the gradient.
+     *           Returns whether it used the gradient.
+     * \return The number of lookup table rows whose gradient was used
+     */
+    unsigned long for_each_gradient(const std::function<bool(dynet::ParameterCollection* owner, float* values, const std::vector<float>& grad)>& fn) const;
+
+    /**
+     * \brief Sum up the buffers and accumulate the result into the gradients stored inside the parameters.
+     *
+     * Different parameters are reduced concurrently by the worker threads.
+     * For each parameter, the buffers are summed in the order they appear in the list,
+     * so the result does not depend on thread scheduling.
+     *
+     * All buffers are cleared afterwards.
+     *
+     * \param buffers The buffers to reduce
+     * \param workers The worker threads that perform the reduction
+     */
+    static void reduce_into_parameters(std::vector<gradient_buffer>& buffers, parallel_map_thread_pool& workers);
+  };
+
+  /**
+   * \brief Redirects all parameter gradients computed on the current thread into a gradient buffer during its lifetime.
+   */
+  class gradient_buffer_guard {
+    decltype(dynet::parameter_gradient_sink) prev_sink_m;
+  public:
+    explicit gradient_buffer_guard(gradient_buffer& buffer);
+    gradient_buffer_guard(const gradient_buffer_guard&) = delete;
+    gradient_buffer_guard& operator=(const gradient_buffer_guard&) = delete;
+    ~gradient_buffer_guard();
+  };
+}
+
+#endif //LEGO_GRADIENT_BUFFER_HPP
@@ -0,0 +1,442 @@
+//
+// Created by Dekai WU and YAN Yuchen on 20201228.
+//
+
+#include "graph_replay.hpp"
+#include "transducer_variant.hpp"
+#include "lambda_transducer_value_cache.hpp"
+#include "include/lego_guard.hpp"
+
+using namespace std;
+using namespace tg;
+
+struct graph_replay::trace {
+  struct step {
+    enum class opcode : unsigned char {
+      constant,
+      make_list,
+      transduce,
+      lazy_transduce
+    };
+    opcode op{};
+
+    /**
+     * \brief The transducer to apply (when op is transduce or lazy_transduce)
+     */
+    std::weak_ptr<transducer_variant> transducer;
+
+    unsigned long operands_begin{};
+
+    unsigned long num_operands{};
+
+    /**
+     * \brief Which operands a lazy transducer evaluated (when op is lazy_transduce)
+     */
+    unsigned char evaluated_mask{};
+
+    /**
+     * \brief The steps that computed each evaluated operand (when op is lazy_transduce)
+     *
+     * They follow the lazy step, and are replayed when the lazy transducer evaluates the operand.
+     */
+    unsigned long operand_steps_begin[3]{};
+
+    unsigned long operand_steps_end[3]{};
+
+    /**
+     * \brief The index of the first step after the lazy step and its operand steps (when op is lazy_transduce)
+     */
+    unsigned long steps_end{};
+
+    unsigned long result{};
+
+    /**
+     * \brief The value (when op is constant)
+     */
+    value_t constant;
+  };
+
+  std::vector<step> steps;
+
+  /**
+   * \brief The operands of all the steps
+   */
+  std::vector<unsigned long> operands;
+
+  /**
+   * \brief The number of values, the inputs followed by the results of the steps
+   */
+  unsigned long num_values{};
+
+  unsigned long result{};
+};
+
+thread_local graph_replay::state_t graph_replay::state = graph_replay::state_t::idle;
+thread_local bool graph_replay::is_entering_root = false;
+thread_local unsigned long graph_replay::num_opaque_calls = 0;
+thread_local const lambda_transducer_value_cache* graph_replay::opaque_call_boundary = nullptr;
+thread_local unsigned long graph_replay::last_returned = 0;
+thread_local std::unordered_map<const value_t*, unsigned long> graph_replay::slots;
+thread_local std::vector<graph_replay::lazy_frame> graph_replay::lazy_frames;
+thread_local std::shared_ptr<graph_replay::trace> graph_replay::recording;
+
+namespace tg {
+  namespace __private_graph_replay {
+
+    /**
+     * \brief Describe the structure of a value: its type, and for lists, the length and the structure of every item
+     */
+    void append_signature(const value_t& x, std::vector<long>& signature) {
+      if(x.is_list()) {
+        auto&& items = x.as_list();
+        signature.push_back((long)items.size());
+        for(auto&& item:items) {
+          append_signature(item, signature);
+        }
+      }
+      else if(x.is_null()) signature.push_back(-1);
+      else if(x.is_integer()) signature.push_back(-2);
+      else if(x.is_float()) signature.push_back(-3);
+      else if(x.is_symbol()) signature.push_back(-4);
+      else if(x.is_tensor()) signature.push_back(-5);
+      else signature.push_back(-6);
+    }
+  }
+}
+
+graph_replay::cache& graph_replay::cache::operator=(const graph_replay::cache&) {
+  std::lock_guard<std::mutex> _(mutex_m);
+  traces_m.clear();
+  return *this;
+}
+
+graph_replay::cache& graph_replay::cache::operator=(graph_replay::cache&&) noexcept {
+  std::lock_guard<std::mutex> _(mutex_m);
+  traces_m.clear();
+  return *this;
+}
+
+bool graph_replay::is_ready() {
+  return state == state_t::idle && graph_replay_guard::is_guarded();
+}
+
+void graph_replay::abort() {
+  state = state_t::aborted;
+}
+
+void graph_replay::observe_scope_in_opaque_call(const lambda_transducer_value_cache* scope) {
+  for(auto outside = opaque_call_boundary; outside != nullptr; outside = outside->parent) {
+    if(outside == scope) {
+      abort();
+      return;
+    }
+  }
+}
+
+unsigned long graph_replay::lookup(const value_t* slot) {
+  auto itr = slots.find(slot);
+  if(itr == slots.end()) {
+    // the value comes from outside of the recording (for example, from an enclosing lambda transducer)
+    abort();
+    return 0;
+  }
+  return itr->second;
+}
+
+void graph_replay::define(const value_t& slot) {
+  slots[&slot] = recording->num_values++;
+}
+
+value_t graph_replay::transduce(cache& traces, const value_t* const* inputs, unsigned long num_inputs, const std::function<value_t()>& evaluate) {
+  std::vector<long> signature;
+  for(unsigned long i = 0; i < num_inputs; ++i) {
+    __private_graph_replay::append_signature(*inputs[i], signature);
+  }
+
+  std::shared_ptr<const trace> found;
+  bool is_known;
+  {
+    std::lock_guard<std::mutex> _(traces.mutex_m);
+    auto itr = traces.traces_m.find(signature);
+    is_known = itr != traces.traces_m.end();
+    if(is_known) found = itr->second;
+    else if(traces.traces_m.size() >= MAX_TRACES) return evaluate();
+  }
+
+  if(is_known) {
+    if(!found) return evaluate();
+    value_t ret;
+    bool replayed;
+    try {
+      replayed = replay(*found, inputs, num_inputs, ret);
+    }
+    catch(...) {
+      replayed = false;
+    }
+    if(replayed) return ret;
+
+    // the replay diverged from the trace or failed, and what it has constructed so far is left unused
+    {
+      std::lock_guard<std::mutex> _(traces.mutex_m);
+      traces.traces_m[signature] = nullptr;
+    }
+    return evaluate();
+  }
+
+  // record a new trace
+  state = state_t::recording;
+  recording = std::make_shared<trace>();
+
+  // the inputs are identified by the input slots of the lambda transducer, since the same value may be passed as several inputs
+  recording->num_values = num_inputs;
+  is_entering_root = true;
+
+  auto finish = [&]() {
+    state = state_t::idle;
+    is_entering_root = false;
+    num_opaque_calls = 0;
+    slots.clear();
+    lazy_frames.clear();
+    recording.reset();
+  };
+
+  value_t ret;
+  try {
+    ret = evaluate();
+  }
+  catch(...) {
+    finish();
+    throw;
+  }
+
+  std::shared_ptr<const trace> recorded;
+  if(state == state_t::recording) {
+    recording->result = last_returned;
+    recorded = recording;
+  }
+  finish();
+
+  {
+    std::lock_guard<std::mutex> _(traces.mutex_m);
+    traces.traces_m.emplace(std::move(signature), std::move(recorded));
+  }
+  return ret;
+}
+
+bool graph_replay::replay(const trace& t, const value_t* const* inputs, unsigned long num_inputs, value_t& result) {
+  std::vector<value_t> values(t.num_values);
+  for(unsigned long i = 0; i < num_inputs; ++i) {
+    values[i] = *inputs[i];
+  }
+  if(!replay_steps(t, 0, t.steps.size(), values)) return false;
+  result = values[t.result];
+  return true;
+}
+
+bool graph_replay::replay_steps(const trace& t, unsigned long begin, unsigned long end, std::vector<value_t>& values) {
+  using opcode = trace::step::opcode;
+  const value_t* operands[8];
+  for(auto i = begin; i < end;) {
+    auto&& step = t.steps[i];
+    auto&& value = values[step.result];
+    if(step.op == opcode::constant) {
+      value = step.constant;
+    }
+    else if(step.op == opcode::make_list) {
+      std::vector<value_t> items;
+      items.reserve(step.num_operands);
+      for(unsigned long j = 0; j < step.num_operands; ++j) {
+        items.push_back(values[t.operands[step.operands_begin + j]]);
+      }
+      value = value_t(std::move(items));
+    }
+    else {
+      auto transducer = step.transducer.lock();
+      if(!transducer) return false;
+      if(step.op == opcode::transduce) {
+        for(unsigned long j = 0; j < step.num_operands; ++j) {
+          operands[j] = &values[t.operands[step.operands_begin + j]];
+        }
+        value = transducer->_apply(operands, step.num_operands);
+      }
+      else {
+        // the lazy transducer must evaluate exactly the operands it evaluated when recorded,
+        // and the steps of an operand are only replayed once the lazy transducer asks for it
+        unsigned char evaluated_mask = 0;
+        bool diverged = false;
+        auto make_getter = [&](unsigned long j) {
+          return [&, j]() -> value_t {
+            auto bit = (unsigned char)(1u << j);
+            if(diverged || !(step.evaluated_mask & bit)) {
+              diverged = true;
+              return value_t();
+            }
+            if(!(evaluated_mask & bit)) {
+              evaluated_mask |= bit;
+              if(!replay_steps(t, step.operand_steps_begin[j], step.operand_steps_end[j], values)) {
+                diverged = true;
+                return value_t();
+              }
+            }
+            return values[t.operands[step.operands_begin + j]];
+          };
+        };
+        value = transducer->visit([&](auto&& op) -> value_t {
+          constexpr auto traits = transducer_variant::transducer_traits<decltype(op)>();
+          if constexpr (traits.is_lazy) {
+            return op.lazy_transduce(make_getter(0), make_getter(1), make_getter(2));
+          }
+          else {
+            throw std::runtime_error("Cannot replay a non-lazy transducer as a lazy one");
+          }
+        });
+        if(diverged || evaluated_mask != step.evaluated_mask) return false;
+        i = step.steps_end;
+        continue;
+      }
+    }
+    ++i;
+  }
+  return true;
+}
+
+void graph_replay::enter_lambda(const value_t* const* input_slots, const value_t* const* inputs, unsigned long num_inputs) {
+  if(!is_recording()) return;
+  for(unsigned long i = 0; i < num_inputs; ++i) {
+    slots[input_slots[i]] = is_entering_root ? i : lookup(inputs[i]);
+  }
+  is_entering_root = false;
+}
+
+void graph_replay::leave_lambda(const value_t& result) {
+  if(!is_recording()) return;
+  last_returned = lookup(&result);
+}
+
+void graph_replay::record_constant(const value_t& result) {
+  if(!is_recording()) return;
+  trace::step step;
+  step.op = trace::step::opcode::constant;
+  step.constant = result;
+  step.result = recording->num_values;
+  recording->steps.push_back(std::move(step));
+  define(result);
+}
+
+void graph_replay::record_make_list(const std::vector<const value_t*>& items, const value_t& result) {
+  if(!is_recording()) return;
+  trace::step step;
+  step.op = trace::step::opcode::make_list;
+  step.operands_begin = recording->operands.size();
+  step.num_operands = items.size();
+  for(auto&& item:items) {
+    recording->operands.push_back(lookup(item));
+  }
+  step.result = recording->num_values;
+  recording->steps.push_back(std::move(step));
+  define(result);
+}
+
+graph_replay::call::call(transducer_variant* transducer, const value_t* const* operands, unsigned long num_operands) :
+  active_m(is_recording()) {
+  if(!active_m) return;
+  transducer_m = transducer;
+  is_lambda_m = std::holds_alternative<lambda_transducer_model>(transducer->v);
+  if(is_lambda_m) return;
+
+  num_operands_m = num_operands;
+  for(unsigned long i = 0; i < num_operands; ++i) {
+    operands_m[i] = lookup(operands[i]);
+  }
+
+  // nothing is recorded within a transducer that is recorded as a single step
+  if(num_opaque_calls++ == 0) opaque_call_boundary = lambda_transducer_value_cache::top;
+}
+
+graph_replay::call::~call() {
+  if(active_m && !is_lambda_m) --num_opaque_calls;
+}
+
+void graph_replay::call::commit(const value_t& result) {
+  if(!active_m) return;
+  if(!is_lambda_m) --num_opaque_calls;
+  active_m = false;
+  if(!is_recording()) return;
+
+  // an inlined lambda transducer results in the value it returns
+  if(is_lambda_m) {
+    slots[&result] = last_returned;
+    return;
+  }
+
+  auto weak = transducer_m->weak_from_this();
+  if(weak.expired()) {
+    abort();
+    return;
+  }
+  trace::step step;
+  step.op = trace::step::opcode::transduce;
+  step.transducer = std::move(weak);
+  step.operands_begin = recording->operands.size();
+  step.num_operands = num_operands_m;
+  recording->operands.insert(recording->operands.end(), operands_m, operands_m + num_operands_m);
+  step.result = recording->num_values;
+  recording->steps.push_back(std::move(step));
+  define(result);
+}
+
+graph_replay::lazy_call::lazy_call(transducer_variant* transducer) : active_m(is_recording()) {
+  if(!active_m) return;
+
+  // the lazy step goes before the steps of its operands, and is filled in on commit
+  trace::step step;
+  step.op = trace::step::opcode::lazy_transduce;
+  recording->steps.push_back(std::move(step));
+  auto index = recording->steps.size() - 1;
+  lazy_frames.push_back(lazy_frame{transducer, {}, 0, index, index + 1});
+}
+
+graph_replay::lazy_call::~lazy_call() {
+  if(!active_m) return;
+  // not committed, so the lazy step is left incomplete
+  lazy_frames.pop_back();
+  abort();
+}
+
+void graph_replay::lazy_call::commit(const value_t& result) {
+  if(!active_m) return;
+  auto frame = lazy_frames.back();
+  lazy_frames.pop_back();
+  active_m = false;
+  if(!is_recording()) return;
+
+  auto weak = frame.transducer->weak_from_this();
+  if(weak.expired() || frame.next_operand_steps != recording->steps.size()) {
+    abort();
+    return;
+  }
+  auto& step = recording->steps[frame.step];
+  step.transducer = std::move(weak);
+  step.operands_begin = recording->operands.size();
+  step.num_operands = 3;
+  step.evaluated_mask = frame.evaluated_mask;
+  step.steps_end = recording->steps.size();
+  recording->operands.insert(recording->operands.end(), frame.operands, frame.operands + 3);
+  step.result = recording->num_values;
+  define(result);
+}
+
+void graph_replay::observe_lazy_operand(unsigned long operand_index, const value_t& operand) {
+  if(!is_recording() || lazy_frames.empty() || operand_index >= 3) return;
+  auto& frame = lazy_frames.back();
+  auto bit = (unsigned char)(1u << operand_index);
+  if(frame.evaluated_mask & bit) return;
+  frame.operands[operand_index] = lookup(&operand);
+  frame.evaluated_mask |= bit;
+
+  // the steps recorded since the previous operand computed this one
+  auto& step = recording->steps[frame.step];
+  step.operand_steps_begin[operand_index] = frame.next_operand_steps;
+  step.operand_steps_end[operand_index] = recording->steps.size();
+  frame.next_operand_steps = recording->steps.size();
+}
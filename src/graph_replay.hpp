@@ -0,0 +1,227 @@
+//
+// Created by Dekai WU and YAN Yuchen on 20201228.
+//
+/// \cond SHOW_INTERNAL_IMPL
+#ifndef LEGO_GRAPH_REPLAY_HPP
+#define LEGO_GRAPH_REPLAY_HPP
+
+#include "include/transducer_typed_value.hpp"
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace tg {
+
+  class transducer_variant;
+  struct lambda_transducer_value_cache;
+
+  /**
+   * \brief Records the transducers that a lambda transducer ends up applying, and replays them on inputs of the same structure.
+   *
+   * While enabled (see tg::graph_replay_guard), the first application of a lambda transducer on inputs of a given structure
+   * (the types of the inputs, and the lengths of the lists, recursively) is recorded into a trace.
+   * Nested lambda transducers are inlined into the trace. Every other transducer is recorded as a single step, with its operands and its result.
+   * Later applications on inputs of the same structure replay the trace directly,
+   * skipping the scopes, the placeholder lookups and the lazy evaluation of the lambda transducers.
+   *
+   * Each lazy operation (for example, lazy_ifelse) is recorded together with the operands that it evaluated,
+   * and the steps that computed each operand are nested under it, so that they are replayed only when the lazy operation asks for that operand.
+   * If a replay evaluates different operands (for example, takes the other branch), or a step throws,
+   * the structure is marked as not replayable, and the lambda transducer is evaluated as usual from then on.
+   *
+   * The steps are replayed on the new inputs, so they still construct their nodes in the computation graph.
+   */
+  class graph_replay {
+  public:
+    struct trace;
+
+    /**
+     * \brief The traces of one lambda transducer, keyed by the structure of the inputs
+     *
+     * A copy starts empty, since the traces refer to the transducers of the original.
+     */
+    class cache {
+    public:
+      cache() = default;
+      cache(const cache&) {}
+      cache(cache&&) noexcept {}
+      cache& operator=(const cache&);
+      cache& operator=(cache&&) noexcept;
+    private:
+      friend class graph_replay;
+      std::mutex mutex_m;
+
+      /**
+       * \brief nullptr means that the structure is not replayable
+       */
+      std::map<std::vector<long>, std::shared_ptr<const trace>> traces_m;
+    };
+
+    /**
+     * \brief The maximum number of input structures to remember per lambda transducer
+     */
+    static constexpr unsigned long MAX_TRACES = 1024;
+
+    /**
+     * \brief Whether a lambda transducer application may be recorded or replayed
+     *
+     * True if tg::graph_replay_guard is guarded, and no recording is in progress on this thread.
+     */
+    static bool is_ready();
+
+    /**
+     * \brief Whether the steps are being recorded
+     */
+    static bool is_recording() {
+      return state == state_t::recording && num_opaque_calls == 0;
+    }
+
+    /**
+     * \brief Apply a lambda transducer, by replaying a trace if possible, otherwise by evaluating it (and recording a trace if possible)
+     * \param traces The traces of the lambda transducer
+     * \param inputs The inputs
+     * \param num_inputs The number of inputs
+     * \param evaluate Evaluates the lambda transducer as usual
+     * \return The result
+     */
+    static value_t transduce(cache& traces, const value_t* const* inputs, unsigned long num_inputs, const std::function<value_t()>& evaluate);
+
+    /**
+     * \brief Records that a lambda transducer starts, whose input slots hold copies of the given inputs
+     * \param input_slots The input slots of the lambda transducer
+     * \param inputs The inputs
+     * \param num_inputs The number of inputs
+     */
+    static void enter_lambda(const value_t* const* input_slots, const value_t* const* inputs, unsigned long num_inputs);
+
+    /**
+     * \brief Records that a lambda transducer returns
+     * \param result The slot holding the return value
+     */
+    static void leave_lambda(const value_t& result);
+
+    static void record_constant(const value_t& result);
+
+    static void record_make_list(const std::vector<const value_t*>& items, const value_t& result);
+
+    /**
+     * \brief Records a transducer application, for as long as the object lives
+     *
+     * Lambda transducers are inlined. Every other transducer is recorded as a single step, and nothing is recorded while it runs.
+     * Does nothing when not recording.
+     */
+    class call {
+    public:
+      call(transducer_variant* transducer, const value_t* const* operands, unsigned long num_operands);
+      call(const call&) = delete;
+      call(call&&) noexcept = delete;
+      call& operator=(const call&) = delete;
+      call& operator=(call&&) noexcept = delete;
+      ~call();
+
+      /**
+       * \brief Records the result of the application
+       * \param result The slot holding the result
+       */
+      void commit(const value_t& result);
+    private:
+      bool active_m;
+      bool is_lambda_m{};
+      transducer_variant* transducer_m{};
+      unsigned long operands_m[8]{};
+      unsigned long num_operands_m{};
+    };
+
+    /**
+     * \brief Records a lazy transducer application, for as long as the object lives
+     *
+     * The operands are recorded as they are evaluated (see observe_lazy_operand()).
+     * Does nothing when not recording.
+     */
+    class lazy_call {
+    public:
+      explicit lazy_call(transducer_variant* transducer);
+      lazy_call(const lazy_call&) = delete;
+      lazy_call(lazy_call&&) noexcept = delete;
+      lazy_call& operator=(const lazy_call&) = delete;
+      lazy_call& operator=(lazy_call&&) noexcept = delete;
+      ~lazy_call();
+
+      /**
+       * \brief Records the result of the application
+       * \param result The slot holding the result
+       */
+      void commit(const value_t& result);
+    private:
+      bool active_m;
+    };
+
+    /**
+     * \brief Records that the innermost lazy transducer application has evaluated an operand
+     * \param operand_index The index of the operand
+     * \param operand The operand value
+     */
+    static void observe_lazy_operand(unsigned long operand_index, const value_t& operand);
+
+    /**
+     * \brief Records that a value is read from the given scope
+     *
+     * A transducer recorded as a single step cannot be replayed if it reads a scope that exists outside of it
+     * (for example, a nested lambda transducer mapped over a list reads from its enclosing lambda transducer),
+     * since that scope does not exist when replaying.
+     *
+     * \param scope The scope
+     */
+    static void observe_scope(const lambda_transducer_value_cache* scope) {
+      if(state == state_t::recording && num_opaque_calls > 0) observe_scope_in_opaque_call(scope);
+    }
+
+  private:
+    enum class state_t : unsigned char {
+      idle,
+      recording,
+      aborted
+    };
+
+    struct lazy_frame {
+      transducer_variant* transducer;
+      unsigned long operands[3];
+      unsigned char evaluated_mask;
+
+      /**
+       * \brief The index of the step that records the lazy transducer application
+       */
+      unsigned long step;
+
+      /**
+       * \brief Where the steps of the next evaluated operand begin
+       */
+      unsigned long next_operand_steps;
+    };
+
+    static void abort();
+    static void observe_scope_in_opaque_call(const lambda_transducer_value_cache* scope);
+    static unsigned long lookup(const value_t* slot);
+    static void define(const value_t& slot);
+    static bool replay(const trace& t, const value_t* const* inputs, unsigned long num_inputs, value_t& result);
+    static bool replay_steps(const trace& t, unsigned long begin, unsigned long end, std::vector<value_t>& values);
+
+    thread_local static state_t state;
+    thread_local static bool is_entering_root;
+    thread_local static unsigned long num_opaque_calls;
+
+    /**
+     * \brief The innermost scope when the outermost transducer recorded as a single step starts
+     */
+    thread_local static const lambda_transducer_value_cache* opaque_call_boundary;
+    thread_local static unsigned long last_returned;
+    thread_local static std::unordered_map<const value_t*, unsigned long> slots;
+    thread_local static std::vector<lazy_frame> lazy_frames;
+    thread_local static std::shared_ptr<trace> recording;
+  };
+}
+
+#endif //LEGO_GRAPH_REPLAY_HPP
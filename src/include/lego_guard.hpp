@@ -51,6 +51,79 @@ namespace tg {
    * TODO: implement the usage of this NaN debugging
    */
   DEFINE_THREAD_LOCAL_GUARD(immediate_computation_guard)
+
+  /**
+   * \brief When guarded, NaN and Inf values are traced back to where they originate, without re-evaluating anything.
+   *
+   * Every node in the computation graph is annotated with the transducer and the datum it is constructed for.
+   * When a NaN or Inf value is encountered, the values already computed are scanned for the nodes it originates from,
+   * and the error reports the node, the transducer and the datum index.
+   *
+   * Takes precedence over re-evaluating in immediate mode (see tg::immediate_computation_guard).
+   */
+  DEFINE_THREAD_LOCAL_GUARD(numerical_health_guard)
+
+  /**
+   * \brief When guarded, datums that produce NaN or Inf values are dropped from the batch, instead of failing the batch.
+   *
+   * Applies to batch training (backward) and batch application.
+   * Datums dropped from a batch application yield null, and the rest of the batch is not computed again.
+   * In batch training, dropping datums builds and runs the forward pass of the whole batch again without them,
+   * because autobatching may have computed the dropped datums together with the rest. So every batch that
+   * drops datums costs at least one extra forward pass, and one more for every further pass that finds new offending datums.
+   * Implies tg::numerical_health_guard for locating the offending datums.
+   * If NaN or Inf values originate from a parameter, which is shared by the whole batch, the batch still fails.
+   */
+  DEFINE_THREAD_LOCAL_GUARD(nan_or_inf_quarantine_guard)
+
+  /**
+   * \brief When guarded, lambda transducers replay the transducers they applied before, for inputs of the same structure.
+   *
+   * The first application of a lambda transducer on inputs of a given structure (the types, and the lengths of the lists) is recorded.
+   * Later applications on inputs of the same structure replay the recording on the new inputs,
+   * skipping the evaluation of the lambda transducers (including the nested ones).
+   *
+   * If a lazy operation (for example, lazy_ifelse) decides differently from the recording,
+   * the lambda transducer is evaluated as usual for inputs of that structure from then on.
+   *
+   * See also training_pipeline::set_graph_replay().
+   */
+  DEFINE_THREAD_LOCAL_GUARD(graph_replay_guard)
+
+  /**
+   * \brief When guarded, a dense layer (with a bias) followed by an activation (relu, tanh or sigmoid) is computed as a single computation graph node.
+   *
+   * Applies to adjacent stages of a composed transducer (for example, compose(relu, dense)),
+   * and to lambda transducers where the output of a dense layer is only consumed by an activation (for example, relu(dense(x))).
+   * The results are the same either way. Useful for comparing the timing with and without fusion.
+   * Other transducers following a dense layer (for example, dropout) are not fused.
+   *
+   * See also training_pipeline::set_operator_fusion().
+   */
+  DEFINE_THREAD_LOCAL_GUARD(operator_fusion_guard)
+
+  /**
+   * \brief When guarded, the computation graph is executed level by level: all the nodes at the same depth (the longest path from the inputs) that perform the same operation are batched together.
+   *
+   * For recursive transducers (for example, tree encoders), the depth of a node follows the height of the subtree it encodes,
+   * so the sibling subtrees of all the datums in a batch are computed together, regardless of the shapes of the trees.
+   * Without this guard, the default agenda-based autobatching is used, which may interleave the levels.
+   *
+   * See also training_pipeline::set_depth_scheduled_batching().
+   */
+  class depth_scheduled_batching_guard {
+    static thread_local unsigned num_instances;
+  public:
+    static bool is_guarded() {
+      return num_instances > 0;
+    }
+    depth_scheduled_batching_guard();
+    depth_scheduled_batching_guard(const depth_scheduled_batching_guard&) = delete;
+    depth_scheduled_batching_guard(depth_scheduled_batching_guard&&) noexcept = delete;
+    depth_scheduled_batching_guard &operator=(const depth_scheduled_batching_guard&) = delete;
+    depth_scheduled_batching_guard &operator=(depth_scheduled_batching_guard&&) noexcept = delete;
+    ~depth_scheduled_batching_guard();
+  };
   /// @}
 }
 
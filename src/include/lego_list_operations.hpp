@@ -120,6 +120,10 @@ namespace tg {
 
   /**
    * \brief Concatenate multiple lists into a list
+   *
+   * Shares the first list and appends the items of the others, so it takes time linear in their total length
+   * (plus the length of the first list, when it cannot be appended in place, see tg::value_list).
+   *
    * \param lists The lists to concatenate
    * \return The concatenated list
    */
@@ -15,4 +15,22 @@
 #include <cereal/types/tuple.hpp>
 #include <cereal/types/deque.hpp>
 
+namespace tg {
+  /**
+   * \brief Set the number of threads used when saving and loading datasets and models
+   *
+   * Datasets and models are saved in independent chunks, so that the chunks can be encoded and decoded in parallel.
+   * Defaults to the number of hardware threads.
+   *
+   * \param num_threads The number of threads
+   */
+  void set_num_serialization_threads(unsigned long num_threads);
+
+  /**
+   * \brief Get the number of threads used when saving and loading datasets and models
+   * \return The number of threads
+   */
+  unsigned long get_num_serialization_threads();
+}
+
 #endif //LEGO_LEGO_SERIALIZATION_HELPER_HPP
@@ -77,6 +77,144 @@ namespace tg {
    */
   unsigned long tensor_num_values(const tensor_shape_t& shape);
 
+  /**
+   * \brief A shared, read-only, aligned array of floats.
+   *
+   * The values are allocated once, aligned to tensor_values_t::ALIGNMENT bytes,
+   * and shared by every copy. Taking a sub-range with slice() also shares the values.
+   * So copying tensors around never copies their values.
+   *
+   * Offers the read-only interface of std::vector<float>.
+   */
+  class tensor_values_t {
+  public:
+    using value_type = float;
+    using size_type = std::size_t;
+    using const_iterator = const float*;
+    using iterator = const_iterator;
+
+    /**
+     * \brief The alignment (in bytes) of newly allocated values
+     *
+     * Wide enough for AVX-512 loads.
+     */
+    static constexpr std::size_t ALIGNMENT = 64;
+
+    tensor_values_t() = default;
+    tensor_values_t(const tensor_values_t&) = default;
+    tensor_values_t(tensor_values_t&&) noexcept = default;
+    tensor_values_t& operator=(const tensor_values_t&) = default;
+    tensor_values_t& operator=(tensor_values_t&&) noexcept = default;
+
+    /**
+     * \brief Copies the values of a vector into a newly allocated aligned array
+     * \param values The values
+     */
+    tensor_values_t(const std::vector<float>& values);
+
+    /**
+     * \brief Copies a range of floats into a newly allocated aligned array
+     * \param begin Pointer to the first value
+     * \param end Pointer to one past the last value
+     * \return The values
+     */
+    static tensor_values_t copy_of(const float* begin, const float* end);
+
+    /**
+     * \brief Allocates an aligned array filled with the same value
+     * \param size The number of values
+     * \param value The value to fill with
+     * \return The values
+     */
+    static tensor_values_t filled(size_type size, float value);
+
+    /**
+     * \brief Allocates an aligned array, and lets the caller write the initial values
+     *
+     * This is the only way to write into a tensor_values_t, and happens before the values can be shared.
+     *
+     * \param size The number of values
+     * \param init Called once with a pointer to the uninitialized values
+     * \return The values
+     */
+    template<typename F>
+    static tensor_values_t create(size_type size, F&& init) {
+      auto buffer = allocate(size);
+      init(buffer.get());
+      return tensor_values_t(std::move(buffer), size);
+    }
+
+    /**
+     * \brief Views values that live in memory owned by something else, without copying them
+     *
+     * For example, the values stored in a memory-mapped file.
+     * The memory must stay unmodified for as long as the values are in use.
+     *
+     * \param owner Keeps the memory alive, as long as any copy of the values exists
+     * \param data Pointer to the first value
+     * \param size The number of values
+     * \return The values
+     */
+    static tensor_values_t view_of(std::shared_ptr<const void> owner, const float* data, size_type size);
+
+    size_type size() const { return size_m; }
+
+    bool empty() const { return size_m == 0; }
+
+    const float* data() const { return data_m; }
+
+    const_iterator begin() const { return data_m; }
+
+    const_iterator end() const { return data_m + size_m; }
+
+    const float& operator[](size_type i) const { return data_m[i]; }
+
+    const float& front() const { return data_m[0]; }
+
+    const float& back() const { return data_m[size_m - 1]; }
+
+    /**
+     * \brief A sub-range of the values, sharing the same array
+     * \param begin Index of the first value
+     * \param end One past the index of the last value
+     * \return The sub-range
+     */
+    tensor_values_t slice(size_type begin, size_type end) const;
+
+    /**
+     * \brief Whether the first value is aligned to tensor_values_t::ALIGNMENT bytes
+     *
+     * Values are always aligned when allocated, but a slice may not be.
+     */
+    bool is_aligned() const;
+
+    /**
+     * \brief A pointer to the first value, which keeps the whole array alive
+     *
+     * Useful for handing the values to something that outlives this object, like a computation graph.
+     */
+    std::shared_ptr<const float> shared_data() const;
+
+    /**
+     * \brief Copies the values into a std::vector
+     * \return The values
+     */
+    std::vector<float> to_vector() const;
+
+    template<typename Archive>
+    void save(Archive& ar) const;
+
+    template<typename Archive>
+    void load(Archive& ar);
+
+  private:
+    static std::shared_ptr<float> allocate(size_type size);
+    tensor_values_t(std::shared_ptr<const float> buffer, size_type size);
+    std::shared_ptr<const float> buffer_m;
+    const float* data_m{};
+    size_type size_m{};
+  };
+
   /**
    * \brief Represents a tensor.
    *
@@ -86,12 +224,14 @@ namespace tg {
    * \begin{bmatrix}1 & 3 & 5 \\2 & 4 & 6 \end{bmatrix}
    * \$f
    *
+   * The values are shared between copies. reshape() and slicing the outermost axis share the values
+   * of the original tensor, other slices and transpose() gather the values into a newly allocated array.
    */
   struct tensor_t {
     /**
-     * \brief The values
+     * \brief The values, in column major
      */
-    std::vector<float> values;
+    tensor_values_t values;
 
     /**
      * \brief The tensor shape
@@ -116,6 +256,13 @@ namespace tg {
      */
     tensor_t(std::vector<float> values, tensor_shape_t shape);
 
+    /**
+     * \brief Constructs a tensor given values and shape, sharing the values
+     * \param values The values of the tensor, in column major
+     * \param shape The shape of the tensor
+     */
+    tensor_t(tensor_values_t values, tensor_shape_t shape);
+
     /**
      * \brief Constructs a rank-1 tensor given values
      *
@@ -149,6 +296,45 @@ namespace tg {
       decltype(std::end(std::declval<T>()))>* _ = nullptr):tensor_t(std::vector<float>(values.begin(), values.end())) {
     }
 
+    /**
+     * \brief The values in column major order
+     * \return The values
+     */
+    std::vector<float> to_vector() const;
+
+    /**
+     * \brief View the tensor in another shape
+     *
+     * Does not copy the values.
+     *
+     * \param shape The new shape. Must have the same number of values.
+     * \return The reshaped tensor
+     */
+    tensor_t reshape(tensor_shape_t shape) const;
+
+    /**
+     * \brief Take a range along one axis
+     *
+     * Does not copy the values if every axis after the sliced axis has length 1.
+     *
+     * \param axis The axis to slice
+     * \param begin The first index (inclusive) along the axis
+     * \param end The last index (exclusive) along the axis
+     * \return The sliced tensor
+     */
+    tensor_t slice(unsigned long axis, unsigned long begin, unsigned long end) const;
+
+    /**
+     * \brief Permute the axes of the tensor
+     *
+     * Follows the same convention as dynet::transpose.
+     * Copies the values, unless the permutation only moves axes of length 1 around.
+     *
+     * \param dims The new order of the axes. Defaults to swapping the two axes of a matrix.
+     * \return The transposed tensor
+     */
+    tensor_t transpose(const std::vector<unsigned long>& dims = {1, 0}) const;
+
     friend std::ostream& operator<<(std::ostream& os, const tensor_t& x);
 
     /**
@@ -178,8 +364,24 @@ namespace tg {
      * \return the tensor filled with ones
      */
     static tensor_t ones(const tensor_shape_t& shape);
+
+  private:
+    std::vector<unsigned long> column_major_strides() const;
+    static tensor_values_t gather(const float* first, const tensor_shape_t& shape, const std::vector<unsigned long>& strides);
   };
 
+  /**
+   * \brief Add a concrete tensor into a computation graph as an input node
+   *
+   * Unlike dynet::input, the values are not copied into the graph.
+   * The graph shares the values and keeps them alive until it is cleared.
+   *
+   * \param cg The computation graph
+   * \param x The tensor
+   * \return The input node
+   */
+  symbolic_tensor_t tensor_input(dynet::ComputationGraph& cg, const tensor_t& x);
+
   /**
    * \brief Prints out a tensor in human-readible form
    *
@@ -191,6 +393,36 @@ namespace tg {
    */
   std::ostream& operator<<(std::ostream& os, const tg::tensor_t& x);
 
+  template<typename Archive>
+  void tensor_values_t::save(Archive& ar) const {
+    // same format as std::vector<float>
+    ar(cereal::make_size_tag(static_cast<cereal::size_type>(size_m)));
+    if constexpr (cereal::traits::is_output_serializable<cereal::BinaryData<float>, Archive>::value) {
+      ar(cereal::binary_data(data_m, size_m * sizeof(float)));
+    }
+    else {
+      for(auto&& x:*this) {
+        ar(x);
+      }
+    }
+  }
+
+  template<typename Archive>
+  void tensor_values_t::load(Archive& ar) {
+    cereal::size_type len;
+    ar(cereal::make_size_tag(len));
+    *this = create(len, [&](float* out) {
+      if constexpr (cereal::traits::is_input_serializable<cereal::BinaryData<float>, Archive>::value) {
+        ar(cereal::binary_data(out, len * sizeof(float)));
+      }
+      else {
+        for(cereal::size_type i=0; i<len; ++i) {
+          ar(out[i]);
+        }
+      }
+    });
+  }
+
   /// @}
 }
 
@@ -6,8 +6,12 @@
 #define LEGO_LEGO_TRAINING_PIPELINE_HPP
 #include "transducer_optimizer.hpp"
 #include "transducer_model.hpp"
+#include "transducer_dataset.hpp"
+#include "parallel_array_map.hpp"
+#include "lego_guard.hpp"
 
 #include <atomic>
+#include <optional>
 
 namespace tg {
 
@@ -28,23 +32,113 @@ namespace tg {
    *   - [optional] Report progress during training
    */
   class training_pipeline {
+  public:
+    /**
+     * \brief Reads the next datum from an input source.
+     *
+     * Should write the datum into the argument and return true, or return false if the source has been exhausted.
+     */
+    using datum_source_t = std::function<bool(std::vector<value_t>& datum)>;
+
+    /**
+     * \brief Receives the output of a datum, together with the index of the datum in the input source.
+     */
+    using result_callback_t = std::function<void(unsigned long index, const value_t& result)>;
+
+  private:
     std::unordered_set<backprop_trainable_parameter_base*> params_to_train;
     unsigned long num_epochs_m{1};
     std::chrono::steady_clock::duration report_interval{std::chrono::seconds(10)};
     unsigned long num_workers_m{1};
     unsigned long batch_size_m{1};
+    unsigned long batch_cost_budget_m{0};
     bool shuffle_m{false};
+    unsigned long max_pending_updates_m{0};
+    unsigned long batches_per_step_m{0};
+    bool bucketing_m{false};
+    bool graph_replay_m{false};
+    bool depth_scheduled_batching_m{false};
+    bool operator_fusion_m{false};
+    datum_size_fn_t datum_size_fn_m{default_datum_size};
     event_emitter<> epoch_completion_listener_m;
     event_emitter<> new_best_listener_m;
     event_emitter<> before_training_datum_listener_m;
 
     optimizer_base* optimizer_m;
 
+    /**
+     * \brief The state that the worker threads share with the pipeline
+     *
+     * Kept on the heap, so that the pipeline stays movable while the worker threads hold on to this state.
+     */
+    struct runtime_state {
+      /**
+       * \brief The worker threads, reused across train, validate and transduce_many calls.
+       *
+       * Created on first use, and re-created when the number of workers changes.
+       */
+      std::unique_ptr<parallel_map_thread_pool> workers;
+
+      /**
+       * \brief Locks while the worker threads are in use, since a thread pool can only run one task at a time.
+       *
+       * Only held for the duration of one parallel task (see workers_lease), never while firing listeners.
+       */
+      std::mutex workers_mtx;
+
+      /**
+       * \brief Stores the number of training datum that have been trained across all epochs (failed datum does not count)
+       */
+      std::atomic<unsigned long> num_training_datums_completed{0};
+    };
+    std::unique_ptr<runtime_state> state_m;
+
+    /**
+     * \brief The runtime state of the pipeline whose tasks the current thread runs, if any
+     *
+     * Set permanently on the worker threads, and on the calling thread while it holds a workers_lease (with a single worker, the tasks run on the calling thread).
+     */
+    static thread_local const runtime_state* worker_thread_owner;
+
+    /**
+     * \brief Exclusive use of the worker threads for one parallel task
+     *
+     * Holds runtime_state::workers_mtx until destruction.
+     * If the current thread is already running a task of this pipeline (for example, a listener fired while training calls transduce_many),
+     * waiting for the workers would deadlock, so the nested task runs inline on the current thread instead.
+     */
+    class workers_lease {
+      std::unique_lock<std::mutex> lock_m;
+      std::optional<parallel_map_thread_pool> inline_workers_m;
+      parallel_map_thread_pool* workers_m{};
+      const runtime_state* prev_owner_m{};
+    public:
+      explicit workers_lease(const training_pipeline& pipeline);
+      workers_lease(const workers_lease&) = delete;
+      workers_lease(workers_lease&&) noexcept = delete;
+      workers_lease& operator=(const workers_lease&) = delete;
+      workers_lease& operator=(workers_lease&&) noexcept = delete;
+      ~workers_lease();
+      parallel_map_thread_pool& operator*() const;
+    };
 
     /**
-     * \brief Stores the number of training datum that have been trained across all epochs (failed datum does not count)
+     * \brief The modes a worker applies the models in (graph replay, depth-scheduled batching and operator fusion), as configured on the pipeline
+     *
+     * The modes are thread local guards, so each task holds one of these on the thread it runs on, until destruction.
      */
-    std::atomic<unsigned long> num_training_datums_completed_m;
+    class worker_mode_guards {
+      std::optional<graph_replay_guard> replay_m;
+      std::optional<depth_scheduled_batching_guard> schedule_by_depth_m;
+      std::optional<operator_fusion_guard> fusion_m;
+    public:
+      explicit worker_mode_guards(const training_pipeline& pipeline);
+      worker_mode_guards(const worker_mode_guards&) = delete;
+      worker_mode_guards(worker_mode_guards&&) noexcept = delete;
+      worker_mode_guards& operator=(const worker_mode_guards&) = delete;
+      worker_mode_guards& operator=(worker_mode_guards&&) noexcept = delete;
+    };
+
 
     /**
      * \brief Stores the number of epochs completed.
@@ -103,6 +197,9 @@ namespace tg {
      *
      * Having N threads training concurrently will increase the memory usage roughly by a factor of N.
      *
+     * The worker threads are spawned once and reused by all subsequent train, validate and transduce_many calls on this pipeline.
+     * Calls that need the worker threads run one at a time.
+     *
      * Note that when using GPU, the training speed might be bottlenecked by GPU so increasing number of training threads might not be beneficial depending on the hardware and your model.
      *
      * \param workers number of worker threads to spawn
@@ -122,6 +219,20 @@ namespace tg {
      */
     void set_batch_size(unsigned long batch_size);
 
+    /**
+     * \brief Set the cost budget of a batch.
+     *
+     * When set to a non-zero value, batches are no longer formed by a fixed number of datums.
+     * Instead, datums are packed into a batch until their total size (see set_datum_size_function()) reaches the budget,
+     * which keeps the graph size and memory usage of every batch roughly the same.
+     * A datum that alone exceeds the budget is processed in a batch on its own.
+     *
+     * Setting to zero (the default) falls back to the fixed batch size set by set_batch_size().
+     *
+     * \param cost_budget The maximum total size of a batch
+     */
+    void set_batch_cost_budget(unsigned long cost_budget);
+
     /**
      * \brief Enable/Disable shuffling
      *
@@ -131,6 +242,99 @@ namespace tg {
      */
     void set_shuffle(bool should_shuffle);
 
+    /**
+     * \brief Enable/Disable pipelined training
+     *
+     * If enabled, the optimizer step of a batch runs in a background thread,
+     * while the worker thread goes on to construct the computation graph of the next batch.
+     * This hides the graph construction time behind the parameter updates.
+     * The forward pass of the next batch still waits for the pending update before reading the parameters.
+     *
+     * With a single worker thread, the losses and progress reports are the same as without pipelining.
+     * With multiple worker threads, the batches that are pending together are applied in one optimizer step.
+     * All pending updates are applied before validating at the end of each epoch.
+     * With synchronous data-parallel training (see set_synchronous_data_parallel()), every step waits for the update of the previous step
+     * before any of its batches starts, so pipelining does not overlap anything there.
+     *
+     * See optimizer_base::set_pipelined_update() for details.
+     *
+     * \param max_pending_batches The maximum number of batches waiting for their parameter update. Setting to zero disables pipelining.
+     */
+    void set_pipelined_update(unsigned long max_pending_batches);
+
+    /**
+     * \brief Enable/Disable synchronous data-parallel training
+     *
+     * By default, every worker thread updates the model right after its own batch,
+     * and the gradients of batches running concurrently race on the same parameters.
+     *
+     * If enabled, the batches are trained in groups of batches_per_step.
+     * Every batch in a group writes its gradient into its own buffer.
+     * After the whole group is done, the buffers are summed up (in a deterministic order) and the model is updated once.
+     * A good choice of batches_per_step is the number of workers, or a multiple of it.
+     *
+     * \param batches_per_step The number of batches per parameter update. Setting to zero disables synchronous data-parallel training.
+     */
+    void set_synchronous_data_parallel(unsigned long batches_per_step);
+
+    /**
+     * \brief Enable/Disable length bucketing
+     *
+     * If enabled, datums of similar sizes are grouped into the same batch (see set_datum_size_function()),
+     * so that a batch does not mix very short and very long datums.
+     * When shuffling is also enabled, datums of the same size are shuffled before grouping, and then the batches are shuffled.
+     *
+     * Inference results (transduce_many()) are always returned in the original order of the dataset.
+     *
+     * The dynamic_* functions throw if bucketing is enabled, since a dynamic transducer application has no datum to measure.
+     *
+     * \param should_bucket Whether to enable length bucketing
+     */
+    void set_bucketing(bool should_bucket);
+
+    /**
+     * \brief Enable/Disable graph replay
+     *
+     * If enabled, the worker threads apply the models under tg::graph_replay_guard when training, validating and transducing.
+     * Datums of the same structure (for example, sentences of the same length) then skip evaluating the lambda transducers,
+     * by replaying what the first of them applied.
+     *
+     * \param should_replay Whether to enable graph replay
+     */
+    void set_graph_replay(bool should_replay);
+
+    /**
+     * \brief Enable/Disable depth-scheduled batching
+     *
+     * If enabled, the worker threads execute the computation graph under tg::depth_scheduled_batching_guard when training, validating and transducing.
+     * Each batch is then computed level by level, which suits recursive models over trees of different shapes.
+     *
+     * \param should_schedule_by_depth Whether to enable depth-scheduled batching
+     */
+    void set_depth_scheduled_batching(bool should_schedule_by_depth);
+
+    /**
+     * \brief Enable/Disable operator fusion
+     *
+     * If enabled, the worker threads apply the models under tg::operator_fusion_guard when training, validating and transducing.
+     * A dense layer followed by relu, tanh or sigmoid then becomes a single computation graph node (dropout is not fused).
+     *
+     * \param should_fuse Whether to enable operator fusion
+     */
+    void set_operator_fusion(bool should_fuse);
+
+    /**
+     * \brief Set the function that measures the size of a datum
+     *
+     * By default, the size of a datum is the sum of the lengths of its list values (see default_datum_size()). Memory-mapped and packed datasets
+     * know this size without materializing the datum (see transducer_dataset::datum_size()), other functions make them decode every datum.
+     *
+     * For the dynamic_* functions, the datum being measured is a unary datum holding the index of the transducer application.
+     *
+     * \param size_fn The function that computes the size of a datum
+     */
+    void set_datum_size_function(datum_size_fn_t size_fn);
+
     /**
      * \brief Train a model on a training set.
      * \param loss_model the transducer model that returns the loss to minimize.
@@ -206,6 +410,30 @@ namespace tg {
      */
     std::vector<value_t> transduce_many(transducer_model perf, const std::shared_ptr<const transducer_dataset>& dataset);
 
+    /**
+     * \brief Apply a model on a stream of datums.
+     *
+     * Similar to transduce_many(), but the datums are read from an input source on demand,
+     * and the outputs are delivered to a callback as soon as their batches finish.
+     * Only a bounded number of batches are held in memory at once, so this is suitable for datasets that do not fit in memory.
+     *
+     * The datums are grouped in batches by the batch size or the batch cost budget, in the order they are read.
+     * (Length bucketing does not apply, because the dataset is never seen as a whole.)
+     *
+     * The callback is never called concurrently. If the callback blocks (for example, pushing into a bounded queue),
+     * the workers will stop reading new datums once the limit of in-flight batches is reached.
+     *
+     * Throws if a datum does not match the arity of the model, after the batches already in flight are delivered.
+     * The datums read with it in the same batch, and after it, are not transduced.
+     *
+     * \param perf The model to apply
+     * \param source The input source. It is never called concurrently.
+     * \param on_result The callback that receives the outputs
+     * \param preserve_order Whether to deliver the outputs in the same order as the datums are read
+     * \param max_in_flight_batches The maximum number of batches being processed or waiting for delivery. Zero means twice the number of workers.
+     */
+    void transduce_stream(transducer_model perf, const datum_source_t& source, const result_callback_t& on_result, bool preserve_order = true, unsigned long max_in_flight_batches = 0);
+
     /**
      * \brief Apply a dynamic transducer on a dataset
      *
@@ -285,7 +513,43 @@ namespace tg {
     void remove_epoch_completion_listener(const event_emitter<>::listener_handle_t& listener);
     
   private:
-    void train_and_validate_impl(const std::shared_ptr<const transducer_dataset>& training_set, const std::shared_ptr<const transducer_dataset>& validation_set, const std::function<float(const std::shared_ptr<transducer_dataset>&)>& learn_from_training_set_batch, const std::function<float(const std::shared_ptr<transducer_dataset>&)>& compute_loss_from_validation_set_batch);
+    /**
+     * \brief Get the worker threads, creating them (and their thread local memory pools) only when necessary.
+     *
+     * The caller must hold runtime_state::workers_mtx (see workers_lease).
+     *
+     * \return The worker threads
+     */
+    parallel_map_thread_pool& get_workers() const;
+
+    /**
+     * \brief Throw if length bucketing is enabled, for the dynamic_* functions
+     * \param caller The name of the calling function, for the error message
+     */
+    void ensure_no_bucketing(const std::string& caller) const;
+
+    /**
+     * \brief Group a dataset in batches according to the current batching settings
+     * \param dataset The dataset to group
+     * \param shuffle Whether to shuffle the batches
+     * \return The indices of the datums in each batch
+     */
+    std::vector<std::vector<unsigned long>> group_indices_to_batch(const std::shared_ptr<const transducer_dataset>& dataset, bool shuffle) const;
+
+    std::vector<std::shared_ptr<transducer_dataset>> group_to_batch(const std::shared_ptr<const transducer_dataset>& dataset, bool shuffle) const;
+
+    /**
+     * \brief Estimate the cost of every batch, as the total size of its datums (see set_datum_size_function())
+     *
+     * Used as scheduling hints, so that the workers start with the most expensive batches.
+     * Only used when the processing order does not matter (validation and inference).
+     *
+     * \param batches The batches
+     * \return The estimated cost of every batch
+     */
+    std::vector<unsigned long> estimate_batch_costs(const std::vector<std::shared_ptr<transducer_dataset>>& batches) const;
+
+    void train_and_validate_impl(const std::shared_ptr<const transducer_dataset>& training_set, const std::shared_ptr<const transducer_dataset>& validation_set, const std::function<float(const std::shared_ptr<transducer_dataset>&)>& backward_on_training_set_batch, const std::function<float(const std::shared_ptr<transducer_dataset>&)>& compute_loss_from_validation_set_batch);
 
     float validate_impl(const std::shared_ptr<const transducer_dataset>& validation_set, const std::function<float(const std::shared_ptr<transducer_dataset>&)>& compute_loss_from_validation_set_batch) const;
   };
@@ -10,6 +10,13 @@
 #include <atomic>
 #include <mutex>
 #include <condition_variable>
+#include <deque>
+#include <algorithm>
+#include <numeric>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <string>
 
 namespace tg {
 
@@ -222,6 +229,55 @@ namespace tg {
   }
 
 
+  /**
+   * \brief A reusable barrier that spins for a short while before blocking.
+   *
+   * When all threads arrive close together (which is the common case when a thread pool dispatches a task),
+   * no mutex is taken at all. This is much lighter than tg::latch, which locks a mutex on every arrival.
+   *
+   * The barrier resets itself automatically once all threads have arrived, so it can be reused right away.
+   */
+  class spin_barrier {
+    const std::size_t count_m;
+    std::atomic<std::size_t> remaining_m;
+    std::atomic<std::size_t> generation_m{0};
+    std::atomic<std::size_t> num_sleeping_m{0};
+    std::mutex mtx_m;
+    std::condition_variable cond_m;
+
+    static constexpr unsigned spin_limit = 1u << 14;
+  public:
+    explicit spin_barrier(std::size_t count) : count_m(count), remaining_m(count) {}
+    spin_barrier(const spin_barrier&) = delete;
+    spin_barrier& operator=(const spin_barrier&) = delete;
+
+    /**
+     * \brief Block until all threads have arrived at the barrier.
+     */
+    void arrive_and_wait() {
+      std::size_t generation = generation_m.load();
+      if(remaining_m.fetch_sub(1) == 1) {
+        remaining_m.store(count_m);
+        generation_m.fetch_add(1);
+        if(num_sleeping_m.load() > 0) {
+          std::lock_guard<std::mutex> lock(mtx_m);
+          cond_m.notify_all();
+        }
+        return;
+      }
+
+      for(unsigned i=0; i<spin_limit; ++i) {
+        if(generation_m.load() != generation) return;
+        if((i & 63u) == 63u) std::this_thread::yield();
+      }
+
+      std::unique_lock<std::mutex> lock(mtx_m);
+      num_sleeping_m.fetch_add(1);
+      cond_m.wait(lock, [&]() {return generation_m.load() != generation;});
+      num_sleeping_m.fetch_sub(1);
+    }
+  };
+
   /**
    * \brief Spawns a thread pool to perform parallel_array_map() or parallel_for_each()
    *
@@ -232,13 +288,26 @@ namespace tg {
    *
    * This will eliminate overhead of initializing thread_local variables each time when creating new threads, if you believe this overhead is non-trivial in your task.
    *
+   * Items are scheduled by work stealing: every worker owns a queue of items, and a worker that runs out of items
+   * steals from the other workers. When cost hints are given, the most expensive items are processed first,
+   * so that an expensive item does not end up running alone at the end.
+   *
    */
   class parallel_map_thread_pool {
+
+    /**
+     * \brief The queue of item indices owned by a worker. Other workers may steal from it.
+     */
+    struct work_queue {
+      std::mutex mtx;
+      std::deque<unsigned long> items;
+    };
+
     unsigned long num_workers_m;
-    latch idle_latch;
-    latch completion_latch;
+    spin_barrier start_barrier;
+    spin_barrier completion_barrier;
     bool should_terminate_m{false};
-    std::function<void()> task_m;
+    std::function<void(unsigned long worker_id)> task_m;
     std::vector<std::thread> threads;
 
     // The prefix of the progress report
@@ -248,16 +317,56 @@ namespace tg {
     // Zero means no report
     std::chrono::steady_clock::duration report_interval_m{std::chrono::steady_clock::duration::zero()};
 
+    /**
+     * \brief Run a task on every worker, passing the id of the worker.
+     */
+    void run_on_workers(const std::function<void(unsigned long worker_id)>& task) {
+      if(num_workers_m > 1) {
+        task_m = task;
+        start_barrier.arrive_and_wait();
+        completion_barrier.arrive_and_wait();
+      }
+      else {
+        task(0);
+      }
+    }
+
+    /**
+     * \brief Take the next item for a worker. Takes from its own queue first, and steals from other workers' queues when empty.
+     * \return false if there is no item left.
+     */
+    static bool take_item(std::vector<work_queue>& queues, unsigned long worker_id, unsigned long& item) {
+      {
+        auto& own = queues[worker_id];
+        std::lock_guard<std::mutex> lock(own.mtx);
+        if(!own.items.empty()) {
+          item = own.items.front();
+          own.items.pop_front();
+          return true;
+        }
+      }
+      for(unsigned long offset = 1; offset < queues.size(); ++offset) {
+        auto& victim = queues[(worker_id + offset) % queues.size()];
+        std::lock_guard<std::mutex> lock(victim.mtx);
+        if(!victim.items.empty()) {
+          item = victim.items.back();
+          victim.items.pop_back();
+          return true;
+        }
+      }
+      return false;
+    }
+
   public:
-    explicit parallel_map_thread_pool(unsigned num_workers):num_workers_m(num_workers), idle_latch(num_workers + 1), completion_latch(num_workers + 1) {
+    explicit parallel_map_thread_pool(unsigned num_workers):num_workers_m(num_workers), start_barrier(num_workers + 1), completion_barrier(num_workers + 1) {
       if(num_workers > 1) {
         for(unsigned long i=0; i<num_workers; ++i) {
-          threads.emplace_back([&](){
+          threads.emplace_back([this, i](){
             while (true) {
-              idle_latch.count_down_and_wait();
+              start_barrier.arrive_and_wait();
               if(should_terminate_m) break;
-              task_m();
-              completion_latch.count_down_and_wait();
+              task_m(i);
+              completion_barrier.arrive_and_wait();
             }
           });
         }
@@ -266,13 +375,22 @@ namespace tg {
 
 
     ~parallel_map_thread_pool() {
+      if(threads.empty()) return;
       should_terminate_m = true;
-      idle_latch.count_down();
+      start_barrier.arrive_and_wait();
       for(auto&& thread:threads) {
         thread.join();
       }
     }
 
+    /**
+     * \brief Get the number of workers in this pool
+     * \return The number of workers
+     */
+    unsigned long num_workers() const {
+      return num_workers_m;
+    }
+
     /**
      * \brief Enabling progress reporting
      *
@@ -302,27 +420,46 @@ namespace tg {
     }
 
     void for_each_worker(const std::function<void()>& task) {
-      if(num_workers_m > 1) {
-        task_m = task;
-        completion_latch.reset(num_workers_m + 1);
-        idle_latch.count_down_and_wait();
-        idle_latch.reset(num_workers_m + 1);
-        completion_latch.count_down_and_wait();
-      }
-      else {
+      run_on_workers([&](unsigned long) {
         task();
-      }
+      });
     }
 
+    /**
+     * \brief Perform a task on every item, with hints on how expensive each item is.
+     *
+     * Items with higher costs are processed first. Items with the same cost are processed roughly in their original order.
+     *
+     * \param ins The items
+     * \param fn The task to perform on an item. Receives the item and its index.
+     * \param cost_hints The estimated cost of every item. Either empty (no hint), or has the same size as the items.
+     */
     template<typename from_T>
-    void for_each(const std::vector<from_T>& ins, const std::function<void(const from_T&, unsigned long i)>& fn) {
+    void for_each(const std::vector<from_T>& ins, const std::function<void(const from_T&, unsigned long i)>& fn, const std::vector<unsigned long>& cost_hints) {
       using steady_clock = std::chrono::steady_clock;
 
-      std::atomic<unsigned long> next_i(0);
+      if(!cost_hints.empty() && cost_hints.size() != ins.size()) {
+        throw std::runtime_error("The number of cost hints must match the number of items");
+      }
+
+      std::vector<unsigned long> order(ins.size());
+      std::iota(order.begin(), order.end(), 0);
+      if(!cost_hints.empty()) {
+        std::stable_sort(order.begin(), order.end(), [&](unsigned long a, unsigned long b) {
+          return cost_hints[a] > cost_hints[b];
+        });
+      }
+
+      // deal the items to the workers in turn, so that every worker starts with its share of the expensive items
+      std::vector<work_queue> queues(std::max(num_workers_m, 1ul));
+      for(unsigned long k=0; k<order.size(); ++k) {
+        queues[k % queues.size()].items.push_back(order[k]);
+      }
 
       if(report_interval_m == steady_clock::duration::zero()) {
-        for_each_worker([&]() {
-          for(unsigned long i = next_i++; i<ins.size(); i = next_i++) {
+        run_on_workers([&](unsigned long worker_id) {
+          unsigned long i;
+          while(take_item(queues, worker_id, i)) {
             fn(ins[i], i);
           }
         });
@@ -330,29 +467,37 @@ namespace tg {
       }
 
       steady_clock::time_point last_report_time = steady_clock::now();
-      unsigned long last_report_check_i = 0;
+      std::atomic<unsigned long> num_completed{0};
+      unsigned long last_report_check_completed = 0;
       std::mutex report_mtx;
       const unsigned long minimum_items_between_report_checks = std::ceil(ins.size()/100);
 
-      for_each_worker([&]() {
-        for(unsigned long i = next_i++; i<ins.size(); i = next_i++) {
+      run_on_workers([&](unsigned long worker_id) {
+        unsigned long i;
+        while(take_item(queues, worker_id, i)) {
           fn(ins[i], i);
-          if(i - last_report_check_i >= minimum_items_between_report_checks) {
-            std::lock_guard<std::mutex> lock(report_mtx);
-            last_report_check_i = i;
+          unsigned long completed = ++num_completed;
+          std::lock_guard<std::mutex> lock(report_mtx);
+          if(completed - last_report_check_completed >= minimum_items_between_report_checks) {
+            last_report_check_completed = completed;
             auto now = steady_clock::now();
             if(now - last_report_time >= report_interval_m) {
               last_report_time = now;
               if(!report_prefix_m.empty()) {
                 std::cerr << report_prefix_m << ": ";
               }
-              std::cerr << i*100/ins.size() << "%" << std::endl;
+              std::cerr << completed*100/ins.size() << "%" << std::endl;
             }
           }
         }
       });
     }
 
+    template<typename from_T>
+    void for_each(const std::vector<from_T>& ins, const std::function<void(const from_T&, unsigned long i)>& fn) {
+      for_each<from_T>(ins, fn, {});
+    }
+
     template<typename from_T>
     void for_each(const std::vector<from_T>& ins, const std::function<void(const from_T&)>& fn) {
       for_each<from_T>(ins, [&](const from_T& x, unsigned long i) {
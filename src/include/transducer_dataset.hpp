@@ -6,9 +6,31 @@
 #define LEGO_TRANSDUCER_DATASET_HPP
 
 #include "transducer_typed_value.hpp"
+#include "lego_serialization_helper.hpp"
+#include <functional>
+#include <cstdint>
+#include <unordered_map>
+#include <string_view>
 
 namespace tg {
 
+  /**
+   * \brief A function that estimates the computational cost of a datum.
+   *
+   * Used to group datums of similar cost into the same batch.
+   */
+  using datum_size_fn_t = std::function<unsigned long(const std::vector<value_t>&)>;
+
+  /**
+   * \brief The default datum size function
+   *
+   * Sums up the lengths of all list values in the datum. A non-list value counts as 1.
+   *
+   * \param datum The datum to measure
+   * \return The size of the datum
+   */
+  unsigned long default_datum_size(const std::vector<value_t>& datum);
+
 
   /**
    * \brief Contains a list of datums for a transducer to transduce on
@@ -23,6 +45,30 @@ namespace tg {
   class transducer_dataset : public std::enable_shared_from_this<transducer_dataset> {
   public:
 
+    /**
+     * \brief A datum handed out by a dataset, usable like a const std::vector<value_t>&
+     *
+     * For datasets that hold their datums as value_t, it refers to the stored datum without copying it,
+     * and stays valid as long as the dataset is alive and unmodified.
+     * For datasets that materialize their datums upon access (see transducer_dataset_lazy_impl), it holds the materialized datum.
+     */
+    class datum_ref {
+      std::shared_ptr<const std::vector<value_t>> owned_m;
+      const std::vector<value_t>* datum_m{};
+    public:
+      using const_iterator = std::vector<value_t>::const_iterator;
+      explicit datum_ref(const std::vector<value_t>& datum) : datum_m(&datum) {}
+      explicit datum_ref(std::vector<value_t>&& datum) : owned_m(std::make_shared<const std::vector<value_t>>(std::move(datum))), datum_m(owned_m.get()) {}
+      inline const std::vector<value_t>& get() const {return *datum_m;}
+      inline operator const std::vector<value_t>&() const {return *datum_m;}
+      inline const value_t& operator[](unsigned long i) const {return (*datum_m)[i];}
+      inline const value_t& at(unsigned long i) const {return datum_m->at(i);}
+      inline unsigned long size() const {return datum_m->size();}
+      inline bool empty() const {return datum_m->empty();}
+      inline const_iterator begin() const {return datum_m->begin();}
+      inline const_iterator end() const {return datum_m->end();}
+    };
+
     class iterator {
       std::shared_ptr<const transducer_dataset> dataset_m;
       unsigned long i;
@@ -32,12 +78,12 @@ namespace tg {
       inline iterator operator++(int) {iterator retval = *this; ++(*this); return retval;}
       inline bool operator==(const iterator& other) const {return i == other.i;}
       inline bool operator!=(const iterator& other) const {return i != other.i;}
-      inline const std::vector<value_t>& operator*() {return dataset_m->at(i);}
+      inline datum_ref operator*() {return dataset_m->at(i);}
       // iterator traits
       using difference_type = long;
       using value_type = std::vector<value_t>;
       using pointer = std::vector<value_t>*;
-      using reference = const std::vector<value_t>&;
+      using reference = datum_ref;
       using iterator_category = std::forward_iterator_tag;
     };
 
@@ -67,10 +113,26 @@ namespace tg {
 
     /**
      * \brief Get a datum at given index
+     *
+     * Datasets that hold their datums as value_t hand out a reference to the stored datum.
+     * Datasets that do not (see transducer_dataset_lazy_impl) build the datum on every access instead of keeping it around.
+     *
      * \param i The index of the datum
      * \return The datum
      */
-    virtual const std::vector<value_t>& at(unsigned long i) const& = 0;
+    virtual datum_ref at(unsigned long i) const = 0;
+
+    /**
+     * \brief Compute the size of a datum
+     *
+     * By default, applies the size function on the datum. Datasets that store the sizes given by default_datum_size()
+     * (or can tell them from how they store the datum) answer it without materializing the datum.
+     *
+     * \param i The index of the datum
+     * \param size_fn The function that computes the size of a datum
+     * \return The size of the datum
+     */
+    virtual unsigned long datum_size(unsigned long i, const datum_size_fn_t& size_fn) const;
 
     /**
      * \brief Take a consecutive slice of this dataset
@@ -93,6 +155,41 @@ namespace tg {
      */
     virtual std::vector<std::shared_ptr<transducer_dataset>> group_to_batch(unsigned long batch_size) const;
 
+    /**
+     * \brief Take an arbitrary selection (or reordering) of this dataset
+     *
+     * This function will return a new dataset referencing the selected datums. The original dataset is untouched.
+     *
+     * \param indices The indices of the datums to select, in the desired order
+     * \return The selected dataset
+     */
+    virtual std::shared_ptr<transducer_dataset> select(std::vector<unsigned long> indices) const;
+
+    /**
+     * \brief Group the dataset in batches of datums with similar sizes
+     *
+     * Datums are sorted by their size (stable, so datums with equal size keep their relative order),
+     * and then cut into consecutive groups of batch_size.
+     *
+     * \param batch_size The batch size
+     * \param size_fn The function that computes the size of a datum
+     * \return The indices of the datums in each batch
+     */
+    std::vector<std::vector<unsigned long>> group_indices_to_bucketed_batch(unsigned long batch_size, const datum_size_fn_t& size_fn = default_datum_size) const;
+
+    /**
+     * \brief Group the dataset in batches whose total size stays within a budget
+     *
+     * Datums are packed into a batch until adding the next datum would exceed the budget.
+     * A datum that alone exceeds the budget forms a batch on its own.
+     *
+     * \param cost_budget The maximum total size of a batch
+     * \param size_fn The function that computes the size of a datum
+     * \param sort_by_size Whether to sort the datums by size before packing (see group_indices_to_bucketed_batch())
+     * \return The indices of the datums in each batch
+     */
+    std::vector<std::vector<unsigned long>> group_indices_to_budgeted_batch(unsigned long cost_budget, const datum_size_fn_t& size_fn = default_datum_size, bool sort_by_size = false) const;
+
     virtual iterator begin() const &;
 
     virtual iterator end() const &;
@@ -142,9 +239,9 @@ namespace tg {
     /**
      * \brief Get a datum at given index
      * \param i The index of the datum
-     * \return The datum
+     * \return A reference to the stored datum
      */
-    const std::vector<value_t>& at(unsigned long i) const& override;
+    datum_ref at(unsigned long i) const override;
 
     /**
       * \brief Insert an N-ary datum to this dataset
@@ -166,8 +263,21 @@ namespace tg {
      */
     void apply_emplace_back(std::vector<value_t> datum);
 
+    /**
+     * \brief Save this dataset in chunks, which are encoded in parallel (see set_num_serialization_threads())
+     *
+     * transducer_dataset::load_from_stream() reads both this format and the older single-archive format.
+     *
+     * \param os The output stream
+     */
     void save_to_stream(std::ostream& os) const override;
 
+    /**
+     * \brief Load a dataset saved by save_to_stream(), decoding the chunks in parallel
+     * \param is The input stream
+     */
+    void load_chunked(std::istream& is);
+
     void save_to_file(const std::string& path) const override;
   };
 
@@ -196,8 +306,195 @@ namespace tg {
 
     unsigned long size() const override;
 
-    const std::vector<value_t>& at(unsigned long i) const& override;
+    datum_ref at(unsigned long i) const override;
+
+    unsigned long datum_size(unsigned long i, const datum_size_fn_t& size_fn) const override;
+
+  };
 
+  /**
+   * \brief Base class of datasets that do not store their datums as value_t, and materialize them upon access
+   *
+   * A datum is materialized on every access and is not kept, so the memory held by the dataset stays
+   * the compact form, no matter how many datums a run touches.
+   */
+  class transducer_dataset_lazy_impl : public transducer_dataset {
+  protected:
+    /**
+     * \brief Materialize a datum
+     * \param i The index of the datum, which is guaranteed to be within range
+     * \return The datum
+     */
+    virtual std::vector<value_t> materialize(unsigned long i) const = 0;
+
+  public:
+    /**
+     * \brief Get a datum at given index
+     *
+     * The datum is materialized on every call, and the returned datum_ref holds it.
+     *
+     * \param i The index of the datum
+     * \return The datum
+     */
+    datum_ref at(unsigned long i) const override;
+  };
+
+  /**
+   * \brief A read-only dataset backed by a memory-mapped file
+   *
+   * The file is in an indexed binary format (see write_to_file()), so opening it only maps the file and reads its header.
+   * Datums are decoded lazily upon access, and the file pages are shared (through the page cache) among all processes
+   * that open the same file. Tensor values are not copied out of the file: the decoded tensors view the mapping,
+   * which stays alive for as long as any of them does.
+   *
+   * The file also stores the default_datum_size() of every datum, so that bucketing and batch cost estimates with
+   * the default size function do not decode any datum.
+   *
+   * To open a dataset of this format, use transducer_dataset::load_from_file(), which detects the format automatically.
+   */
+  class transducer_dataset_mmap_impl : public transducer_dataset_lazy_impl {
+    std::shared_ptr<const char> data_m;
+    unsigned long data_size_m{};
+    unsigned long arity_m{};
+    unsigned long size_m{};
+    const char* index_m{};
+    const char* sizes_m{};
+
+  protected:
+    std::vector<value_t> materialize(unsigned long i) const override;
+
+  public:
+    /**
+     * \brief The magic bytes at the beginning of a memory-mapped dataset file
+     */
+    static constexpr char magic[] = "LEGODSM2";
+
+    /**
+     * \brief Open a dataset file written by write_to_file()
+     * \param path The path to the file
+     */
+    explicit transducer_dataset_mmap_impl(const std::string& path);
+
+    unsigned long arity() const override;
+
+    unsigned long size() const override;
+
+    unsigned long datum_size(unsigned long i, const datum_size_fn_t& size_fn) const override;
+
+    void save_to_file(const std::string& path) const override;
+
+    /**
+     * \brief Write any dataset into the memory-mapped format
+     *
+     * The file contains a header (magic, arity, number of datums, offset of the index),
+     * followed by the datums encoded one after another (see encode_value_binary()), followed by an index holding
+     * the file offset of every datum (plus the end offset of the last one), and then the default_datum_size() of every datum.
+     *
+     * \param dataset The dataset to write
+     * \param path The path to the file
+     */
+    static void write_to_file(const transducer_dataset& dataset, const std::string& path);
+
+    /**
+     * \brief Convert a dataset file saved by transducer_dataset_vec_impl::save_to_file() into the memory-mapped format
+     * \param cereal_path The path to the existing dataset file
+     * \param mmap_path The path to write the converted dataset
+     */
+    static void convert_from_cereal_file(const std::string& cereal_path, const std::string& mmap_path);
+
+    /**
+     * \brief Check whether a file is in the memory-mapped format
+     * \param path The path to the file
+     * \return True if the file starts with the magic bytes
+     */
+    static bool is_mmap_file(const std::string& path);
+  };
+
+  /**
+   * \brief A dataset that packs its datums into a few contiguous arenas
+   *
+   * Every value is a node with a one-byte type tag and a 64-bit payload. Integers and floats are stored in the payload directly,
+   * symbols are deduplicated so that the payload is a symbol ID, tensors are kept once each with the payload as their ID,
+   * and lists are stored in their own arena, with the payload pointing to them. The items of a list are consecutive nodes.
+   *
+   * This takes a few bytes per value instead of a heap allocation per value, which is much more compact for datasets
+   * of many small values (for example, lists of symbols).
+   * Datums are materialized as value_t upon access, see transducer_dataset_lazy_impl. Materialized symbols and tensors
+   * share their contents with the ones held by the dataset, so only the nodes and lists are rebuilt on every access.
+   *
+   * Like transducer_dataset_vec_impl, you can add new datums into it.
+   * Adding datums must not happen concurrently with accessing datums.
+   */
+  class transducer_dataset_packed_impl : public transducer_dataset_lazy_impl {
+    struct list_entry {
+      unsigned long first_node;
+      unsigned long num_items;
+    };
+
+    unsigned long arity_m{};
+    std::vector<unsigned char> tags_m;
+    std::vector<std::uint64_t> payloads_m;
+    std::vector<unsigned long> datum_roots_m;
+    std::vector<list_entry> lists_m;
+    std::vector<value_t> tensors_m;
+    std::vector<value_t> symbols_m;
+    // the keys view the symbols held by symbols_m, whose contents never move
+    std::unordered_map<std::string_view, std::uint64_t> symbol_ids_m;
+
+    unsigned long allocate_nodes(unsigned long num_nodes);
+    void pack_value(unsigned long node, const value_t& x);
+    value_t unpack_value(unsigned long node) const;
+
+  protected:
+    std::vector<value_t> materialize(unsigned long i) const override;
+
+  public:
+    /**
+     * \param arity The arity of the dataset
+     */
+    explicit transducer_dataset_packed_impl(unsigned long arity);
+
+    unsigned long arity() const override;
+
+    unsigned long size() const override;
+
+    unsigned long datum_size(unsigned long i, const datum_size_fn_t& size_fn) const override;
+
+    /**
+     * \brief Insert an N-ary datum to this dataset
+     *
+     * See transducer_dataset_vec_impl::emplace_back()
+     *
+     * \param datum_contents Contents of the datum you wish to insert
+     */
+    template<typename ...T>
+    void emplace_back(T ...datum_contents) {
+      apply_emplace_back(std::vector<value_t>{value_t(std::move(datum_contents))...});
+    }
+
+    /**
+     * \brief The non-variadic version of emplace_back()
+     * \param datum The datum you wish to insert
+     */
+    void apply_emplace_back(const std::vector<value_t>& datum);
+
+    /**
+     * \brief Release the spare capacity of the arenas. Call this after all datums are added.
+     */
+    void shrink_to_fit();
+
+    /**
+     * \brief Get the approximate number of bytes used by the arenas
+     * \return The number of bytes
+     */
+    unsigned long memory_usage() const;
+
+    /**
+     * \brief Pack any dataset
+     * \param dataset The dataset to pack
+     * \return The packed dataset
+     */
+    static std::shared_ptr<transducer_dataset_packed_impl> pack(const transducer_dataset& dataset);
   };
 }
 
@@ -289,6 +289,16 @@ namespace tg {
      */
     transducer_model find_transducer_by_name(const std::string& name);
 
+    /**
+     * \brief Convert the RNNs within this transducer to fused-gate RNN cells inplace
+     *
+     * The converted RNNs compute the same functions from the same weights, but run several times faster per timestep.
+     * Useful for speeding up models saved with unfused RNN cells (see tg::RNN_CELL_TYPE). Do this before training.
+     *
+     * \return this transducer
+     */
+    transducer_model& fuse_rnn_gates();
+
     /**
      * \brief Save one of more transducer models into an output file.
      *
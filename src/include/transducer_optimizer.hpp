@@ -12,16 +12,47 @@
 #include "transducer_typed_value.hpp"
 #include <dynet/training.h>
 #include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <exception>
+#include <atomic>
+#include <chrono>
 #include "lego_param_naming_guard.hpp"
 
 namespace tg {
   class backprop_trainable_parameter_base;
+  class gradient_buffer;
 
   /**
    * \addtogroup training
    * @{
    */
 
+  /**
+   * \brief Statistics of the parameter updates performed by an optimizer
+   */
+  struct optimizer_update_statistics {
+    /**
+     * \brief The number of parameter updates performed
+     */
+    unsigned long num_updates{};
+
+    /**
+     * \brief The total number of lookup table rows (for example, embedding entries) updated, summed across all updates
+     */
+    unsigned long num_rows_touched{};
+
+    /**
+     * \brief The time elapsed in seconds since the statistics were reset
+     */
+    float seconds_elapsed{};
+
+    /**
+     * \brief The number of parameter updates performed per second
+     */
+    float updates_per_second() const;
+  };
+
   /**
    * \brief An optimizer can update your model's backprop trainable parameters by running your model's loss function
    *
@@ -63,10 +94,41 @@ namespace tg {
 
     std::mutex mtx; // locks when performing update
 
+    std::thread update_thread_m; // performs the updates in background when pipelined update is enabled
+    std::mutex update_queue_mtx_m; // guards the update queue states below
+    std::condition_variable update_queue_cv_m;
+    unsigned long max_pending_updates_m{0}; // 0 means pipelined update is disabled
+    unsigned long num_pending_updates_m{0}; // number of batches whose gradients are not yet applied
+    std::vector<gradient_buffer> pending_gradients_m; // the gradients of the pending batches, staged away from the parameters
+    bool stop_update_thread_m{false};
+    std::exception_ptr update_error_m; // the error encountered by the background update, to be rethrown to the caller
+
+    bool hogwild_m{false};
+    std::atomic<unsigned long> num_updates_m{0};
+    std::atomic<unsigned long> num_rows_touched_m{0};
+    std::chrono::steady_clock::time_point statistics_start_time_m{std::chrono::steady_clock::now()};
+
     virtual std::vector<dynet::Trainer*> get_impl() = 0;
 
     virtual void set_learning_rate_impl(float lr) = 0;
 
+    /**
+     * \brief Whether this optimizer supports Hogwild update. See set_hogwild().
+     */
+    virtual bool supports_hogwild() const;
+
+    /**
+     * \brief Update a piece of parameter values in place, without any locking.
+     *
+     * Only called in Hogwild mode.
+     *
+     * \param values The parameter values to update
+     * \param grad The gradient of the parameter values
+     * \param gradient_scale The factor to scale the gradient by, less than 1 when the gradient is clipped
+     * \param weight_decay_scale The current weight decay scale of the parameter collection owning the values
+     */
+    virtual void hogwild_update_rule(float* values, const std::vector<float>& grad, float gradient_scale, float weight_decay_scale);
+
   public:
     /**
      * \brief Initialize the optimizer
@@ -127,6 +189,34 @@ namespace tg {
      */
     float dynamic_learn_from_batch(const std::vector<dynamic_transducer_application>& compute_loss_batch);
 
+    /**
+     * \brief Compute the gradient on a minibatch of datums, without updating the model parameters.
+     *
+     * The gradient is accumulated until apply_gradients() is called.
+     *
+     * \param loss_fn The transducer model that returns the loss
+     * \param datum_batch The batch of datum
+     * \return The summed loss returned by your transducer on the datums.
+     */
+    float backward_on_batch(transducer_model loss_fn, const std::shared_ptr<const transducer_dataset>& datum_batch);
+
+    /**
+     * \brief Compute the gradient on a minibatch of dynamic transducers, without updating the model parameters.
+     *
+     * The gradient is accumulated until apply_gradients() is called.
+     *
+     * \param compute_loss_batch A list of dynamic transducers that each returns a loss
+     * \return The summed loss returned by your dynamic transducers
+     */
+    float dynamic_backward_on_batch(const std::vector<dynamic_transducer_application>& compute_loss_batch);
+
+    /**
+     * \brief Update the model parameters using the gradient accumulated so far.
+     *
+     * The accumulated gradient is reset afterwards.
+     */
+    void apply_gradients();
+
     /**
      * \brief Adjust the learning rate
      * \param lr The new learning rate
@@ -159,6 +249,66 @@ namespace tg {
      */
     void exclude_params(const std::function<bool(const lego_param_path& param_path)>& filter);
 
+    /**
+     * \brief Enable/Disable pipelined update
+     *
+     * When enabled, the parameter update after each batch is performed by a background thread,
+     * so that the calling thread can go on to construct the computation graph of the next batch
+     * while the optimizer step of the previous batch is still running.
+     * The forward pass of the next batch waits for the pending updates before reading the parameters,
+     * so no gradient is computed on parameters that are being updated.
+     *
+     * At most max_pending_batches batches can be waiting for their update. If the limit is reached,
+     * learning from another batch blocks until the background thread catches up.
+     * When multiple batches are pending (for example, batches of several threads finishing together), their gradients are summed
+     * and applied in one optimizer step, which is not the same as applying them one after another (for example, with Adam).
+     *
+     * The gradient of every batch is staged in a separate buffer when its update is requested,
+     * so the backward pass of the next batch never touches the gradients that the background thread is applying.
+     *
+     * \param max_pending_batches The maximum number of batches waiting for their update. Setting to zero disables pipelined update.
+     */
+    void set_pipelined_update(unsigned long max_pending_batches);
+
+    /**
+     * \brief Block until all pending updates have been applied.
+     *
+     * Does nothing if pipelined update is disabled.
+     * If a background update has failed, the error is rethrown here.
+     */
+    void wait_for_pending_updates();
+
+    /**
+     * \brief Enable/Disable Hogwild update
+     *
+     * By default, a parameter update applies the gradients accumulated by all threads, and only one thread can update at a time.
+     *
+     * In Hogwild mode, every thread keeps its own gradient, and applies it to the parameters without taking any lock.
+     * For lookup parameters (for example, embedding tables), only the rows looked up by the batch are updated.
+     * This scales much better for sparse models, where concurrent updates rarely touch the same rows.
+     *
+     * Gradient clipping and the weight decay schedule are applied as in a locked update,
+     * except that the gradient norm for clipping is measured on the gradient of the updating thread alone.
+     * Currently only simple_sgd_optimizer supports Hogwild mode.
+     *
+     * \param enabled Whether to enable Hogwild update
+     */
+    void set_hogwild(bool enabled);
+
+    /**
+     * \brief Get the statistics of the parameter updates since the last reset_update_statistics()
+     *
+     * Use this to compare the update throughput with and without Hogwild mode.
+     *
+     * \return The update statistics
+     */
+    optimizer_update_statistics update_statistics() const;
+
+    /**
+     * \brief Reset the update statistics
+     */
+    void reset_update_statistics();
+
   private:
     /**
      * \brief Update the parameters according to gradient.
@@ -169,6 +319,36 @@ namespace tg {
      */
     void update_params();
 
+    /**
+     * \brief Perform the update immediately on the current thread
+     */
+    void update_params_impl();
+
+    /**
+     * \brief The main loop of the background update thread
+     */
+    void update_thread_loop();
+
+    /**
+     * \brief Block until all pending updates have been applied, or one of them has failed
+     */
+    void wait_until_parameters_updated();
+
+    /**
+     * \brief Run a backward pass, accumulating the parameter gradients into the thread local buffer that the update applies
+     *
+     * Does not redirect if the current thread already has its own gradient sink.
+     */
+    template<typename F>
+    float backward_into_thread_buffer(F&& backward);
+
+    /**
+     * \brief Apply the gradient accumulated by the current thread, without locking
+     */
+    void hogwild_update();
+
+    void stop_update_thread();
+
     void take_ownership_of_params();
   };
 
@@ -182,6 +362,10 @@ namespace tg {
 
     void set_learning_rate_impl(float lr) override;
 
+    bool supports_hogwild() const override;
+
+    void hogwild_update_rule(float* values, const std::vector<float>& grad, float gradient_scale, float weight_decay_scale) override;
+
   public:
 
     /**
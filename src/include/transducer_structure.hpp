@@ -388,8 +388,14 @@ namespace tg {
 
   extern biaffine_structure_t biaffine_structure;
 
+  /**
+   * \brief The types of RNN cell
+   *
+   * The FUSED_ cells compute the same functions as their unfused counterparts, but stack all the gates into one matrix multiplication, which is several times faster per timestep.
+   * Models saved with unfused cells can be converted with transducer_model::fuse_rnn_gates().
+   */
   enum RNN_CELL_TYPE {
-    NAIVE_RNN, VANILLA_LSTM, COUPLED_LSTM, GRU
+    NAIVE_RNN, VANILLA_LSTM, COUPLED_LSTM, GRU, FUSED_VANILLA_LSTM, FUSED_COUPLED_LSTM, FUSED_GRU
   };
 
   /**
@@ -11,6 +11,10 @@
 #include "lego_primitive_types.hpp"
 #include <memory>
 #include <list>
+#include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <tuple>
 
 namespace dynet {
   template<typename Archive>
@@ -33,7 +37,160 @@ namespace tg {
    * @{
    */
 
-  using list_t = std::vector<value_t>;
+  /**
+   * \brief The list held by tg::value_t
+   *
+   * A list is a range of items in an append-only buffer, which is shared among the copies of the list. Therefore:
+   *   * Copying a list is O(1).
+   *   * push_back() is amortized O(1). It appends in place when the list ends at the end of its buffer,
+   *     otherwise (when another copy has already appended there) it first copies the items into a new buffer.
+   *   * slice() is O(1), sharing the same buffer.
+   *   * append() is O(other.size()) when it appends in place, and O(size() + other.size()) when it first copies the items.
+   *     So concatenation (including tg::list_concat) is linear in the total length, not O(log n).
+   *   * Items never move once appended, so references to items stay valid as long as any list sharing the buffer is alive.
+   *   * A list never holds its own buffer, even indirectly (for example, l.push_back(value_t(l))). Such an item is appended to a copy instead.
+   *
+   * It can be used like a read-only std::vector<value_t> (plus push_back(), emplace_back(), append(), pop_back() and clear()),
+   * and converts from and to std::vector<value_t>.
+   * Unlike std::vector<value_t> (which list_t used to be), items cannot be modified in place: there is no mutable operator[],
+   * data(), insert() or erase(), and iterators are read-only. To modify items, convert to std::vector<value_t>, modify, and convert back.
+   * There is no constructor from a braced list either (it would make value_t({...}) ambiguous), construct from a std::vector<value_t> instead.
+   */
+  class value_list {
+    struct buffer;
+    std::shared_ptr<buffer> buffer_m;
+    unsigned long begin_m{};
+    unsigned long end_m{};
+
+  public:
+    class const_iterator {
+      const buffer* buffer_m{};
+      unsigned long i_m{};
+
+      // the item at i_m and the end of its block, so that stepping through a block does not locate every item
+      // null until dereferenced, and after moving past the block or moving backwards
+      mutable const value_t* item_m{};
+      mutable const value_t* block_end_m{};
+      inline void seek() const;
+    public:
+      using difference_type = long;
+      using value_type = value_t;
+      using pointer = const value_t*;
+      using reference = const value_t&;
+      using iterator_category = std::random_access_iterator_tag;
+      const_iterator() = default;
+      const_iterator(const buffer* buf, unsigned long i) : buffer_m(buf), i_m(i) {}
+      inline reference operator*() const;
+      inline pointer operator->() const {return &**this;}
+      inline reference operator[](difference_type n) const {return *(*this + n);}
+      inline const_iterator& operator++();
+      inline const_iterator operator++(int) {auto ret = *this; ++*this; return ret;}
+      inline const_iterator& operator--() {--i_m; item_m = nullptr; return *this;}
+      inline const_iterator operator--(int) {auto ret = *this; --*this; return ret;}
+      inline const_iterator& operator+=(difference_type n) {i_m += n; item_m = nullptr; return *this;}
+      inline const_iterator& operator-=(difference_type n) {i_m -= n; item_m = nullptr; return *this;}
+      inline const_iterator operator+(difference_type n) const {return const_iterator(buffer_m, i_m + n);}
+      inline const_iterator operator-(difference_type n) const {return const_iterator(buffer_m, i_m - n);}
+      inline difference_type operator-(const const_iterator& other) const {return (difference_type)i_m - (difference_type)other.i_m;}
+      inline bool operator==(const const_iterator& other) const {return i_m == other.i_m;}
+      inline bool operator!=(const const_iterator& other) const {return i_m != other.i_m;}
+      inline bool operator<(const const_iterator& other) const {return i_m < other.i_m;}
+      inline bool operator>(const const_iterator& other) const {return i_m > other.i_m;}
+      inline bool operator<=(const const_iterator& other) const {return i_m <= other.i_m;}
+      inline bool operator>=(const const_iterator& other) const {return i_m >= other.i_m;}
+    };
+    using iterator = const_iterator;
+    using const_reverse_iterator = std::reverse_iterator<const_iterator>;
+    using reverse_iterator = const_reverse_iterator;
+    using value_type = value_t;
+    using size_type = unsigned long;
+    using difference_type = long;
+    using reference = const value_t&;
+    using const_reference = const value_t&;
+
+    template<typename Archive>
+    void save(Archive& ar) const;
+
+    template<typename Archive>
+    void load(Archive& ar);
+
+    value_list() = default;
+    value_list(const value_list&) = default;
+    value_list(value_list&&) noexcept = default;
+    value_list& operator=(const value_list&) = default;
+    value_list& operator=(value_list&&) noexcept = default;
+
+    value_list(const std::vector<value_t>& xs);
+
+    value_list(std::vector<value_t>&& xs);
+
+    template<typename Itr, typename = typename std::iterator_traits<Itr>::iterator_category>
+    value_list(Itr first, Itr last) {
+      for(; first != last; ++first) {
+        push_back(value_t(*first));
+      }
+    }
+
+    /**
+     * \brief Copy the items into a std::vector
+     */
+    operator std::vector<value_t>() const;
+
+    inline unsigned long size() const {return end_m - begin_m;}
+    inline bool empty() const {return end_m == begin_m;}
+    inline const value_t& operator[](unsigned long i) const;
+    const value_t& at(unsigned long i) const;
+    inline const value_t& front() const {return (*this)[0];}
+    inline const value_t& back() const {return (*this)[size() - 1];}
+    inline const_iterator begin() const {return const_iterator(buffer_m.get(), begin_m);}
+    inline const_iterator end() const {return const_iterator(buffer_m.get(), end_m);}
+    inline const_iterator cbegin() const {return begin();}
+    inline const_iterator cend() const {return end();}
+    inline const_reverse_iterator rbegin() const {return const_reverse_iterator(end());}
+    inline const_reverse_iterator rend() const {return const_reverse_iterator(begin());}
+
+    /**
+     * \brief Append an item to the end of this list. Other lists sharing the same buffer are not affected.
+     * \param x The item
+     */
+    void push_back(value_t x);
+
+    template<typename ...Args>
+    void emplace_back(Args&& ... args) {
+      push_back(value_t(std::forward<Args>(args)...));
+    }
+
+    /**
+     * \brief Append all items of another list to the end of this list
+     * \param other The other list
+     */
+    void append(const value_list& other);
+
+    /**
+     * \brief Only for compatibility with std::vector. Does nothing, because the buffer grows without moving items.
+     */
+    void reserve(unsigned long) {}
+
+    void pop_back();
+
+    void clear();
+
+    /**
+     * \brief Take a sub-range of this list, sharing the same buffer
+     * \param begin The starting index (inclusive)
+     * \param end The ending index (exclusive)
+     * \return The sub-list
+     */
+    value_list slice(unsigned long begin, unsigned long end) const;
+
+  private:
+    /**
+     * \brief The minimum depth of a buffer that may hold an item (see value_list::buffer::depth)
+     */
+    static unsigned long depth_to_hold(const value_t& x);
+  };
+
+  using list_t = value_list;
 
   /**
    * \brief Write a tg::typed_value in a human-readible form
@@ -43,6 +200,26 @@ namespace tg {
    */
   std::ostream& operator<<(std::ostream& os, const tg::value_t& x);
 
+  /**
+   * \brief Turn on or off the process-wide symbol interning mode
+   *
+   * When turned on, every symbol value constructed afterwards (including symbols loaded from datasets)
+   * is looked up in a process-wide intern table, so that equal symbols share one copy of the string,
+   * and can be compared by their IDs (see value_t::symbol_id()).
+   *
+   * Interned symbols are never freed. Turning interning off does not affect symbols that are already interned.
+   * Symbols are still saved as strings, so saved datasets and models do not depend on the IDs.
+   *
+   * \param enabled Whether to intern symbols
+   */
+  void set_symbol_interning(bool enabled);
+
+  /**
+   * \brief Check whether the process-wide symbol interning mode is turned on
+   * \return True if symbols are interned upon construction
+   */
+  bool is_symbol_interning_enabled();
+
   /**
    * \brief This exception indicates that NaN or Inf value is encountered.
    */
@@ -73,14 +250,80 @@ namespace tg {
     using varient_t = std::variant<long, scalar_t, tensor_t, symbol_t, list_t, symbolic_tensor_t>;
     std::shared_ptr<varient_t> v;
 
+    /**
+     * \brief Where the value lives
+     *
+     * Integers and floats are stored inside the value_t, so that constructing and copying them never touches the heap.
+     * Other types live in the shared variant v (null when v is empty).
+     */
+    enum class storage_kind : unsigned char {
+      shared,
+      inline_integer,
+      inline_float,
+      interned_symbol
+    };
+    storage_kind storage_m{storage_kind::shared};
+    union inline_storage {
+      long integer;
+      scalar_t scalar;
+      // The ID of the symbol in the process-wide intern table. The symbol itself is still in v.
+      unsigned long symbol_id;
+    } inline_m{};
+
+    class symbol_intern_table;
 
     friend dynet_computation_graph;
     friend transducer_graph_node;
     friend lambda_transducer_model;
   public:
+    /**
+     * \brief Saved before the value, tells how the value is saved
+     *
+     * Inline numbers are saved as they are. Wrapping them in a temporary shared pointer does not work,
+     * because cereal identifies shared pointers by their addresses, which the allocator reuses once the temporary is freed.
+     *
+     * Only present since version 1 (see CEREAL_CLASS_VERSION below). Version 0 saves the shared variant alone.
+     */
+    enum class archived_kind : unsigned char {
+      shared,
+      integer,
+      scalar
+    };
+
+    template<typename Archive>
+    void save(Archive& ar, std::uint32_t version) const {
+      if(storage_m == storage_kind::inline_integer) {
+        ar((unsigned char)archived_kind::integer, inline_m.integer);
+      }
+      else if(storage_m == storage_kind::inline_float) {
+        ar((unsigned char)archived_kind::scalar, inline_m.scalar);
+      }
+      else {
+        ar((unsigned char)archived_kind::shared, v);
+      }
+    }
+
     template<typename Archive>
-    void serialize(Archive& ar) {
+    void load(Archive& ar, std::uint32_t version) {
+      unsigned char kind = (unsigned char)archived_kind::shared;
+      if(version > 0) ar(kind);
+      if(kind == (unsigned char)archived_kind::integer) {
+        long x;
+        ar(x);
+        *this = value_t(x);
+        return;
+      }
+      if(kind == (unsigned char)archived_kind::scalar) {
+        scalar_t x;
+        ar(x);
+        *this = value_t(x);
+        return;
+      }
       ar(v);
+      storage_m = storage_kind::shared;
+      if(is_symbol_interning_enabled() && is_symbol()) {
+        *this = intern_symbol(as_symbol());
+      }
     }
 
     /**
@@ -170,12 +413,20 @@ namespace tg {
     /**
      * \brief Construct a symbol
      *
-     * Internally stores as a string
+     * Internally stores as a string. The symbol is interned if interning is turned on, see set_symbol_interning().
      *
      * \param x The symbol
      */
     explicit value_t(const symbol_t& x);
 
+    /**
+     * \brief Construct an interned symbol, regardless of whether interning is turned on
+     *
+     * \param x The symbol
+     * \return The interned symbol
+     */
+    static value_t intern_symbol(const symbol_t& x);
+
     /**
      * \brief Construct a scalar value
      *
@@ -223,6 +474,13 @@ namespace tg {
      */
     explicit value_t(std::vector<value_t>&& xs);
 
+    /**
+     * \brief Construct a list
+     *
+     * \param x The list of tg::typed_value
+     */
+    explicit value_t(list_t xs);
+
     /**
      * \brief Construct a list
      *
@@ -232,8 +490,7 @@ namespace tg {
     template<typename T>
     explicit
     value_t(const std::vector<T>& xs, typename std::enable_if<!std::is_same<T, value_t>::value>::type * = nullptr) {
-      std::vector<value_t> ret;
-      ret.reserve(xs.size());
+      list_t ret;
       for (auto&& x:xs) {
         ret.emplace_back(x);
       }
@@ -414,6 +671,23 @@ namespace tg {
      */
     bool is_symbol() const;
 
+    /**
+     * \brief Check if this value is a symbol in the process-wide intern table
+     * \return If this value is an interned symbol
+     */
+    bool is_interned_symbol() const {
+      return storage_m == storage_kind::interned_symbol;
+    }
+
+    /**
+     * \brief Get the ID of an interned symbol
+     *
+     * Two interned symbols are equal if and only if their IDs are equal. IDs are positive, and only valid within the current process.
+     *
+     * \return The ID of this symbol
+     */
+    unsigned long symbol_id() const;
+
     /**
      * \brief Check if this value is of type tensor
      * \return If this value is of type tensor
@@ -525,6 +799,14 @@ namespace tg {
      */
     template<typename _Visitor>
     constexpr decltype(auto) visit(_Visitor&& visitor) const {
+      if (storage_m == storage_kind::inline_integer) {
+        long x = inline_m.integer;
+        return visitor(x);
+      }
+      if (storage_m == storage_kind::inline_float) {
+        scalar_t x = inline_m.scalar;
+        return visitor(x);
+      }
       if (!v) std::throw_with_nested(std::runtime_error("Cannot get value from null"));
       return std::visit(visitor, *v);
     }
@@ -583,10 +865,20 @@ namespace tg {
      * \param values The values to visit
      * \return What visitor function returns
      */
-    template<typename _Visitor, typename... Values>
-    static constexpr decltype(auto) visit_many(_Visitor&& visitor, Values&& ... values) {
-      if (is_any_null(values...)) std::throw_with_nested(std::runtime_error("Cannot get value from null"));
-      return std::visit(visitor, (*values.v)...);
+    template<typename _Visitor, typename First, typename... Rest>
+    static constexpr decltype(auto) visit_many(_Visitor&& visitor, First&& first, Rest&& ... rest) {
+      if (is_any_null(first, rest...)) std::throw_with_nested(std::runtime_error("Cannot get value from null"));
+      if constexpr (sizeof...(Rest) == 0) {
+        return first.visit(visitor);
+      }
+      else {
+        // bind the values one at a time, because some of them may be stored inline instead of in a variant
+        return first.visit([&](auto&& x) -> decltype(auto) {
+          return visit_many([&](auto&& ... ys) -> decltype(auto) {
+            return visitor(x, ys...);
+          }, rest...);
+        });
+      }
     }
 
     /**
@@ -599,10 +891,170 @@ namespace tg {
 
   private:
 
-    void collect_nested_symbolic_tensors(std::unordered_set<varient_t *>& ret);
+    void collect_nested_symbolic_tensors(std::unordered_set<varient_t *>& ret) const;
+
+  };
+
+  /**
+   * \brief The append-only buffer behind tg::value_list
+   *
+   * Items are stored in blocks of geometrically increasing sizes, so that appending never moves existing items,
+   * and readers do not need a lock: a list only reads items below its own end, which were fully written before the list was created.
+   *
+   * The first block is stored inline, so a small list costs a single allocation.
+   * The table of the other blocks is only allocated when the first block is full, and grows with the number of blocks.
+   */
+  struct value_list::buffer {
+    static constexpr unsigned long FIRST_BLOCK_BITS = 2;
+    static constexpr unsigned long FIRST_BLOCK_SIZE = 1ul << FIRST_BLOCK_BITS;
+
+    /**
+     * \brief Greater than the depth of the buffer of every list among the items
+     *
+     * Depths strictly decrease from a buffer to the buffers it holds, so a buffer never holds itself, even indirectly,
+     * and the shared pointers among buffers never form a cycle.
+     */
+    const unsigned long depth;
+
+    /**
+     * \brief The blocks after the first one
+     *
+     * When full, it is replaced by a larger copy. The smaller one is kept alive, since a concurrent reader may still be using it.
+     */
+    struct block_table {
+      std::unique_ptr<block_table> prev;
+      std::unique_ptr<value_t*[]> blocks;
+      unsigned long capacity;
+      explicit block_table(unsigned long capacity) : blocks(new value_t*[capacity]()), capacity(capacity) {}
+    };
+
+    std::atomic<unsigned long> size{0};
+    std::atomic<block_table*> table{nullptr};
+    value_t first_block[FIRST_BLOCK_SIZE];
+
+    explicit buffer(unsigned long depth) : depth(depth) {}
+    buffer(const buffer&) = delete;
+    buffer& operator=(const buffer&) = delete;
+    ~buffer() {
+      auto t = table.load(std::memory_order_relaxed);
+      if(!t) return;
+      for(unsigned long i=0; i<t->capacity; ++i) delete[] t->blocks[i];
+      delete t;
+    }
+
+    /**
+     * \brief The index of the most significant bit set. x must not be zero.
+     */
+    static inline unsigned long floor_log2(unsigned long x) {
+#if defined(__GNUC__)
+      return sizeof(x) * 8 - 1 - __builtin_clzl(x);
+#else
+      unsigned long ret = 0;
+      for(unsigned long shift = sizeof(x) * 4; shift > 0; shift >>= 1) {
+        if(x >> shift) {
+          x >>= shift;
+          ret += shift;
+        }
+      }
+      return ret;
+#endif
+    }
+
+    /**
+     * \brief Find the block and the offset within the block of an item
+     */
+    static inline std::pair<unsigned long, unsigned long> locate(unsigned long i) {
+      auto j = i + FIRST_BLOCK_SIZE;
+      auto msb = floor_log2(j);
+      return std::make_pair(msb - FIRST_BLOCK_BITS, j - (1ul << msb));
+    }
+
+    inline const value_t& item(unsigned long i) const {
+      if(i < FIRST_BLOCK_SIZE) return first_block[i];
+      auto [block, offset] = locate(i);
+      return table.load(std::memory_order_acquire)->blocks[block - 1][offset];
+    }
 
+    /**
+     * \brief Find an item, and the end of the block holding it
+     */
+    inline std::pair<const value_t*, const value_t*> item_in_block(unsigned long i) const {
+      if(i < FIRST_BLOCK_SIZE) return std::make_pair(first_block + i, first_block + FIRST_BLOCK_SIZE);
+      auto [block, offset] = locate(i);
+      const value_t* begin = table.load(std::memory_order_acquire)->blocks[block - 1];
+      return std::make_pair(begin + offset, begin + (FIRST_BLOCK_SIZE << block));
+    }
+
+    /**
+     * \brief Append an item, only if the buffer currently has expected_size items
+     *
+     * Only a list ending at expected_size can append, so once the slot is claimed, nobody else touches it.
+     *
+     * \return Whether the item is appended. x is untouched if not.
+     */
+    bool try_append(unsigned long expected_size, value_t&& x) {
+      if(!size.compare_exchange_strong(expected_size, expected_size + 1, std::memory_order_acq_rel)) return false;
+      if(expected_size < FIRST_BLOCK_SIZE) {
+        first_block[expected_size] = std::move(x);
+        return true;
+      }
+      auto [block_id, offset] = locate(expected_size);
+      auto t = table.load(std::memory_order_relaxed);
+      if(offset == 0) {
+        // the first item of a new block
+        if(!t || block_id > t->capacity) {
+          auto grown = new block_table(t ? t->capacity * 2 : 4);
+          if(t) std::copy(t->blocks.get(), t->blocks.get() + t->capacity, grown->blocks.get());
+          grown->prev.reset(t);
+          table.store(grown, std::memory_order_release);
+          t = grown;
+        }
+        t->blocks[block_id - 1] = new value_t[FIRST_BLOCK_SIZE << block_id];
+      }
+      t->blocks[block_id - 1][offset] = std::move(x);
+      return true;
+    }
   };
 
+  inline void value_list::const_iterator::seek() const {
+    std::tie(item_m, block_end_m) = buffer_m->item_in_block(i_m);
+  }
+
+  inline value_list::const_iterator::reference value_list::const_iterator::operator*() const {
+    if(!item_m) seek();
+    return *item_m;
+  }
+
+  inline value_list::const_iterator& value_list::const_iterator::operator++() {
+    ++i_m;
+    if(item_m && ++item_m == block_end_m) item_m = nullptr;
+    return *this;
+  }
+
+  inline const value_t& value_list::operator[](unsigned long i) const {
+    return buffer_m->item(begin_m + i);
+  }
+
+  template<typename Archive>
+  void value_list::save(Archive& ar) const {
+    ar(cereal::make_size_tag(static_cast<cereal::size_type>(size())));
+    for(auto&& x:*this) {
+      ar(x);
+    }
+  }
+
+  template<typename Archive>
+  void value_list::load(Archive& ar) {
+    cereal::size_type len;
+    ar(cereal::make_size_tag(len));
+    clear();
+    for(cereal::size_type i=0; i<len; ++i) {
+      value_t x;
+      ar(x);
+      push_back(std::move(x));
+    }
+  }
+
   /**
    * \brief Ensure that a tensor does not contain NaN or Inf
    *
@@ -612,6 +1064,15 @@ namespace tg {
    */
   void block_nan_or_inf(const std::vector<float>& values);
 
+  /**
+   * \brief Ensure that a tensor does not contain NaN or Inf
+   *
+   * Throws an exception if it does.
+   *
+   * \param values The values of the tensor to ensure
+   */
+  void block_nan_or_inf(const tensor_values_t& values);
+
   /**
    * \brief Ensure that a float value is not NaN or Inf
    *
@@ -624,5 +1085,8 @@ namespace tg {
   /// @}
 }
 
+// version 0: the shared variant alone, written before integers and floats were stored inline
+// version 1: an archived_kind byte, followed by the value
+CEREAL_CLASS_VERSION(tg::value_t, 1)
 
 #endif //LEGO_TRANSDUCER_TYPED_VALUE_HPP
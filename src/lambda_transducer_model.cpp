@@ -4,6 +4,8 @@
 
 #include "lambda_transducer_model.hpp"
 #include "transducer_variant.hpp"
+#include <functional>
+#include <unordered_set>
 using namespace std;
 using namespace tg;
 
@@ -82,6 +84,10 @@ unsigned long lambda_transducer_model::num_locals() const {
   return locals_m.size();
 }
 
+unsigned long lambda_transducer_model::num_slots() const {
+  return std::max(num_slots_m, (unsigned long)locals_m.size());
+}
+
 value_placeholder lambda_transducer_model::make_value_placeholder_from_make_list(
   std::vector<value_placeholder> inputs) {
   return make_value_placeholder_impl(compute_value_behavior(compute_value_make_list_impl(std::move(inputs))));
@@ -125,38 +131,331 @@ template value_placeholder lambda_transducer_model::make_value_placeholder_from_
 template value_placeholder lambda_transducer_model::make_value_placeholder_from_transducing(std::shared_ptr<transducer_variant> transducer, value_placeholder, value_placeholder, value_placeholder, value_placeholder, value_placeholder, value_placeholder, value_placeholder);
 template value_placeholder lambda_transducer_model::make_value_placeholder_from_transducing(std::shared_ptr<transducer_variant> transducer, value_placeholder, value_placeholder, value_placeholder, value_placeholder, value_placeholder, value_placeholder, value_placeholder, value_placeholder);
 
-value_t lambda_transducer_model::evaluate_compute_behavior(const compute_value_behavior& behavior) {
-  return std::visit([&](auto&& v)->value_t {
+void lambda_transducer_model::evaluate_compute_behavior(const compute_value_behavior& behavior, value_t& value) {
+  std::visit([&](auto&& v) {
     using V = std::decay_t<decltype(v)>;
     if constexpr (std::is_same_v<V, compute_value_input_impl>) {
       throw std::runtime_error("Unfulfilled input placeholder");
     }
     else if constexpr (std::is_same_v<V, compute_value_const_impl>) {
-      return v;
+      value = v;
+      graph_replay::record_constant(value);
     }
     else if constexpr (std::is_same_v<V, compute_value_make_list_impl>) {
       const std::vector<value_placeholder>& vps = v.inputs;
       std::vector<value_t> ret;
+      std::vector<const value_t*> items;
       ret.reserve(vps.size());
       for(auto&& vp:vps) {
-        ret.push_back(evaluate_value_placeholder(vp));
+        auto&& item = evaluate_value_placeholder(vp);
+        if(graph_replay::is_recording()) items.push_back(&item);
+        ret.push_back(item);
       }
-      return value_t(std::move(ret));
+      value = value_t(std::move(ret));
+      graph_replay::record_make_list(items, value);
     }
     else {
-      return std::visit([&](auto&& transducer)->value_t {
-        using transducer_t = std::decay_t<decltype(transducer)>;
-        if constexpr (std::is_same_v<transducer_t, std::shared_ptr<transducer_variant>>) {
-          auto helper = [&](auto&& ...args) {return transducer->transduce_placeholder(args...);};
-          return std::apply(helper, v.inputs);
+      std::shared_ptr<transducer_variant> tbd;
+      transducer_variant* transducer;
+      if(auto weak = std::get_if<std::weak_ptr<transducer_variant>>(&v.transducer)) {
+        tbd = weak->lock();
+        transducer = tbd.get();
+      }
+      else {
+        transducer = std::get<std::shared_ptr<transducer_variant>>(v.transducer).get();
+      }
+
+      if(!graph_replay::is_recording()) {
+        auto helper = [&](auto&& ...args) {return transducer->transduce_placeholder(args...);};
+        value = std::apply(helper, v.inputs);
+      }
+      else if(transducer->visit([](auto&& t) {return transducer_variant::transducer_traits<decltype(t)>().is_lazy;})) {
+        // the operands of a lazy transducer are recorded as they are evaluated
+        graph_replay::lazy_call recorded(transducer);
+        auto helper = [&](auto&& ...args) {return transducer->transduce_placeholder(args...);};
+        value = std::apply(helper, v.inputs);
+        recorded.commit(value);
+      }
+      else {
+        const value_t* operands[V::ARITY + 1] = {};
+        unsigned long i = 0;
+        std::apply([&](auto&& ...args) {
+          ((operands[i++] = &evaluate_value_placeholder(args)), ...);
+        }, v.inputs);
+        graph_replay::call recorded(transducer, operands, V::ARITY);
+        value = transducer->_apply(operands, V::ARITY);
+        recorded.commit(value);
+      }
+    }
+  }, behavior.impl);
+}
+
+value_t lambda_transducer_model::evaluate_inputs(const value_t* const* inputs) {
+  lambda_transducer_value_cache scope(this, inputs, arity_m);
+  if(graph_replay::is_recording()) {
+    std::vector<const value_t*> input_slots;
+    for(unsigned long i = 0; i < arity_m; ++i) {
+      input_slots.push_back(&scope.values_cache[i].second);
+    }
+    graph_replay::enter_lambda(input_slots.data(), inputs, arity_m);
+  }
+  auto&& ret = evaluate_value_placeholder(ret_m);
+  graph_replay::leave_lambda(ret);
+  return ret;
+}
+
+std::vector<bool> lambda_transducer_model::find_captured_slots() {
+  std::vector<bool> ret(locals_m.size(), false);
+  auto capture = [&](const value_placeholder& vp) {
+    if(vp.owner_nesting_depth == nesting_depth_m && vp.value_idx < ret.size()) ret[vp.value_idx] = true;
+  };
+
+  // any lambda transducer nested deeper than this one may read from this one through its placeholders
+  // TBD transducers are not among the nested transducers, so they are resolved here.
+  // If one is not defined yet, what it will read is unknown, so every slot counts as captured
+  bool has_undefined_tbd = false;
+  std::unordered_set<transducer_variant*> visited;
+  std::function<void(const std::shared_ptr<transducer_variant>&)> visit_nested;
+  auto visit_tbd_transducers = [&](const lambda_transducer_model& lambda) {
+    for(auto&& local:lambda.locals_m) {
+      std::visit([&](auto&& v) {
+        using V = std::decay_t<decltype(v)>;
+        if constexpr (!std::is_same_v<V, compute_value_input_impl> && !std::is_same_v<V, compute_value_const_impl> && !std::is_same_v<V, compute_value_make_list_impl>) {
+          if(auto weak = std::get_if<std::weak_ptr<transducer_variant>>(&v.transducer)) {
+            auto tbd = weak->lock();
+            if(!tbd || std::holds_alternative<tbd_transducer>(tbd->v)) has_undefined_tbd = true;
+            else visit_nested(tbd);
+          }
+        }
+      }, local.impl);
+    }
+  };
+  visit_nested = [&](const std::shared_ptr<transducer_variant>& transducer) {
+    if(!transducer || !visited.insert(transducer.get()).second) return;
+    if(auto lambda = std::get_if<lambda_transducer_model>(&transducer->v)) {
+      if(lambda->nesting_depth_m > nesting_depth_m) {
+        for(auto&& local:lambda->locals_m) {
+          std::visit([&](auto&& v) {
+            using V = std::decay_t<decltype(v)>;
+            if constexpr (std::is_same_v<V, compute_value_make_list_impl>) {
+              for(auto&& input:v.inputs) capture(input);
+            }
+            else if constexpr (!std::is_same_v<V, compute_value_input_impl> && !std::is_same_v<V, compute_value_const_impl>) {
+              std::apply([&](auto&& ...inputs) {(capture(inputs), ...);}, v.inputs);
+            }
+          }, local.impl);
+        }
+        capture(lambda->ret_m);
+      }
+      visit_tbd_transducers(*lambda);
+    }
+    for(auto&& nested:transducer->nested_transducers()) {
+      visit_nested(nested);
+    }
+  };
+  for(auto&& nested:nested_transducers()) {
+    visit_nested(nested);
+  }
+  visit_tbd_transducers(*this);
+  if(has_undefined_tbd) ret.assign(ret.size(), true);
+  return ret;
+}
+
+void lambda_transducer_model::compile_tape() {
+  tape_m.clear();
+  tape_operands_m.clear();
+  tape_releases_m.clear();
+  num_slots_m = locals_m.size();
+  if(has_lazy_operation) return;
+
+  for(unsigned long idx = arity_m; idx < locals_m.size(); ++idx) {
+    std::visit([&](auto&& v) {
+      using V = std::decay_t<decltype(v)>;
+      tape_instruction instruction;
+      instruction.result = idx;
+      instruction.operands_begin = tape_operands_m.size();
+      if constexpr (std::is_same_v<V, compute_value_input_impl>) {
+        throw std::runtime_error("Unfulfilled input placeholder");
+      }
+      else if constexpr (std::is_same_v<V, compute_value_const_impl>) {
+        instruction.op = tape_instruction::opcode::constant;
+        instruction.constant = v;
+      }
+      else if constexpr (std::is_same_v<V, compute_value_make_list_impl>) {
+        instruction.op = tape_instruction::opcode::make_list;
+        tape_operands_m.insert(tape_operands_m.end(), v.inputs.begin(), v.inputs.end());
+      }
+      else {
+        std::apply([&](auto&& ...inputs) {
+          (tape_operands_m.push_back(inputs), ...);
+        }, v.inputs);
+
+        if(auto weak = std::get_if<std::weak_ptr<transducer_variant>>(&v.transducer)) {
+          instruction.op = tape_instruction::opcode::transduce_tbd;
+          instruction.tbd_transducer = *weak;
         }
         else {
-          auto helper = [&](auto&& ...args) {return transducer.lock()->transduce_placeholder(args...);};
-          return std::apply(helper, v.inputs);
+          auto&& transducer = std::get<std::shared_ptr<transducer_variant>>(v.transducer);
+          instruction.op = tape_instruction::opcode::transduce;
+          instruction.transducer = transducer.get();
+
+          // unroll a composed transducer into its stages, chained through extra slots
+          if constexpr (V::ARITY == 1) {
+            if(auto composed = std::get_if<composed_transducer_model>(&transducer->v)) {
+              auto&& pipeline = composed->nested_transducers();
+              if(!pipeline.empty()) {
+                for(unsigned long stage = 0; stage < pipeline.size(); ++stage) {
+                  // the first stage takes the original operand, every later stage takes the result of the stage before
+                  if(stage > 0) tape_operands_m.push_back(value_placeholder(nesting_depth_m, tape_m.back().result));
+                  tape_instruction stage_instruction;
+                  stage_instruction.op = tape_instruction::opcode::transduce;
+                  stage_instruction.transducer = pipeline[stage].get();
+                  stage_instruction.operands_begin = tape_operands_m.size() - 1;
+                  stage_instruction.num_operands = 1;
+                  stage_instruction.result = stage + 1 == pipeline.size() ? idx : num_slots_m++;
+                  tape_m.push_back(std::move(stage_instruction));
+                }
+                return;
+              }
+            }
+          }
         }
-      }, v.transducer);
+      }
+      instruction.num_operands = tape_operands_m.size() - instruction.operands_begin;
+      tape_m.push_back(std::move(instruction));
+    }, locals_m[idx].impl);
+  }
+
+  // the return value and the captured slots must stay alive until the scope ends
+  auto is_pinned = find_captured_slots();
+  is_pinned.resize(num_slots_m, false);
+  if(ret_m.owner_nesting_depth == nesting_depth_m) is_pinned[ret_m.value_idx] = true;
+
+  // walk backwards to find the instructions that contribute to the pinned slots
+  std::vector<bool> is_needed = is_pinned;
+  std::vector<bool> is_instruction_needed(tape_m.size(), false);
+  for(unsigned long i = tape_m.size(); i-- > 0;) {
+    auto&& instruction = tape_m[i];
+    if(!is_needed[instruction.result]) continue;
+    is_instruction_needed[i] = true;
+    for(unsigned long j = 0; j < instruction.num_operands; ++j) {
+      auto&& operand = tape_operands_m[instruction.operands_begin + j];
+      if(operand.owner_nesting_depth == nesting_depth_m) is_needed[operand.value_idx] = true;
     }
-  }, behavior.impl);
+  }
+
+  // keep only the needed instructions, and find the last consumer of every slot
+  std::vector<tape_instruction> tape;
+  std::vector<value_placeholder> operands;
+  std::vector<long> last_consumer(num_slots_m, -1);
+  for(unsigned long i = 0; i < tape_m.size(); ++i) {
+    if(!is_instruction_needed[i]) continue;
+    auto instruction = std::move(tape_m[i]);
+    auto operands_begin = operands.size();
+    for(unsigned long j = 0; j < instruction.num_operands; ++j) {
+      auto&& operand = tape_operands_m[instruction.operands_begin + j];
+      if(operand.owner_nesting_depth == nesting_depth_m) last_consumer[operand.value_idx] = (long)tape.size();
+      operands.push_back(operand);
+    }
+    instruction.operands_begin = operands_begin;
+    tape.push_back(std::move(instruction));
+  }
+
+  std::vector<std::vector<unsigned long>> releases(tape.size());
+  for(unsigned long slot = 0; slot < num_slots_m; ++slot) {
+    if(!is_pinned[slot] && last_consumer[slot] >= 0) releases[last_consumer[slot]].push_back(slot);
+  }
+  for(unsigned long i = 0; i < tape.size(); ++i) {
+    tape[i].releases_begin = tape_releases_m.size();
+    tape[i].num_releases = releases[i].size();
+    tape_releases_m.insert(tape_releases_m.end(), releases[i].begin(), releases[i].end());
+  }
+
+  // an affine transducer whose result is only read by an activation right after it can be fused with the activation
+  for(unsigned long i = 0; i + 1 < tape.size(); ++i) {
+    auto&& instruction = tape[i];
+    auto&& next = tape[i + 1];
+    if(instruction.op != tape_instruction::opcode::transduce || next.op != tape_instruction::opcode::transduce || next.num_operands != 1) continue;
+    auto&& operand = operands[next.operands_begin];
+    if(operand.owner_nesting_depth != nesting_depth_m || operand.value_idx != instruction.result) continue;
+    if(is_pinned[instruction.result] || last_consumer[instruction.result] != (long)(i + 1)) continue;
+    if(!operator_fusion::is_affine(*instruction.transducer)) continue;
+    instruction.fused_activation = operator_fusion::activation_of(*next.transducer);
+  }
+
+  tape_m = std::move(tape);
+  tape_operands_m = std::move(operands);
+}
+
+void lambda_transducer_model::run_tape(lambda_transducer_value_cache& scope, unsigned long slot) const {
+  const value_t* operands[8];
+
+  // drop the values that no later instruction reads
+  auto release = [&](const tape_instruction& instruction) {
+    for(unsigned long i = 0; i < instruction.num_releases; ++i) {
+      auto& released = scope.values_cache[tape_releases_m[instruction.releases_begin + i]];
+      released.first = false;
+      released.second = value_t();
+    }
+  };
+
+  while(scope.tape_position < tape_m.size()) {
+    auto& instruction = tape_m[scope.tape_position++];
+    auto&& [computed, value] = scope.values_cache[instruction.result];
+
+    if(instruction.op == tape_instruction::opcode::make_list) {
+      std::vector<value_t> items;
+      items.reserve(instruction.num_operands);
+      std::vector<const value_t*> recorded_items;
+      for(unsigned long i = 0; i < instruction.num_operands; ++i) {
+        auto&& operand = tape_operands_m[instruction.operands_begin + i];
+        auto&& item = operand.owner_nesting_depth == nesting_depth_m ? scope.values_cache[operand.value_idx].second : evaluate_value_placeholder(operand);
+        if(graph_replay::is_recording()) recorded_items.push_back(&item);
+        items.push_back(item);
+      }
+      value = value_t(std::move(items));
+      graph_replay::record_make_list(recorded_items, value);
+    }
+    else if(instruction.op == tape_instruction::opcode::constant) {
+      value = instruction.constant;
+      graph_replay::record_constant(value);
+    }
+    else if(instruction.fused_activation && operator_fusion::is_enabled() && !graph_replay::is_recording()) {
+      for(unsigned long i = 0; i < instruction.num_operands; ++i) {
+        auto&& operand = tape_operands_m[instruction.operands_begin + i];
+        operands[i] = operand.owner_nesting_depth == nesting_depth_m ? &scope.values_cache[operand.value_idx].second : &evaluate_value_placeholder(operand);
+      }
+
+      // compute the activation (the next instruction) together, straight into its slot
+      auto& next = tape_m[scope.tape_position++];
+      auto&& [next_computed, next_value] = scope.values_cache[next.result];
+      next_value = operator_fusion::transduce(*instruction.transducer, *instruction.fused_activation, operands, instruction.num_operands);
+      next_computed = true;
+      release(instruction);
+      release(next);
+      if(next.result == slot) return;
+      continue;
+    }
+    else {
+      for(unsigned long i = 0; i < instruction.num_operands; ++i) {
+        auto&& operand = tape_operands_m[instruction.operands_begin + i];
+        operands[i] = operand.owner_nesting_depth == nesting_depth_m ? &scope.values_cache[operand.value_idx].second : &evaluate_value_placeholder(operand);
+      }
+      std::shared_ptr<transducer_variant> tbd;
+      auto transducer = instruction.transducer;
+      if(instruction.op == tape_instruction::opcode::transduce_tbd) {
+        tbd = instruction.tbd_transducer.lock();
+        transducer = tbd.get();
+      }
+      graph_replay::call recorded(transducer, operands, instruction.num_operands);
+      value = transducer->_apply(operands, instruction.num_operands);
+      recorded.commit(value);
+    }
+    computed = true;
+    release(instruction);
+
+    if(instruction.result == slot) return;
+  }
 }
 
 const value_t & lambda_transducer_model::evaluate_value_placeholder(const value_placeholder& vp) {
@@ -167,6 +466,8 @@ const value_t & lambda_transducer_model::evaluate_value_placeholder(const value_
     throw std::runtime_error("Value cannot be obtained in the current scope");
   }
 
+  graph_replay::observe_scope(scope);
+
   auto& [computed, value] = scope->values_cache[vp.value_idx];
 
   // Return the value if it is in cache
@@ -176,16 +477,12 @@ const value_t & lambda_transducer_model::evaluate_value_placeholder(const value_
 
   // Use the sequential evaluation strategy if the transducer has no lazy operations
   if(!owner->has_lazy_operation) {
-    for(unsigned long idx_i = owner->arity_m; idx_i < owner->num_locals(); ++idx_i) {
-      auto& [computed, value] = scope->values_cache[idx_i];
-      value = evaluate_compute_behavior(owner->locals_m[idx_i]);
-      computed = true;
-      if(idx_i == vp.value_idx) return value;
-    }
+    owner->run_tape(*scope, vp.value_idx);
+    if(computed) return value;
   }
 
   // Compute the value according to computation behavior
-  value = evaluate_compute_behavior(owner->locals_m[vp.value_idx]);
+  evaluate_compute_behavior(owner->locals_m[vp.value_idx], value);
   computed = true;
   return value;
 }
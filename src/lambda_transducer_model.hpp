@@ -10,6 +10,8 @@
 #include "include/value_placeholder.hpp"
 #include "compute_value_behavior.hpp"
 #include "lambda_transducer_value_cache.hpp"
+#include "graph_replay.hpp"
+#include "operator_fusion.hpp"
 
 #include <variant>
 #include <mutex>
@@ -78,13 +80,101 @@ namespace tg {
      */
     bool has_lazy_operation{false};
 
+    /**
+     * \brief One step of the flat instruction tape
+     *
+     * Computes one slot of the value cache from the operands tape_operands_m[operands_begin, operands_begin + num_operands).
+     */
+    struct tape_instruction {
+      enum class opcode : unsigned char {
+        constant,
+        make_list,
+        transduce,
+        transduce_tbd
+      };
+      opcode op{};
+
+      /**
+       * \brief The slot to store the result into
+       */
+      unsigned long result{};
+
+      unsigned long operands_begin{};
+
+      unsigned long num_operands{};
+
+      /**
+       * \brief The transducer to invoke (when op is transduce). Kept alive by locals_m.
+       */
+      transducer_variant* transducer{};
+
+      /**
+       * \brief The transducer to invoke (when op is transduce_tbd). It may be defined after this transducer is constructed.
+       */
+      std::weak_ptr<transducer_variant> tbd_transducer;
+
+      /**
+       * \brief The value (when op is constant)
+       */
+      value_t constant;
+
+      /**
+       * \brief The slots to release after this instruction, tape_releases_m[releases_begin, releases_begin + num_releases)
+       *
+       * These are the slots whose last consumer is this instruction.
+       */
+      unsigned long releases_begin{};
+
+      unsigned long num_releases{};
+
+      /**
+       * \brief The activation applied by the next instruction, if it can be fused into this one (see tg::operator_fusion)
+       */
+      std::optional<dynet::AffineActivation> fused_activation;
+    };
+
+    /**
+     * \brief The locals lowered into a flat list of instructions, in topological order
+     *
+     * Only used when the transducer has no lazy operations (so that it can be executed sequentially).
+     * Operands in the same transducer are read directly from their slots, without resolving the scope.
+     * Composed transducers are unrolled into one instruction per stage, whose intermediate results go into extra slots after the locals.
+     */
+    std::vector<tape_instruction> tape_m;
+
+    /**
+     * \brief The operands of all the instructions on the tape
+     */
+    std::vector<value_placeholder> tape_operands_m;
+
+    /**
+     * \brief The slots to release after each instruction on the tape
+     */
+    std::vector<unsigned long> tape_releases_m;
+
+    /**
+     * \brief The number of value cache slots, the locals followed by the intermediate results of unrolled composed transducers
+     */
+    unsigned long num_slots_m{};
+
+    /**
+     * \brief The recorded applications of this transducer, when tg::graph_replay_guard is guarded
+     */
+    graph_replay::cache replay_cache_m;
+
     friend value_placeholder;
   public:
     template<typename Archive>
-    void serialize(Archive& ar) {
+    void save(Archive& ar) const {
       ar(nesting_depth_m, arity_m, locals_m, ret_m, has_lazy_operation);
     }
 
+    template<typename Archive>
+    void load(Archive& ar) {
+      ar(nesting_depth_m, arity_m, locals_m, ret_m, has_lazy_operation);
+      compile_tape();
+    }
+
     lambda_transducer_model() = default;
     lambda_transducer_model(const lambda_transducer_model&) = default;
     lambda_transducer_model(lambda_transducer_model&& x) noexcept = default;
@@ -109,6 +199,7 @@ namespace tg {
           return input_placeholders[i];
         }));
 
+      ret.compile_tape();
       return ret;
     }
 
@@ -118,6 +209,12 @@ namespace tg {
 
     [[nodiscard]] unsigned long num_locals() const;
 
+    /**
+     * \brief The number of slots that the value cache needs when applying this transducer
+     * \return The number of slots
+     */
+    [[nodiscard]] unsigned long num_slots() const;
+
     [[nodiscard]] std::string default_name() const;
 
     template<typename ...Args>
@@ -127,8 +224,11 @@ namespace tg {
         throw std::runtime_error("Argument count error");
       }
 
-      lambda_transducer_value_cache _(this, args...);
-      return evaluate_value_placeholder(ret_m);
+      const value_t* inputs[argc + 1] = {&args...};
+      if(graph_replay::is_ready()) {
+        return graph_replay::transduce(replay_cache_m, inputs, argc, [&]() {return evaluate_inputs(inputs);});
+      }
+      return evaluate_inputs(inputs);
     }
 
     std::vector<std::shared_ptr<transducer_variant>> nested_transducers();
@@ -180,7 +280,43 @@ namespace tg {
 
   private:
 
-    static value_t evaluate_compute_behavior(const compute_value_behavior& behavior);
+    /**
+     * \brief Compute a local value according to its computation behavior
+     * \param behavior The computation behavior
+     * \param value The slot to store the value into
+     */
+    static void evaluate_compute_behavior(const compute_value_behavior& behavior, value_t& value);
+
+    /**
+     * \brief Apply this transducer in a new scope
+     * \param inputs The inputs, as many as the arity
+     * \return The return value
+     */
+    value_t evaluate_inputs(const value_t* const* inputs);
+
+    /**
+     * \brief Lower the locals into the flat instruction tape (see tape_m)
+     *
+     * Instructions that contribute neither to the return value nor to a slot captured by a nested transducer are left out.
+     * Every other slot is released right after its last consumer on the tape.
+     */
+    void compile_tape();
+
+    /**
+     * \brief Find the slots of this transducer that nested lambda transducers read from
+     *
+     * These slots may be read at any time while the nested transducers run, so they are never released.
+     *
+     * \return For every slot, whether it is captured
+     */
+    std::vector<bool> find_captured_slots();
+
+    /**
+     * \brief Run the tape in the given scope, until the given slot is computed
+     * \param scope The value cache of this transducer
+     * \param slot The slot to compute
+     */
+    void run_tape(lambda_transducer_value_cache& scope, unsigned long slot) const;
 
     value_placeholder make_value_placeholder_impl(compute_value_behavior behavior);
   };
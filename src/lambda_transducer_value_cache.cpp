@@ -9,27 +9,28 @@ using namespace tg;
 using namespace std;
 
 thread_local lambda_transducer_value_cache* lambda_transducer_value_cache::top = nullptr;
+thread_local std::vector<lambda_transducer_value_cache*> lambda_transducer_value_cache::scope_by_nesting_depth;
 
-lambda_transducer_value_cache::~lambda_transducer_value_cache() {
-  top = top->parent;
+lambda_transducer_value_cache::lambda_transducer_value_cache(lambda_transducer_model* transducer, const value_t* const* args, unsigned long num_args) :
+  parent(top), transducer(transducer) {
+  resize_values_cache_to_transducer_num_slots();
+  for(unsigned long i = 0; i < num_args; ++i) {
+    values_cache[i] = std::make_pair(true, *args[i]);
+  }
+  auto depth = transducer->nesting_depth();
+  if(depth >= scope_by_nesting_depth.size()) scope_by_nesting_depth.resize(depth + 1, nullptr);
+  shadowed = scope_by_nesting_depth[depth];
+  scope_by_nesting_depth[depth] = this;
+  top = this;
 }
 
-
-
-lambda_transducer_value_cache *lambda_transducer_value_cache::get_scope_by_nesting_depth(unsigned long depth) {
-  lambda_transducer_value_cache* ret = top;
-  while(ret != nullptr) {
-    if(ret->transducer->nesting_depth() == depth) {
-
-      return ret;
-    }
-    ret = ret->parent;
-  }
-  return nullptr;
+lambda_transducer_value_cache::~lambda_transducer_value_cache() {
+  scope_by_nesting_depth[transducer->nesting_depth()] = shadowed;
+  top = top->parent;
 }
 
-void lambda_transducer_value_cache::resize_values_cache_to_transducer_num_locals() {
-  values_cache.resize(transducer->num_locals());
+void lambda_transducer_value_cache::resize_values_cache_to_transducer_num_slots() {
+  values_cache.resize(transducer->num_slots());
 }
 
 template<class> inline constexpr bool always_false_v = false;
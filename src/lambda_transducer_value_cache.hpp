@@ -5,6 +5,7 @@
 #ifndef LEGO_TRANSDUCE_TIME_SCOPE_HPP_
 #define LEGO_TRANSDUCE_TIME_SCOPE_HPP_
 #include "include/value_placeholder.hpp"
+#include <vector>
 namespace tg {
   class lambda_transducer_model;
   /**
@@ -29,31 +30,49 @@ namespace tg {
      */
     std::vector<std::pair<bool, value_t>> values_cache;
 
+    /**
+     * \brief The innermost cache at the same nesting depth before this one was created
+     *
+     * Restored to scope_by_nesting_depth when this cache is destroyed.
+     */
+    lambda_transducer_value_cache* shadowed;
+
+    /**
+     * \brief The next instruction to run on the transducer's tape
+     */
+    unsigned long tape_position{};
+
     /**
      * \brief Globally points to the cache of the current transducer being invoked.
      */
     static thread_local lambda_transducer_value_cache* top;
 
+    /**
+     * \brief Globally points to the innermost cache at each nesting depth, so that a scope can be found in constant time.
+     */
+    static thread_local std::vector<lambda_transducer_value_cache*> scope_by_nesting_depth;
+
     /**
      * \brief Need to create this scope guard before transducing
      * \param transducer
      * \param args The values that gets passed to this transducer as inputs
+     * \param num_args The number of inputs
      */
-    template<typename ...value_T>
-    lambda_transducer_value_cache(lambda_transducer_model* transducer, value_T ...args):
-    parent(top), transducer(transducer),
-    values_cache(std::initializer_list<std::pair<bool, value_t>>{std::make_pair(true, std::move(args))...})
-    {
-      resize_values_cache_to_transducer_num_locals();
-      top = this;
-    }
+    lambda_transducer_value_cache(lambda_transducer_model* transducer, const value_t* const* args, unsigned long num_args);
 
     ~lambda_transducer_value_cache();
 
-    static lambda_transducer_value_cache* get_scope_by_nesting_depth(unsigned long nesting_depth);
+    /**
+     * \brief Find the innermost cache in the current callstack, of a transducer at the given nesting depth
+     * \param nesting_depth The nesting depth
+     * \return The cache, or nullptr if there isn't any
+     */
+    static lambda_transducer_value_cache* get_scope_by_nesting_depth(unsigned long nesting_depth) {
+      return nesting_depth < scope_by_nesting_depth.size() ? scope_by_nesting_depth[nesting_depth] : nullptr;
+    }
 
   private:
-    void resize_values_cache_to_transducer_num_locals();
+    void resize_values_cache_to_transducer_num_slots();
   };
 
 
@@ -3,10 +3,31 @@
 //
 
 #include "include/lego_guard.hpp"
+#include <dynet/exec.h>
 
 namespace tg {
   DEFINE_THREAD_LOCAL_GUARD_IMPL(lego_training_guard)
   DEFINE_THREAD_LOCAL_GUARD_IMPL(show_cg_construction_time_guard)
   DEFINE_THREAD_LOCAL_GUARD_IMPL(immediate_computation_guard)
+  DEFINE_THREAD_LOCAL_GUARD_IMPL(numerical_health_guard)
+  DEFINE_THREAD_LOCAL_GUARD_IMPL(nan_or_inf_quarantine_guard)
+  DEFINE_THREAD_LOCAL_GUARD_IMPL(graph_replay_guard)
+  DEFINE_THREAD_LOCAL_GUARD_IMPL(operator_fusion_guard)
+
+  /**
+   * \brief The depth-based batching strategy of the dynet execution engine
+   */
+  constexpr int DEPTH_BASED_AUTOBATCH_STRATEGY = 2;
+
+  thread_local unsigned depth_scheduled_batching_guard::num_instances = 0;
+
+  depth_scheduled_batching_guard::depth_scheduled_batching_guard() {
+    num_instances++;
+    dynet::autobatch_strategy_override = DEPTH_BASED_AUTOBATCH_STRATEGY;
+  }
+
+  depth_scheduled_batching_guard::~depth_scheduled_batching_guard() {
+    if(--num_instances == 0) dynet::autobatch_strategy_override = 0;
+  }
 }
 
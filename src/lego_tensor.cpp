@@ -3,10 +3,128 @@
 //
 
 #include "include/lego_tensor.hpp"
+#include <cstdlib>
+#include <cstring>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
 
 using namespace std;
 using namespace tg;
 
+namespace tg {
+  namespace __private_lego_tensor {
+    /**
+     * \brief An input node that shares the values of a concrete tensor
+     *
+     * Holds a reference to the values so that they outlive the computation graph.
+     * On CPU, the node output points straight at the values, which must be aligned (see tg::tensor_input()),
+     * so the values are neither copied nor given memory in the computation graph.
+     */
+    struct shared_input_node : public dynet::Node {
+      shared_input_node(const std::initializer_list<dynet::VariableIndex>& a, const dynet::Dim& dim, tensor_values_t values)
+        : dynet::Node(a), dim(dim), values(move(values)) {}
+
+      dynet::Dim dim_forward(const std::vector<dynet::Dim>& xs) const override {
+        return dim;
+      }
+
+      std::string as_string(const std::vector<std::string>& args) const override {
+        stringstream ss;
+        ss << "constant(" << dim << ')';
+        return ss.str();
+      }
+
+      bool supports_multibatch() const override { return true; }
+
+#if !HAVE_CUDA
+      bool provides_forward_memory() const override { return true; }
+#endif
+
+      void forward_impl(const std::vector<const dynet::Tensor*>& xs, dynet::Tensor& fx) const override {
+#if HAVE_CUDA
+        dynet::TensorTools::set_elements(fx, values.to_vector());
+#else
+        // read only: the execution engines never write into the output of a node that provides its own memory
+        fx.v = const_cast<float*>(values.data());
+#endif
+      }
+
+      void backward_impl(const std::vector<const dynet::Tensor*>& xs, const dynet::Tensor& fx, const dynet::Tensor& dEdf,
+                         unsigned i, dynet::Tensor& dEdxi) const override {
+        throw std::runtime_error("called backward() on an input node");
+      }
+
+      dynet::Dim dim;
+      tensor_values_t values;
+    };
+  }
+}
+
+tensor_values_t::tensor_values_t(std::shared_ptr<const float> buffer, size_type size):buffer_m(move(buffer)), data_m(buffer_m.get()), size_m(size) {}
+
+tensor_values_t::tensor_values_t(const std::vector<float>& values):tensor_values_t(copy_of(values.data(), values.data() + values.size())) {}
+
+std::shared_ptr<float> tensor_values_t::allocate(size_type size) {
+  // aligned_alloc requires the size to be a multiple of the alignment
+  auto bytes = (size * sizeof(float) + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+  if(bytes == 0) bytes = ALIGNMENT;
+#ifndef _WIN32
+  auto ptr = static_cast<float*>(std::aligned_alloc(ALIGNMENT, bytes));
+  if(!ptr) throw std::bad_alloc();
+  return std::shared_ptr<float>(ptr, [](float* p) { std::free(p); });
+#else
+  // MSVC has no aligned_alloc, and memory from _aligned_malloc must be released by _aligned_free
+  auto ptr = static_cast<float*>(_aligned_malloc(bytes, ALIGNMENT));
+  if(!ptr) throw std::bad_alloc();
+  return std::shared_ptr<float>(ptr, [](float* p) { _aligned_free(p); });
+#endif
+}
+
+tensor_values_t tensor_values_t::copy_of(const float* begin, const float* end) {
+  return create(end - begin, [&](float* out) {
+    if(end > begin) memcpy(out, begin, (end - begin) * sizeof(float));
+  });
+}
+
+tensor_values_t tensor_values_t::view_of(std::shared_ptr<const void> owner, const float* data, size_type size) {
+  return tensor_values_t(std::shared_ptr<const float>(move(owner), data), size);
+}
+
+tensor_values_t tensor_values_t::filled(size_type size, float value) {
+  return create(size, [&](float* out) {
+    std::fill(out, out + size, value);
+  });
+}
+
+tensor_values_t tensor_values_t::slice(size_type begin, size_type end) const {
+  if(begin > end || end > size_m) throw_with_nested(std::out_of_range("Tensor values slice out of range"));
+  tensor_values_t ret(*this);
+  ret.data_m = data_m + begin;
+  ret.size_m = end - begin;
+  return ret;
+}
+
+bool tensor_values_t::is_aligned() const {
+  return reinterpret_cast<std::uintptr_t>(data_m) % ALIGNMENT == 0;
+}
+
+std::shared_ptr<const float> tensor_values_t::shared_data() const {
+  return std::shared_ptr<const float>(buffer_m, data_m);
+}
+
+std::vector<float> tensor_values_t::to_vector() const {
+  return std::vector<float>(begin(), end());
+}
+
+symbolic_tensor_t tg::tensor_input(dynet::ComputationGraph& cg, const tensor_t& x) {
+  auto c = x;
+#if !HAVE_CUDA
+  if(!c.values.is_aligned()) c.values = tensor_values_t::copy_of(c.values.begin(), c.values.end());
+#endif
+  return symbolic_tensor_t(&cg, cg.add_function<__private_lego_tensor::shared_input_node>({}, to_dynet_dim(c.shape), move(c.values)));
+}
+
 dynet::Dim tg::to_dynet_dim(const tg::tensor_shape_t& dim) {
   return dynet::Dim(dim);
 }
@@ -40,7 +158,11 @@ std::string tg::print_tensor_shape(const tensor_shape_t& sizes) {
 
 tg::tensor_t tg::tensor_t::from_dynet_tensor(const dynet::Tensor& dynet_tensor) {
   tensor_t ret;
+#if HAVE_CUDA
   ret.values = dynet::as_vector(dynet_tensor);
+#else
+  ret.values = tensor_values_t::copy_of(dynet_tensor.v, dynet_tensor.v + dynet_tensor.d.size());
+#endif
   ret.shape = from_dynet_dim(dynet_tensor.d);
   return ret;
 }
@@ -48,19 +170,18 @@ tg::tensor_t tg::tensor_t::from_dynet_tensor(const dynet::Tensor& dynet_tensor)
 tensor_t tensor_t::zeros(const tensor_shape_t& dim) {
   tensor_t ret;
   ret.shape = dim;
-  ret.values.resize(tensor_num_values(dim), 0);
+  ret.values = tensor_values_t::filled(tensor_num_values(dim), 0);
   return ret;
 }
 
 tensor_t tensor_t::ones(const tensor_shape_t& dim) {
   tensor_t ret;
   ret.shape = dim;
-  ret.values.resize(tensor_num_values(dim), 1);
+  ret.values = tensor_values_t::filled(tensor_num_values(dim), 1);
   return ret;
 }
 
 std::ostream& tg::operator<<(std::ostream& os, const tensor_t& x) {
-
   os << "tensor(" << print_tensor_shape(x.shape) << ")";
 
   if (x.values.size() > tensor_t::MAX_TENSOR_ELEMS_TO_PRINT) return os;
@@ -94,7 +215,9 @@ std::ostream& tg::operator<<(std::ostream& os, const tensor_t& x) {
   return os;
 }
 
-tensor_t::tensor_t(std::vector<float> values, tensor_shape_t shape):values(move(values)), shape(move(shape)) {
+tensor_t::tensor_t(std::vector<float> values, tensor_shape_t shape):tensor_t(tensor_values_t(values), move(shape)) {}
+
+tensor_t::tensor_t(tensor_values_t values, tensor_shape_t shape):values(move(values)), shape(move(shape)) {
   auto shape_num_values = tensor_num_values(this->shape);
   if (this->values.size() != shape_num_values) {
     stringstream ss;
@@ -105,5 +228,100 @@ tensor_t::tensor_t(std::vector<float> values, tensor_shape_t shape):values(move(
   }
 }
 
-tensor_t::tensor_t(std::vector<float> values):tensor_t(move(values), {(long)values.size()}) {}
+tensor_t::tensor_t(std::vector<float> values):tensor_t(tensor_values_t(values), {(long)values.size()}) {}
+
+std::vector<unsigned long> tensor_t::column_major_strides() const {
+  std::vector<unsigned long> ret(shape.size());
+  unsigned long stride = 1;
+  for(unsigned long i=0; i<shape.size(); ++i) {
+    ret[i] = stride;
+    stride *= shape[i];
+  }
+  return ret;
+}
+
+tensor_values_t tensor_t::gather(const float* first, const tensor_shape_t& shape, const std::vector<unsigned long>& strides) {
+  auto num_values = tensor_num_values(shape);
+  return tensor_values_t::create(num_values, [&](float* out) {
+    // walk the elements in column major order, like an odometer
+    std::vector<unsigned long> index(shape.size(), 0);
+    unsigned long offset = 0;
+    for(unsigned long i=0; i<num_values; ++i) {
+      out[i] = first[offset];
+      for(unsigned long axis=0; axis<shape.size(); ++axis) {
+        if(++index[axis] < (unsigned long)shape[axis]) {
+          offset += strides[axis];
+          break;
+        }
+        offset -= strides[axis] * (index[axis] - 1);
+        index[axis] = 0;
+      }
+    }
+  });
+}
+
+std::vector<float> tensor_t::to_vector() const {
+  return values.to_vector();
+}
+
+tensor_t tensor_t::reshape(tensor_shape_t shape) const {
+  return tensor_t(values, move(shape));
+}
+
+tensor_t tensor_t::slice(unsigned long axis, unsigned long begin, unsigned long end) const {
+  if(axis >= shape.size()) {
+    throw_with_nested(std::runtime_error("Cannot slice axis " + std::to_string(axis) + " of a tensor of shape " + print_tensor_shape(shape)));
+  }
+  if(begin > end || end > (unsigned long)shape[axis]) {
+    throw_with_nested(std::runtime_error("Slice [" + std::to_string(begin) + ", " + std::to_string(end) + ") out of range on axis " + std::to_string(axis) + " of a tensor of shape " + print_tensor_shape(shape)));
+  }
+  auto strides = column_major_strides();
+  tensor_t ret;
+  ret.shape = shape;
+  ret.shape[axis] = end - begin;
+  auto num_values = tensor_num_values(ret.shape);
+
+  // slicing the outermost non-trivial axis keeps the values contiguous, so they can be shared
+  bool stays_contiguous = true;
+  for(auto i=axis+1; i<shape.size(); ++i) {
+    if(shape[i] != 1) stays_contiguous = false;
+  }
+
+  unsigned long first = begin * strides[axis];
+  if(stays_contiguous || num_values == 0) {
+    ret.values = values.slice(first, first + num_values);
+  }
+  else {
+    ret.values = gather(values.data() + first, ret.shape, strides);
+  }
+  return ret;
+}
+
+tensor_t tensor_t::transpose(const std::vector<unsigned long>& dims) const {
+  if(dims.size() != shape.size()) {
+    throw_with_nested(std::runtime_error("Cannot transpose a tensor of shape " + print_tensor_shape(shape) + " with " + std::to_string(dims.size()) + " axes"));
+  }
+  auto old_strides = column_major_strides();
+  std::vector<bool> seen(dims.size(), false);
+  tensor_t ret;
+  std::vector<unsigned long> strides(dims.size());
+  ret.shape.resize(dims.size());
+  for(unsigned long i=0; i<dims.size(); ++i) {
+    if(dims[i] >= dims.size() || seen[dims[i]]) {
+      throw_with_nested(std::runtime_error("Transpose axes must be a permutation of the tensor axes"));
+    }
+    seen[dims[i]] = true;
+    ret.shape[i] = shape[dims[i]];
+    strides[i] = old_strides[dims[i]];
+  }
 
+  // a permutation that only moves axes of length 1 around keeps the values in place
+  unsigned long expected = 1;
+  bool contiguous = true;
+  for(unsigned long i=0; i<ret.shape.size(); ++i) {
+    if(ret.shape[i] != 1 && strides[i] != expected) contiguous = false;
+    expected *= ret.shape[i];
+  }
+  ret.values = contiguous ? values : gather(values.data(), ret.shape, strides);
+  return ret;
+}
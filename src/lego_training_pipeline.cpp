@@ -11,7 +11,12 @@
 #include "include/transducer_dataset.hpp"
 #include "include/lego_transducer.hpp"
 #include "lambda_transducer_value_cache.hpp"
+#include "gradient_buffer.hpp"
 #include <iomanip>
+#include <numeric>
+#include <map>
+#include <condition_variable>
+#include <optional>
 
 using namespace tg;
 using namespace std;
@@ -24,10 +29,42 @@ void tg::training_pipeline::set_batch_size(unsigned long batch_size) {
   this->batch_size_m = batch_size;
 }
 
+void tg::training_pipeline::set_batch_cost_budget(unsigned long cost_budget) {
+  this->batch_cost_budget_m = cost_budget;
+}
+
 void tg::training_pipeline::set_shuffle(bool should_shuffle) {
   this->shuffle_m = should_shuffle;
 }
 
+void tg::training_pipeline::set_pipelined_update(unsigned long max_pending_batches) {
+  this->max_pending_updates_m = max_pending_batches;
+}
+
+void tg::training_pipeline::set_synchronous_data_parallel(unsigned long batches_per_step) {
+  this->batches_per_step_m = batches_per_step;
+}
+
+void tg::training_pipeline::set_bucketing(bool should_bucket) {
+  this->bucketing_m = should_bucket;
+}
+
+void tg::training_pipeline::set_graph_replay(bool should_replay) {
+  this->graph_replay_m = should_replay;
+}
+
+void tg::training_pipeline::set_depth_scheduled_batching(bool should_schedule_by_depth) {
+  this->depth_scheduled_batching_m = should_schedule_by_depth;
+}
+
+void tg::training_pipeline::set_operator_fusion(bool should_fuse) {
+  this->operator_fusion_m = should_fuse;
+}
+
+void tg::training_pipeline::set_datum_size_function(datum_size_fn_t size_fn) {
+  this->datum_size_fn_m = move(size_fn);
+}
+
 tg::event_emitter<>::listener_handle_t
 tg::training_pipeline::add_before_training_example_listener(const tg::event_emitter<>::listener_t& listener) {
   return before_training_datum_listener_m.add_listener(listener);
@@ -86,7 +123,7 @@ void training_pipeline::train_and_validate(transducer_model loss_model,
                                            const std::shared_ptr<const transducer_dataset>& validation_set) {
 
   return train_and_validate_impl(training_set, validation_set, [&](const std::shared_ptr<transducer_dataset>& batch) {
-    return optimizer_m->learn_from_batch(loss_model, batch);
+    return optimizer_m->backward_on_batch(loss_model, batch);
   }, [&](const std::shared_ptr<transducer_dataset>& batch) {
     float batch_loss = 0;
     for(auto&& loss:loss_model.batch_transduce(batch)) {
@@ -98,6 +135,7 @@ void training_pipeline::train_and_validate(transducer_model loss_model,
 
 void training_pipeline::dynamic_train(
   const std::vector<dynamic_transducer_application>& transducer_applications_for_training) {
+  ensure_no_bucketing("dynamic_train");
 
   auto training_set_ids = create_transducer_dataset(1);
   for(unsigned long i=0; i<transducer_applications_for_training.size(); ++i) {
@@ -112,7 +150,7 @@ void training_pipeline::dynamic_train(
     for(auto&& datum : *batch) {
       applications_batch.push_back(transducer_applications_for_training.at(datum.at(0).as_integer()));
     }
-    return optimizer_m->dynamic_learn_from_batch(applications_batch);
+    return optimizer_m->dynamic_backward_on_batch(applications_batch);
   }, [&](const std::shared_ptr<transducer_dataset>& batch) {
     return 0;
   });
@@ -121,6 +159,7 @@ void training_pipeline::dynamic_train(
 void training_pipeline::dynamic_train_and_validate(
   const std::vector<dynamic_transducer_application>& transducer_applications_for_training,
   const std::vector<dynamic_transducer_application>& transducer_applications_for_validation) {
+  ensure_no_bucketing("dynamic_train_and_validate");
 
   auto training_set_ids = create_transducer_dataset(1);
   for(unsigned long i=0; i<transducer_applications_for_training.size(); ++i) {
@@ -138,7 +177,7 @@ void training_pipeline::dynamic_train_and_validate(
     for(auto&& datum : *batch) {
       applications_batch.push_back(transducer_applications_for_training.at(datum.at(0).as_integer()));
     }
-    return optimizer_m->dynamic_learn_from_batch(applications_batch);
+    return optimizer_m->dynamic_backward_on_batch(applications_batch);
   }, [&](const std::shared_ptr<transducer_dataset>& batch)->float {
 
     vector<dynamic_transducer_application> applications_batch;
@@ -163,28 +202,139 @@ void training_pipeline::train(transducer_model loss_model, const std::shared_ptr
 }
 
 unsigned long training_pipeline::num_training_datums_completed() const {
-  return num_training_datums_completed_m;
+  return state_m->num_training_datums_completed;
+}
+
+training_pipeline::training_pipeline(optimizer_base *optimizer): optimizer_m(optimizer), state_m(std::make_unique<runtime_state>()) {
+
+}
+
+thread_local const training_pipeline::runtime_state* training_pipeline::worker_thread_owner = nullptr;
+
+training_pipeline::workers_lease::workers_lease(const training_pipeline& pipeline): prev_owner_m(worker_thread_owner) {
+  if(worker_thread_owner == pipeline.state_m.get()) {
+    // a pool with a single worker runs the tasks on the calling thread
+    workers_m = &inline_workers_m.emplace(1);
+    return;
+  }
+  lock_m = std::unique_lock<std::mutex>(pipeline.state_m->workers_mtx);
+  workers_m = &pipeline.get_workers();
+  worker_thread_owner = pipeline.state_m.get();
+}
+
+training_pipeline::workers_lease::~workers_lease() {
+  worker_thread_owner = prev_owner_m;
+}
+
+parallel_map_thread_pool& training_pipeline::workers_lease::operator*() const {
+  return *workers_m;
+}
+
+training_pipeline::worker_mode_guards::worker_mode_guards(const training_pipeline& pipeline) {
+  if(pipeline.graph_replay_m) replay_m.emplace();
+  if(pipeline.depth_scheduled_batching_m) schedule_by_depth_m.emplace();
+  if(pipeline.operator_fusion_m) fusion_m.emplace();
 }
 
-training_pipeline::training_pipeline(optimizer_base *optimizer): optimizer_m(optimizer) {
+parallel_map_thread_pool& training_pipeline::get_workers() const {
+  auto& workers = state_m->workers;
+  if(!workers || workers->num_workers() != num_workers_m) {
+    workers.reset();
+    workers = std::make_unique<parallel_map_thread_pool>(num_workers_m);
+    auto owner = state_m.get();
+    workers->for_each_worker([&]() {
+      preallocate_thread_local_mempool();
+      if(num_workers_m > 1) worker_thread_owner = owner;
+    });
+  }
+  return *workers;
+}
+
+std::vector<unsigned long>
+training_pipeline::estimate_batch_costs(const std::vector<std::shared_ptr<transducer_dataset>>& batches) const {
+  std::vector<unsigned long> ret;
+  ret.reserve(batches.size());
+  for(auto&& batch:batches) {
+    unsigned long cost = 0;
+    for(unsigned long i=0; i<batch->size(); ++i) {
+      cost += batch->datum_size(i, datum_size_fn_m);
+    }
+    ret.push_back(cost);
+  }
+  return ret;
+}
+
+void training_pipeline::ensure_no_bucketing(const std::string& caller) const {
+  if(bucketing_m) {
+    throw std::runtime_error("Cannot use length bucketing in " + caller + "(): a dynamic transducer application has no datum to measure. Call set_bucketing(false) first.");
+  }
+}
+
+std::vector<std::vector<unsigned long>>
+training_pipeline::group_indices_to_batch(const std::shared_ptr<const transducer_dataset>& dataset, bool shuffle) const {
+  auto len = dataset->size();
+
+  // when bucketing with shuffling, shuffle the datums first so that datums of the same size end up in different batches every time
+  std::shared_ptr<const transducer_dataset> view = dataset;
+  vector<unsigned long> order;
+  if(bucketing_m && shuffle) {
+    order.resize(len);
+    std::iota(order.begin(), order.end(), 0);
+    std::shuffle(order.begin(), order.end(), *dynet::rndeng);
+    view = dataset->select(order);
+  }
+
+  std::vector<std::vector<unsigned long>> ret;
+  if(batch_cost_budget_m > 0) {
+    ret = view->group_indices_to_budgeted_batch(batch_cost_budget_m, datum_size_fn_m, bucketing_m);
+  }
+  else if(bucketing_m) {
+    ret = view->group_indices_to_bucketed_batch(batch_size_m, datum_size_fn_m);
+  }
+  else {
+    for(unsigned long i=0; i<len; i+=batch_size_m) {
+      vector<unsigned long> batch(std::min(i + batch_size_m, len) - i);
+      std::iota(batch.begin(), batch.end(), i);
+      ret.push_back(move(batch));
+    }
+  }
+
+  if(!order.empty()) {
+    for(auto&& batch:ret) {
+      for(auto&& i:batch) {
+        i = order[i];
+      }
+    }
+  }
 
+  if(shuffle) {
+    std::shuffle(ret.begin(), ret.end(), *dynet::rndeng);
+  }
+  return ret;
+}
+
+std::vector<std::shared_ptr<transducer_dataset>>
+training_pipeline::group_to_batch(const std::shared_ptr<const transducer_dataset>& dataset, bool shuffle) const {
+  std::vector<std::shared_ptr<transducer_dataset>> ret;
+  for(auto&& indices:group_indices_to_batch(dataset, shuffle)) {
+    ret.push_back(dataset->select(move(indices)));
+  }
+  return ret;
 }
 
 float training_pipeline::validate_impl(const std::shared_ptr<const transducer_dataset>& validation_set,
                                        const std::function<float(
                                          const std::shared_ptr<transducer_dataset>&)>& compute_loss_from_validation_set_batch) const {
-  parallel_map_thread_pool workers(num_workers_m);
-
-  auto batched_validation_set = validation_set->group_to_batch(batch_size_m);
+  workers_lease lease(*this);
+  auto& workers = *lease;
 
-  workers.for_each_worker([&]() {
-    preallocate_thread_local_mempool();
-  });
+  auto batched_validation_set = group_to_batch(validation_set, false);
 
   std::mutex loss_mtx;
   float sum_validation_loss = 0;
 
-  workers.for_each<std::shared_ptr<transducer_dataset>>(batched_validation_set, [&](const std::shared_ptr<transducer_dataset>& batch) {
+  workers.for_each<std::shared_ptr<transducer_dataset>>(batched_validation_set, [&](const std::shared_ptr<transducer_dataset>& batch, unsigned long) {
+    worker_mode_guards modes(*this);
 
     // compute the current batch loss
     float batch_loss = compute_loss_from_validation_set_batch(batch);
@@ -196,7 +346,7 @@ float training_pipeline::validate_impl(const std::shared_ptr<const transducer_da
       loss_mtx.unlock();
     }
 
-  });
+  }, estimate_batch_costs(batched_validation_set));
 
   return sum_validation_loss / (float)validation_set->size();
 }
@@ -214,6 +364,7 @@ training_pipeline::validate(transducer_model loss_model, const shared_ptr<const
 
 float training_pipeline::dynamic_validate(
   std::vector<dynamic_transducer_application>& transducer_applications_for_validation) const {
+  ensure_no_bucketing("dynamic_validate");
   auto validation_set_ids = create_transducer_dataset(1);
   for(unsigned long i=0; i<transducer_applications_for_validation.size(); ++i) {
     validation_set_ids->emplace_back(i);
@@ -236,31 +387,32 @@ float training_pipeline::dynamic_validate(
 
 std::vector<value_t> training_pipeline::dynamic_transduce_many(
   const std::vector<dynamic_transducer_application>& applications) {
+  ensure_no_bucketing("dynamic_transduce_many");
   auto ids = create_transducer_dataset(1);
   for(unsigned long i=0; i<applications.size(); ++i) {
     ids->emplace_back(i);
   }
-  parallel_map_thread_pool workers(num_workers_m);
-  auto batched_ids = ids->group_to_batch(batch_size_m);
-
-  {
-    workers.for_each_worker([&]() {
-      preallocate_thread_local_mempool();
-    });
+  workers_lease lease(*this);
+  auto& workers = *lease;
+  auto batch_indices = group_indices_to_batch(ids, false);
+  std::vector<std::shared_ptr<transducer_dataset>> batched_ids;
+  for(auto&& indices:batch_indices) {
+    batched_ids.push_back(ids->select(indices));
   }
 
   std::vector<value_t> ret(ids->size());
   workers.for_each<std::shared_ptr<transducer_dataset>>(batched_ids, [&](const std::shared_ptr<transducer_dataset>& batch, unsigned long batch_index){
+    worker_mode_guards modes(*this);
     std::vector<dynamic_transducer_application> batch_applications;
     for(auto&& _id:*batch) {
       batch_applications.push_back(applications.at(_id[0].as_integer()));
     }
     auto batch_result = transducer_instance::dynamic_batch_apply(batch_applications);
-    unsigned long offset = batch_index*batch_size_m;
+    auto&& indices = batch_indices[batch_index];
     for(unsigned long i=0; i<batch_result.size(); ++i) {
-      ret[offset + i] = batch_result[i];
+      ret[indices[i]] = batch_result[i];
     }
-  });
+  }, estimate_batch_costs(batched_ids));
 
   return ret;
 }
@@ -274,27 +426,140 @@ training_pipeline::transduce_many(transducer_model perf, const shared_ptr<const
     throw std::runtime_error(ss.str());
   }
 
-  parallel_map_thread_pool workers(num_workers_m);
-  auto batched_dataset = dataset->group_to_batch(batch_size_m);
-
-  {
-    workers.for_each_worker([&]() {
-      preallocate_thread_local_mempool();
-    });
+  workers_lease lease(*this);
+  auto& workers = *lease;
+  auto batch_indices = group_indices_to_batch(dataset, false);
+  std::vector<std::shared_ptr<transducer_dataset>> batched_dataset;
+  for(auto&& indices:batch_indices) {
+    batched_dataset.push_back(dataset->select(indices));
   }
 
   std::vector<value_t> ret(dataset->size());
   workers.for_each<std::shared_ptr<transducer_dataset>>(batched_dataset, [&](const std::shared_ptr<transducer_dataset>& batch, unsigned long batch_index){
+    worker_mode_guards modes(*this);
     auto batch_result = perf.batch_transduce(batch);
-    unsigned long offset = batch_index*batch_size_m;
+    auto&& indices = batch_indices[batch_index];
     for(unsigned long i=0; i<batch_result.size(); ++i) {
-      ret[offset + i] = batch_result[i];
+      ret[indices[i]] = batch_result[i];
     }
-  });
+  }, estimate_batch_costs(batched_dataset));
 
   return ret;
 }
 
+void training_pipeline::transduce_stream(transducer_model perf, const datum_source_t& source,
+                                         const result_callback_t& on_result, bool preserve_order,
+                                         unsigned long max_in_flight_batches) {
+  workers_lease lease(*this);
+  auto& workers = *lease;
+
+  if(max_in_flight_batches == 0) {
+    max_in_flight_batches = 2 * std::max(num_workers_m, 1ul);
+  }
+
+  std::mutex mtx; // guards the source, the delivery and all states below
+  std::condition_variable cv;
+  bool source_exhausted = false;
+  std::exception_ptr error; // a datum that the model cannot take stops the reading
+  std::vector<value_t> carried_datum; // a datum read from the source that did not fit into the previous batch
+  unsigned long num_datums_read = 0;
+  unsigned long num_batches_read = 0;
+  unsigned long num_batches_delivered = 0;
+  unsigned long num_in_flight = 0;
+
+  // finished batches waiting to be delivered in order, indexed by batch ID. Stores the index of the first datum and the outputs
+  std::map<unsigned long, std::pair<unsigned long, std::vector<value_t>>> finished_batches;
+
+  auto deliver = [&](unsigned long first_index, const std::vector<value_t>& results) {
+    for(unsigned long i=0; i<results.size(); ++i) {
+      on_result(first_index + i, results[i]);
+    }
+    --num_in_flight;
+  };
+
+  workers.for_each_worker([&]() {
+    while(true) {
+      std::vector<std::vector<value_t>> datums;
+      unsigned long batch_id{};
+      unsigned long first_index{};
+
+      // read a batch from the source
+      {
+        std::unique_lock<std::mutex> lock(mtx);
+        cv.wait(lock, [&]() {
+          return source_exhausted || num_in_flight < max_in_flight_batches;
+        });
+
+        unsigned long batch_cost = 0;
+        while(!source_exhausted || !carried_datum.empty()) {
+          if(batch_cost_budget_m == 0 && datums.size() >= batch_size_m) break;
+          std::vector<value_t> datum;
+          if(!carried_datum.empty()) {
+            datum = std::move(carried_datum);
+            carried_datum.clear();
+          }
+          else if(!source(datum)) {
+            source_exhausted = true;
+            break;
+          }
+          if(!perf.is_arity(datum.size())) {
+            stringstream ss;
+            ss << "Cannot transduce a datum of arity "<< datum.size();
+            error = std::make_exception_ptr(std::runtime_error(ss.str()));
+            source_exhausted = true;
+            datums.clear();
+            break;
+          }
+          if(batch_cost_budget_m > 0) {
+            auto datum_cost = datum_size_fn_m(datum);
+            if(!datums.empty() && batch_cost + datum_cost > batch_cost_budget_m) {
+              carried_datum = std::move(datum);
+              break;
+            }
+            batch_cost += datum_cost;
+          }
+          datums.push_back(std::move(datum));
+        }
+
+        if(datums.empty()) {
+          cv.notify_all();
+          return;
+        }
+        batch_id = num_batches_read++;
+        first_index = num_datums_read;
+        num_datums_read += datums.size();
+        ++num_in_flight;
+      }
+
+      auto batch = create_transducer_dataset(datums.front().size());
+      for(auto&& datum:datums) {
+        batch->apply_emplace_back(std::move(datum));
+      }
+      worker_mode_guards modes(*this);
+      auto batch_result = perf.batch_transduce(batch);
+
+      // deliver the results
+      {
+        std::lock_guard<std::mutex> lock(mtx);
+        if(!preserve_order) {
+          deliver(first_index, batch_result);
+        }
+        else {
+          finished_batches.emplace(batch_id, std::make_pair(first_index, std::move(batch_result)));
+          for(auto found = finished_batches.find(num_batches_delivered); found != finished_batches.end(); found = finished_batches.find(num_batches_delivered)) {
+            deliver(found->second.first, found->second.second);
+            finished_batches.erase(found);
+            ++num_batches_delivered;
+          }
+        }
+      }
+      cv.notify_all();
+    }
+  });
+
+  if(error) std::rethrow_exception(error);
+}
+
 namespace __private_lego_training_pipeline {
   void print_duration(ostream& os, const std::chrono::steady_clock::duration& duration) {
     if( duration < std::chrono::milliseconds(10)) {
@@ -307,9 +572,25 @@ namespace __private_lego_training_pipeline {
       os << std::chrono::duration_cast<std::chrono::seconds>(duration).count() << "s";
     }
   }
+
+  /**
+   * \brief Enables pipelined update on an optimizer during its lifetime
+   */
+  class pipelined_update_guard {
+    optimizer_base* optimizer_m;
+  public:
+    pipelined_update_guard(optimizer_base* optimizer, unsigned long max_pending_batches) : optimizer_m(optimizer) {
+      optimizer_m->set_pipelined_update(max_pending_batches);
+    }
+    pipelined_update_guard(const pipelined_update_guard&) = delete;
+    pipelined_update_guard& operator=(const pipelined_update_guard&) = delete;
+    ~pipelined_update_guard() {
+      optimizer_m->set_pipelined_update(0);
+    }
+  };
 }
 using namespace __private_lego_training_pipeline;
-void training_pipeline::train_and_validate_impl(const std::shared_ptr<const transducer_dataset>& training_set, const std::shared_ptr<const transducer_dataset>& validation_set, const std::function<float(const std::shared_ptr<transducer_dataset>&)>& learn_from_training_set_batch, const std::function<float(const std::shared_ptr<transducer_dataset>&)>& compute_loss_from_validation_set_batch) {
+void training_pipeline::train_and_validate_impl(const std::shared_ptr<const transducer_dataset>& training_set, const std::shared_ptr<const transducer_dataset>& validation_set, const std::function<float(const std::shared_ptr<transducer_dataset>&)>& backward_on_training_set_batch, const std::function<float(const std::shared_ptr<transducer_dataset>&)>& compute_loss_from_validation_set_batch) {
   if(!optimizer_m) {
     throw std::runtime_error("Cannot perform training because no optimizer is specified. Please provide an optimizer when constructing a training_pipeline.");
   }
@@ -319,24 +600,22 @@ void training_pipeline::train_and_validate_impl(const std::shared_ptr<const tran
     return;
   }
 
-  parallel_map_thread_pool workers(num_workers_m);
+  auto batched_training_set = group_to_batch(training_set, shuffle_m);
 
-  auto batched_training_set = training_set->group_to_batch(batch_size_m);
+  auto batched_validation_set = group_to_batch(validation_set, false);
+  auto validation_batch_costs = estimate_batch_costs(batched_validation_set);
 
-  if(shuffle_m) {
-    std::shuffle(batched_training_set.begin(), batched_training_set.end(), *dynet::rndeng);
+  // the worker threads are only held while running parallel tasks, so that the listeners and other threads can use them in between
+  wallclock_timer t;
+  t.start();
+  {
+    workers_lease lease(*this);
   }
+  cerr << "Training worker threads initialized in "<<t.milliseconds_elapsed()/(float)1000<<"s"<<endl;
 
-  auto batched_validation_set = validation_set->group_to_batch(batch_size_m);
+  pipelined_update_guard _(optimizer_m, max_pending_updates_m);
 
-  {
-    wallclock_timer t;
-    t.start();
-    workers.for_each_worker([&]() {
-      preallocate_thread_local_mempool();
-    });
-    cerr << "Training worker threads initialized in "<<t.milliseconds_elapsed()/(float)1000<<"s"<<endl;
-  }
+  std::vector<gradient_buffer> gradient_buffers(batches_per_step_m);
 
 
   for(unsigned long i_epoch = 0; i_epoch < num_epochs_m; ++i_epoch) {
@@ -356,17 +635,20 @@ void training_pipeline::train_and_validate_impl(const std::shared_ptr<const tran
     wallclock_timer epoch_timer; // measures the time spent for the entire epoch
     epoch_timer.start();
 
-    // train on training set
-    workers.for_each<std::shared_ptr<transducer_dataset>>(batched_training_set, [&](const std::shared_ptr<transducer_dataset>& batch) {
+    // computes the gradient on a batch, and optionally updates the model right away
+    auto train_on_batch = [&](const std::shared_ptr<transducer_dataset>& batch, bool should_update) {
 
       // fire the before training datum event
       before_training_datum_listener_m.fire();
 
+      worker_mode_guards modes(*this);
+
       float loss{};
 
       try {
         // compute the current batch loss and update the model
-        loss = learn_from_training_set_batch(batch);
+        loss = backward_on_training_set_batch(batch);
+        if(should_update) optimizer_m->apply_gradients();
       }
       catch(std::exception& e) {
         num_datums_failed += batch->size();
@@ -386,7 +668,7 @@ void training_pipeline::train_and_validate_impl(const std::shared_ptr<const tran
 
       // accumulate the # of datums trained
       {
-        num_training_datums_completed_m += batch->size();
+        state_m->num_training_datums_completed += batch->size();
         num_datums_trained += batch->size();
       }
 
@@ -407,8 +689,39 @@ void training_pipeline::train_and_validate_impl(const std::shared_ptr<const tran
 
         report_mtx.unlock();
       }
-    });
+    };
+
+    // train on training set
+    if(batches_per_step_m == 0) {
+      workers_lease lease(*this);
+      (*lease).for_each<std::shared_ptr<transducer_dataset>>(batched_training_set, [&](const std::shared_ptr<transducer_dataset>& batch) {
+        train_on_batch(batch, true);
+      });
+    }
+    else {
+      for(unsigned long step_begin = 0; step_begin < batched_training_set.size(); step_begin += batches_per_step_m) {
+        auto step_end = std::min(step_begin + batches_per_step_m, (unsigned long)batched_training_set.size());
+        std::vector<std::shared_ptr<transducer_dataset>> step_batches(batched_training_set.begin() + step_begin, batched_training_set.begin() + step_end);
 
+        workers_lease lease(*this);
+
+        // the forward passes read the parameters, and the gradient buffers skip the optimizer's own wait for pending updates,
+        // so the update of the previous step must finish first
+        optimizer_m->wait_for_pending_updates();
+
+        // every batch writes its gradient into its own buffer
+        (*lease).for_each<std::shared_ptr<transducer_dataset>>(step_batches, [&](const std::shared_ptr<transducer_dataset>& batch, unsigned long i) {
+          gradient_buffer_guard _(gradient_buffers[i]);
+          train_on_batch(batch, false);
+        });
+
+        gradient_buffer::reduce_into_parameters(gradient_buffers, *lease);
+        optimizer_m->apply_gradients();
+      }
+    }
+
+    // make sure the model is up-to-date before validating
+    optimizer_m->wait_for_pending_updates();
 
     // validate on validation set
     bool is_new_best = false;
@@ -417,7 +730,9 @@ void training_pipeline::train_and_validate_impl(const std::shared_ptr<const tran
     if(!batched_validation_set.empty()) {
 
       // calculate the validation set loss
-      workers.for_each<std::shared_ptr<transducer_dataset>>(batched_validation_set, [&](const std::shared_ptr<transducer_dataset>& batch) {
+      workers_lease lease(*this);
+      (*lease).for_each<std::shared_ptr<transducer_dataset>>(batched_validation_set, [&](const std::shared_ptr<transducer_dataset>& batch, unsigned long) {
+        worker_mode_guards modes(*this);
 
         // compute the current batch loss
 
@@ -430,7 +745,7 @@ void training_pipeline::train_and_validate_impl(const std::shared_ptr<const tran
           loss_mtx.unlock();
         }
 
-      });
+      }, validation_batch_costs);
 
 
       // update new best record if possible
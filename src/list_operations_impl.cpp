@@ -109,10 +109,10 @@ string list_select_op::default_name() const {
 }
 
 value_t list_push_op::transduce(const value_t& in0, const value_t& in1) {
+  // shares the items of in0, and appends in place when nothing has been appended after in0 yet
   auto ret = in0.as_list();
-  auto&& item = in1;
-  ret.push_back(item);
-  return value_t(ret);
+  ret.push_back(in1);
+  return value_t(move(ret));
 }
 
 string list_push_op::default_name() const {
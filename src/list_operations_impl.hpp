@@ -304,14 +304,15 @@ namespace tg {
       if constexpr (argc == 1) return std::get<0>(std::forward_as_tuple(args...));
 
       std::initializer_list<value_t> ins{args...};
-      std::vector<value_t> ret;
+      auto itr = ins.begin();
 
-      for(auto&& in:ins) {
-        auto&& i_list = in.as_list();
-        ret.insert(ret.end(), i_list.begin(), i_list.end());
+      // shares the items of the first list, so only the other lists are copied
+      list_t ret = itr->as_list();
+      for(++itr; itr != ins.end(); ++itr) {
+        ret.append(itr->as_list());
       }
 
-      return value_t(ret);
+      return value_t(std::move(ret));
     }
 
     std::string default_name() const {
@@ -0,0 +1,179 @@
+//
+// Created by Dekai WU and YAN Yuchen on 20201224.
+//
+
+#include "numerical_health.hpp"
+#include "dynet_computation_graph.hpp"
+#include "include/lego_guard.hpp"
+#include <dynet/param-nodes.h>
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <sstream>
+
+using namespace std;
+using namespace tg;
+
+thread_local std::vector<numerical_health::scope_entry> numerical_health::scopes;
+thread_local long numerical_health::current_scope = -1;
+thread_local std::vector<numerical_health::datum_entry> numerical_health::datums;
+
+namespace tg {
+  namespace __private_numerical_health {
+    dynet::VariableIndex num_nodes() {
+      return (dynet::VariableIndex) dynet_computation_graph::p()->nodes.size();
+    }
+
+    // Inf and NaN are exactly the floats whose exponent bits are all set
+    constexpr uint32_t EXPONENT_MASK = 0x7f800000;
+
+    inline uint32_t is_non_finite(const float* x) {
+      uint32_t bits;
+      memcpy(&bits, x, sizeof(float));
+      return (bits & EXPONENT_MASK) == EXPONENT_MASK;
+    }
+  }
+}
+
+bool numerical_health::is_enabled() {
+  return numerical_health_guard::is_guarded() || nan_or_inf_quarantine_guard::is_guarded();
+}
+
+bool numerical_health::all_finite(const float* values, unsigned long size) {
+  using namespace __private_numerical_health;
+  constexpr unsigned long BLOCK_SIZE = 64;
+  unsigned long i = 0;
+  for(; i + BLOCK_SIZE <= size; i += BLOCK_SIZE) {
+    uint32_t any_non_finite = 0;
+    for(unsigned long j = 0; j < BLOCK_SIZE; ++j) {
+      any_non_finite |= is_non_finite(values + i + j);
+    }
+    if(any_non_finite) return false;
+  }
+  uint32_t any_non_finite = 0;
+  for(; i < size; ++i) {
+    any_non_finite |= is_non_finite(values + i);
+  }
+  return !any_non_finite;
+}
+
+bool numerical_health::all_finite(const dynet::Tensor& value) {
+#if HAVE_CUDA
+  auto values = dynet::as_vector(value);
+  return all_finite(values.data(), values.size());
+#else
+  return all_finite(value.v, value.d.size());
+#endif
+}
+
+void numerical_health::transducer_scope::enter(std::string name) {
+  // the scope is open-ended until it exits
+  scopes.push_back(scope_entry{__private_numerical_health::num_nodes(), numeric_limits<dynet::VariableIndex>::max(), current_scope, move(name)});
+  current_scope = (long) scopes.size() - 1;
+}
+
+numerical_health::transducer_scope::~transducer_scope() {
+  if(!active_m || current_scope < 0) return;
+  auto& entry = scopes[current_scope];
+  entry.end_node = __private_numerical_health::num_nodes();
+  current_scope = entry.parent;
+}
+
+void numerical_health::begin_datum(long datum_index) {
+  if(!is_enabled()) return;
+  datums.push_back(datum_entry{__private_numerical_health::num_nodes(), datum_index});
+}
+
+void numerical_health::end_datum() {
+  begin_datum(-1);
+}
+
+void numerical_health::reset() {
+  scopes.clear();
+  current_scope = -1;
+  datums.clear();
+}
+
+std::vector<numerical_health::finding> numerical_health::scan(dynet::VariableIndex up_to) {
+  auto cg = dynet_computation_graph::p();
+  vector<bool> non_finite(up_to + 1, false);
+  vector<finding> ret;
+  for(dynet::VariableIndex i = 0; i <= up_to; ++i) {
+    non_finite[i] = !all_finite(cg->get_value(i));
+    if(!non_finite[i]) continue;
+
+    auto node = cg->nodes[i];
+    bool is_origin = true;
+    for(auto&& arg:node->args) {
+      if(non_finite[arg]) {
+        is_origin = false;
+        break;
+      }
+    }
+    if(!is_origin) continue;
+
+    finding f;
+    f.node = i;
+    stringstream ss;
+    ss << node->as_dummy_string() << " of shape " << node->dim;
+    f.node_description = ss.str();
+
+    // scopes are in pre-order, so the last scope containing the node is the innermost one
+    for(long s = (long) scopes.size() - 1; s >= 0; --s) {
+      auto&& entry = scopes[s];
+      if(entry.first_node <= i && i < entry.end_node) {
+        vector<string> path;
+        for(auto p = s; p >= 0; p = scopes[p].parent) {
+          path.push_back(scopes[p].name);
+        }
+        for(auto it = path.rbegin(); it != path.rend(); ++it) {
+          if(!f.transducer_path.empty()) f.transducer_path += " > ";
+          f.transducer_path += *it;
+        }
+        break;
+      }
+    }
+
+    // parameters and lookups are cached per graph, so they are shared by every datum that uses them
+    f.datum_index = -1;
+    if(dynamic_cast<dynet::ParameterNodeBase*>(node) || dynamic_cast<dynet::ConstParameterNode*>(node)) {
+      ret.push_back(move(f));
+      continue;
+    }
+    for(auto&& entry:datums) {
+      if(entry.first_node > i) break;
+      f.datum_index = entry.datum_index;
+    }
+    ret.push_back(move(f));
+  }
+  return ret;
+}
+
+std::string numerical_health::report(const std::vector<finding>& findings) {
+  stringstream ss;
+  if(findings.empty()) {
+    ss << "NaN or Inf encountered, but no computed node holds such values";
+    return ss.str();
+  }
+  ss << "NaN or Inf encountered. Originated from " << findings.size() << " node(s):";
+  for(auto&& f:findings) {
+    ss << std::endl << "  node #" << f.node << " " << f.node_description;
+    if(!f.transducer_path.empty()) ss << ", in " << f.transducer_path;
+    if(f.datum_index >= 0) ss << ", datum #" << f.datum_index;
+  }
+  return ss.str();
+}
+
+std::vector<long> numerical_health::offending_datums(const std::vector<finding>& findings) {
+  vector<long> ret;
+  for(auto&& f:findings) {
+    if(f.datum_index < 0) throw non_finite_exception(findings);
+    ret.push_back(f.datum_index);
+  }
+  sort(ret.begin(), ret.end());
+  ret.erase(unique(ret.begin(), ret.end()), ret.end());
+  return ret;
+}
+
+numerical_health::non_finite_exception::non_finite_exception(std::vector<finding> findings) :
+  nan_or_inf_exception(report(findings)), findings(move(findings)) {}
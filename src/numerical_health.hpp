@@ -0,0 +1,170 @@
+//
+// Created by Dekai WU and YAN Yuchen on 20201224.
+//
+/// \cond SHOW_INTERNAL_IMPL
+#ifndef LEGO_NUMERICAL_HEALTH_HPP
+#define LEGO_NUMERICAL_HEALTH_HPP
+
+#include <dynet/dynet.h>
+#include "include/transducer_typed_value.hpp"
+#include <string>
+#include <vector>
+
+namespace tg {
+
+  /**
+   * \brief Locates where NaN or Inf values originate, from the values already computed in the computation graph.
+   *
+   * While enabled (see tg::numerical_health_guard), the computation graph is annotated with
+   * which transducer, and which datum, every node is constructed for.
+   * When a NaN or Inf value is found, the node values held by the execution engine are scanned in topological order.
+   * A node is an origin if its own value is NaN or Inf but none of its arguments are.
+   *
+   * Nothing is re-executed, unlike tg::immediate_computation_guard.
+   */
+  class numerical_health {
+  public:
+
+    /**
+     * \brief A node where NaN or Inf values originate
+     */
+    struct finding {
+      dynet::VariableIndex node;
+
+      /**
+       * \brief The operation of the node, and its shape
+       */
+      std::string node_description;
+
+      /**
+       * \brief The nesting of the transducers that constructed the node, outermost first. Empty if unknown.
+       */
+      std::string transducer_path;
+
+      /**
+       * \brief The index of the datum that the node is constructed for. -1 if the node does not belong to a datum.
+       *
+       * Parameter and lookup nodes never belong to a datum, since they are shared by every datum in the batch that uses them.
+       */
+      long datum_index;
+    };
+
+    /**
+     * \brief Whether nodes are being annotated, either tg::numerical_health_guard or tg::nan_or_inf_quarantine_guard is guarded
+     */
+    static bool is_enabled();
+
+    /**
+     * \brief Check whether values are all finite
+     *
+     * Branch-free over fixed size blocks, so that the compiler vectorizes it.
+     *
+     * \param values The values
+     * \param size The number of values
+     * \return False if any value is NaN or Inf
+     */
+    static bool all_finite(const float* values, unsigned long size);
+
+    /**
+     * \brief Check whether the values of a computed node are all finite
+     * \param value The node value
+     * \return False if any value is NaN or Inf
+     */
+    static bool all_finite(const dynet::Tensor& value);
+
+    /**
+     * \brief Marks the beginning of a transducer application, for as long as the object lives.
+     *
+     * Does nothing when not enabled.
+     */
+    class transducer_scope {
+    public:
+      template<typename F>
+      explicit transducer_scope(F&& get_name) : active_m(is_enabled()) {
+        if(active_m) enter(get_name());
+      }
+      transducer_scope(const transducer_scope&) = delete;
+      transducer_scope(transducer_scope&&) noexcept = delete;
+      transducer_scope& operator=(const transducer_scope&) = delete;
+      transducer_scope& operator=(transducer_scope&&) noexcept = delete;
+      ~transducer_scope();
+    private:
+      static void enter(std::string name);
+      bool active_m;
+    };
+
+    /**
+     * \brief Marks that the nodes constructed from now on belong to a datum
+     *
+     * Does nothing when not enabled.
+     *
+     * \param datum_index The index of the datum in the batch
+     */
+    static void begin_datum(long datum_index);
+
+    /**
+     * \brief Marks that the nodes constructed from now on belong to no datum
+     *
+     * Does nothing when not enabled.
+     */
+    static void end_datum();
+
+    /**
+     * \brief Forget all annotations. Called when the computation graph is discarded.
+     */
+    static void reset();
+
+    /**
+     * \brief Find where NaN or Inf values originate
+     *
+     * Only looks at nodes that are already computed.
+     *
+     * \param up_to The index of the last node that is already computed
+     * \return The origins, in topological order
+     */
+    static std::vector<finding> scan(dynet::VariableIndex up_to);
+
+    /**
+     * \brief Describe the origins in human-readable form
+     * \param findings The origins
+     * \return The description
+     */
+    static std::string report(const std::vector<finding>& findings);
+
+    /**
+     * \brief The datums that NaN or Inf values originate from
+     *
+     * Throws if some origin does not belong to any datum, in which case no datum can be blamed.
+     *
+     * \param findings The origins
+     * \return The datum indices, sorted and without duplicates
+     */
+    static std::vector<long> offending_datums(const std::vector<finding>& findings);
+
+    /**
+     * \brief NaN or Inf values are encountered, and their origins are located
+     */
+    class non_finite_exception : public nan_or_inf_exception {
+    public:
+      explicit non_finite_exception(std::vector<finding> findings);
+      std::vector<finding> findings;
+    };
+
+  private:
+    struct scope_entry {
+      dynet::VariableIndex first_node;
+      dynet::VariableIndex end_node;
+      long parent;
+      std::string name;
+    };
+    struct datum_entry {
+      dynet::VariableIndex first_node;
+      long datum_index;
+    };
+    thread_local static std::vector<scope_entry> scopes;
+    thread_local static long current_scope;
+    thread_local static std::vector<datum_entry> datums;
+  };
+}
+
+#endif //LEGO_NUMERICAL_HEALTH_HPP
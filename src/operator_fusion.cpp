@@ -0,0 +1,56 @@
+//
+// Created by Dekai WU and YAN Yuchen on 20201230.
+//
+
+#include "operator_fusion.hpp"
+#include "transducer_variant.hpp"
+#include "numerical_health.hpp"
+#include "include/lego_guard.hpp"
+
+using namespace std;
+using namespace tg;
+
+bool operator_fusion::is_enabled() {
+  return operator_fusion_guard::is_guarded();
+}
+
+bool operator_fusion::is_affine(const transducer_variant& transducer) {
+  if(auto dense = std::get_if<dense_model>(&transducer.v)) return dense->has_bias();
+  if(auto dense = std::get_if<n_ary_dense_model>(&transducer.v)) return dense->has_bias();
+  return false;
+}
+
+std::optional<dynet::AffineActivation> operator_fusion::activation_of(const transducer_variant& transducer) {
+  if(std::holds_alternative<relu_op>(transducer.v)) return dynet::AffineActivation::rectify;
+  if(std::holds_alternative<tanh_op>(transducer.v)) return dynet::AffineActivation::tanh;
+  if(std::holds_alternative<sigmoid_op>(transducer.v)) return dynet::AffineActivation::logistic;
+  return std::nullopt;
+}
+
+value_t operator_fusion::transduce(transducer_variant& affine, dynet::AffineActivation activation, const value_t* const* operands, unsigned long num_operands) {
+  numerical_health::transducer_scope _([&]() { return affine.name(); });
+  try {
+    return std::visit([&](auto&& t)->value_t {
+      using T = std::decay_t<decltype(t)>;
+      if constexpr (std::is_same_v<T, dense_model>) {
+        if(num_operands != 1) throw std::runtime_error("Argument count error");
+        return t.transduce_fused(*operands[0], activation);
+      }
+      else if constexpr (std::is_same_v<T, n_ary_dense_model>) {
+        if(!t.is_arity(num_operands)) throw std::runtime_error("Argument count error");
+        std::vector<value_t> ins;
+        ins.reserve(num_operands);
+        for(unsigned long i = 0; i < num_operands; ++i) {
+          ins.push_back(*operands[i]);
+        }
+        return t.apply_fused(ins, activation);
+      }
+      else {
+        throw std::runtime_error("Cannot fuse an activation into " + affine.name());
+      }
+    }, affine.v);
+  }
+  catch(...) {
+    std::throw_with_nested(std::runtime_error("In " + affine.name()));
+  }
+}
@@ -0,0 +1,65 @@
+//
+// Created by Dekai WU and YAN Yuchen on 20201230.
+//
+/// \cond SHOW_INTERNAL_IMPL
+#ifndef LEGO_OPERATOR_FUSION_HPP
+#define LEGO_OPERATOR_FUSION_HPP
+
+#include "include/transducer_typed_value.hpp"
+#include <dynet/nodes-affinetransform.h>
+#include <optional>
+
+namespace tg {
+
+  class transducer_variant;
+
+  /**
+   * \brief Fuses an affine transducer (dense) with the activation applied right after it, into a single computation graph node.
+   *
+   * Patterns like relu(dense(x)), tanh(dense(x)) and sigmoid(dense(x)) otherwise construct one node for the affine transform
+   * and one for the activation, each with its own pass over the memory (forward and backward).
+   * The fused node applies the activation in place on the result of the affine transform.
+   *
+   * Applies to adjacent stages of a composed transducer, and to adjacent instructions on the tape of a lambda transducer,
+   * when the result of the affine transducer is consumed by the activation only.
+   *
+   * Only relu, tanh and sigmoid are fused. dropout(dense(x)) is not: DyNet draws the dropout mask in a node of its own,
+   * so the affine transform and the dropout stay separate nodes.
+   *
+   * Only takes effect when tg::operator_fusion_guard is guarded.
+   */
+  class operator_fusion {
+  public:
+
+    /**
+     * \brief Whether tg::operator_fusion_guard is guarded
+     */
+    static bool is_enabled();
+
+    /**
+     * \brief Whether a transducer is an affine transform that an activation can be fused into
+     * \param transducer The transducer
+     * \return True for dense layers with a bias
+     */
+    static bool is_affine(const transducer_variant& transducer);
+
+    /**
+     * \brief The activation that a transducer applies, if it can be fused into an affine transform
+     * \param transducer The transducer
+     * \return The activation, or nothing if the transducer cannot be fused
+     */
+    static std::optional<dynet::AffineActivation> activation_of(const transducer_variant& transducer);
+
+    /**
+     * \brief Apply an affine transducer, followed by an activation, as a single node
+     * \param affine The affine transducer (see is_affine())
+     * \param activation The activation
+     * \param operands The operands of the affine transducer
+     * \param num_operands The number of operands
+     * \return The activated result
+     */
+    static value_t transduce(transducer_variant& affine, dynet::AffineActivation activation, const value_t* const* operands, unsigned long num_operands);
+  };
+}
+
+#endif //LEGO_OPERATOR_FUSION_HPP
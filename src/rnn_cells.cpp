@@ -7,6 +7,93 @@
 using namespace tg;
 using namespace std;
 
+namespace {
+  /**
+   * \brief Copy the weights of dense layers applied on concatenate(hidden state, input) into stacked weights
+   *
+   * The gates are stacked along the rows in the given order, and split into the input-to-hidden part and the hidden-to-hidden part.
+   *
+   * \param gates The dense layers to stack
+   * \param bias_offsets The value to add to the bias of each gate
+   * \param hidden_size The size of hidden state, which is also the output size of each dense layer
+   * \param input_size The size of input
+   * \param Wx The stacked input-to-hidden weights to write into
+   * \param Wh The stacked hidden-to-hidden weights to write into
+   * \param b The stacked bias to write into
+   */
+  void stack_gate_weights(const vector<const dense_model*>& gates, const vector<float>& bias_offsets,
+                          unsigned long hidden_size, unsigned long input_size,
+                          backprop_trainable_parameter& Wx, backprop_trainable_parameter& Wh, backprop_trainable_bias_parameter& b) {
+    auto num_rows = gates.size() * hidden_size;
+    vector<float> Wx_values(num_rows * input_size), Wh_values(num_rows * hidden_size), b_values(num_rows);
+    for(unsigned long k = 0; k < gates.size(); ++k) {
+      // dynet stores matrices in column-major order
+      auto W = gates[k]->weight().as_tensor().to_vector();
+      auto bias = gates[k]->bias().as_tensor().to_vector();
+      for(unsigned long r = 0; r < hidden_size; ++r) {
+        auto row = k * hidden_size + r;
+        for(unsigned long c = 0; c < hidden_size; ++c) {
+          Wh_values[c * num_rows + row] = W[c * hidden_size + r];
+        }
+        for(unsigned long c = 0; c < input_size; ++c) {
+          Wx_values[c * num_rows + row] = W[(hidden_size + c) * hidden_size + r];
+        }
+        b_values[row] = bias[r] + bias_offsets[k];
+      }
+    }
+    Wx.set_value(Wx_values);
+    Wh.set_value(Wh_values);
+    b.set_value(b_values);
+  }
+
+  /**
+   * \brief Compute Wx * x + b for all timesteps in one matrix multiplication
+   * \param xs The inputs of all timesteps
+   * \param Wx The input-to-hidden weights
+   * \param b The bias
+   * \return The result of each timestep
+   */
+  vector<value_t> project_all_timesteps(const vector<value_t>& xs, const dynet::Expression& Wx, const dynet::Expression& b) {
+    if(xs.empty()) return {};
+    vector<dynet::Expression> columns;
+    columns.reserve(xs.size());
+    for(auto&& x:xs) {
+      columns.push_back(x.as_symbolic_tensor());
+    }
+    auto projected = dynet::affine_transform({b, Wx, dynet::concatenate_cols(columns)});
+    if(xs.size() == 1) return {value_t(projected)};
+    vector<value_t> ret;
+    ret.reserve(xs.size());
+    for(unsigned t = 0; t < xs.size(); ++t) {
+      ret.emplace_back(dynet::pick(projected, t, 1));
+    }
+    return ret;
+  }
+
+  /**
+   * \brief Same as project_all_timesteps(), but for the stacked weights of the four vanilla LSTM gates
+   *
+   * Adds the constant 1 to the forget gate bias like dynet::vanilla_lstm_gates does, so that the recurrence can use dynet::AffineActivation::lstm_gates.
+   */
+  vector<value_t> project_lstm_inputs(const vector<value_t>& xs, const dynet::Expression& Wx, const dynet::Expression& b, unsigned long hidden_size) {
+    vector<float> forget_gate_bias(hidden_size * 4);
+    std::fill(forget_gate_bias.begin() + hidden_size, forget_gate_bias.begin() + hidden_size * 2, 1.0f);
+    return project_all_timesteps(xs, Wx, b + dynet::input(*dynet_computation_graph::p(), {(unsigned)hidden_size * 4}, forget_gate_bias));
+  }
+}
+
+std::shared_ptr<rnn_cell_base> rnn_cell_base::to_fused_gates() const {
+  return nullptr;
+}
+
+std::vector<value_t> rnn_cell_base::project_inputs(const std::vector<value_t>& xs) {
+  return {};
+}
+
+std::pair<value_t, value_t> rnn_cell_base::transduce_projected_impl(const value_t& prev_state, const value_t& projected_x) {
+  throw std::runtime_error("This RNN cell does not separate the input-to-hidden part");
+}
+
 std::string tg::naive_rnn_cell::default_name() const {
   return "naive_rnn_cell";
 }
@@ -74,6 +161,10 @@ string vanilla_lstm_cell::default_name() const {
   return "vanilla_lstm_cell";
 }
 
+std::shared_ptr<rnn_cell_base> vanilla_lstm_cell::to_fused_gates() const {
+  return make_shared<fused_vanilla_lstm_cell>(*this);
+}
+
 coupled_lstm_cell::coupled_lstm_cell(unsigned long input_size, unsigned long output_size)
   : input_size_m(input_size), output_size_m(output_size),
     forget_gate(input_size + output_size, output_size),
@@ -93,6 +184,10 @@ string coupled_lstm_cell::default_name() const {
   return "coupled_lstm_cell";
 }
 
+std::shared_ptr<rnn_cell_base> coupled_lstm_cell::to_fused_gates() const {
+  return make_shared<fused_coupled_lstm_cell>(*this);
+}
+
 std::pair<value_t, value_t>
 coupled_lstm_cell::transduce_impl(const value_t& prev_state, const value_t& x) {
   auto&&[cell_state, hidden_state] = prev_state.as_tuple<2>();
@@ -133,8 +228,217 @@ string gru_cell::default_name() const {
   return "gru_cell";
 }
 
+std::shared_ptr<rnn_cell_base> gru_cell::to_fused_gates() const {
+  return make_shared<fused_gru_cell>(*this);
+}
+
 gru_cell::gru_cell(unsigned long input_size, unsigned long output_size)
   : input_size_m(input_size), output_size_m(output_size), pre_input_gate_m(output_size + input_size, output_size),
     input_fc_m(output_size + input_size, output_size), output_gate_m(output_size + input_size, output_size) {
 
 }
+
+fused_vanilla_lstm_cell::fused_vanilla_lstm_cell(unsigned long input_size, unsigned long output_size)
+  : input_size_m(input_size), output_size_m(output_size),
+    Wx_m({(long)output_size * 4, (long)input_size}),
+    Wh_m({(long)output_size * 4, (long)output_size}),
+    b_m({(long)output_size * 4}) {
+
+}
+
+fused_vanilla_lstm_cell::fused_vanilla_lstm_cell(const vanilla_lstm_cell& cell)
+  : fused_vanilla_lstm_cell(cell.input_size_m, cell.output_size_m) {
+  // dynet::vanilla_lstm_gates adds 1 to the forget gate bias
+  stack_gate_weights({&cell.input_gate, &cell.forget_gate, &cell.output_gate, &cell.input_layer}, {0, -1, 0, 0},
+                     output_size_m, input_size_m, Wx_m, Wh_m, b_m);
+}
+
+pair<value_t, value_t> fused_vanilla_lstm_cell::transduce_impl(const value_t& prev_state, const value_t& x) {
+  auto&&[cell_state, hidden_state] = prev_state.as_tuple<2>();
+
+  auto gates = dynet::vanilla_lstm_gates(x.as_symbolic_tensor(), hidden_state.as_symbolic_tensor(),
+                                         Wx_m.as_symbolic_tensor(), Wh_m.as_symbolic_tensor(), b_m.as_symbolic_tensor());
+  auto next_cell_state = dynet::vanilla_lstm_c(cell_state.as_symbolic_tensor(), gates);
+  auto next_hidden_state = value_t(dynet::vanilla_lstm_h(next_cell_state, gates));
+
+  return make_pair(
+    next_hidden_state,
+    value_t({value_t(next_cell_state), next_hidden_state})
+  );
+}
+
+vector<value_t> fused_vanilla_lstm_cell::project_inputs(const vector<value_t>& xs) {
+  return project_lstm_inputs(xs, Wx_m.as_symbolic_tensor(), b_m.as_symbolic_tensor(), output_size_m);
+}
+
+pair<value_t, value_t> fused_vanilla_lstm_cell::transduce_projected_impl(const value_t& prev_state, const value_t& projected_x) {
+  auto&&[cell_state, hidden_state] = prev_state.as_tuple<2>();
+
+  auto gates = dynet::affine_transform_activation(
+    {projected_x.as_symbolic_tensor(), Wh_m.as_symbolic_tensor(), hidden_state.as_symbolic_tensor()},
+    dynet::AffineActivation::lstm_gates);
+  auto next_cell_state = dynet::vanilla_lstm_c(cell_state.as_symbolic_tensor(), gates);
+  auto next_hidden_state = value_t(dynet::vanilla_lstm_h(next_cell_state, gates));
+
+  return make_pair(
+    next_hidden_state,
+    value_t({value_t(next_cell_state), next_hidden_state})
+  );
+}
+
+value_t fused_vanilla_lstm_cell::default_initial_state() const {
+  auto zeros = value_t(dynet::zeros(*dynet_computation_graph::p(), {(unsigned)output_size_m}));
+  return value_t({zeros, zeros});
+}
+
+string fused_vanilla_lstm_cell::default_name() const {
+  return "fused_vanilla_lstm_cell";
+}
+
+fused_coupled_lstm_cell::fused_coupled_lstm_cell(unsigned long input_size, unsigned long output_size)
+  : input_size_m(input_size), output_size_m(output_size),
+    Wx_m({(long)output_size * 3, (long)input_size}),
+    Wh_m({(long)output_size * 3, (long)output_size}),
+    b_m({(long)output_size * 3}) {
+
+}
+
+fused_coupled_lstm_cell::fused_coupled_lstm_cell(const coupled_lstm_cell& cell)
+  : fused_coupled_lstm_cell(cell.input_size_m, cell.output_size_m) {
+  // dynet::vanilla_lstm_gates adds 1 to the forget gate bias
+  stack_gate_weights({&cell.forget_gate, &cell.output_gate, &cell.input_layer}, {-1, 0, 0},
+                     output_size_m, input_size_m, Wx_m, Wh_m, b_m);
+}
+
+std::array<dynet::Expression, 3> fused_coupled_lstm_cell::expanded_weights() const {
+  // input gate = 1 - logistic(Wx_f * x + Wh_f * h + b_f + 1) = logistic(-Wx_f * x - Wh_f * h - b_f - 1)
+  auto H = (unsigned)output_size_m;
+  auto Wx = Wx_m.as_symbolic_tensor();
+  auto Wh = Wh_m.as_symbolic_tensor();
+  auto b = b_m.as_symbolic_tensor();
+  return {
+    dynet::concatenate({-dynet::pick_range(Wx, 0, H), Wx}),
+    dynet::concatenate({-dynet::pick_range(Wh, 0, H), Wh}),
+    dynet::concatenate({-1.0f - dynet::pick_range(b, 0, H), b})
+  };
+}
+
+pair<value_t, value_t> fused_coupled_lstm_cell::transduce_impl(const value_t& prev_state, const value_t& x) {
+  auto&&[cell_state, hidden_state] = prev_state.as_tuple<2>();
+
+  auto[Wx, Wh, b] = expanded_weights();
+  auto gates = dynet::vanilla_lstm_gates(x.as_symbolic_tensor(), hidden_state.as_symbolic_tensor(), Wx, Wh, b);
+  auto next_cell_state = dynet::vanilla_lstm_c(cell_state.as_symbolic_tensor(), gates);
+  auto next_hidden_state = value_t(dynet::vanilla_lstm_h(next_cell_state, gates));
+
+  return make_pair(
+    next_hidden_state,
+    value_t({value_t(next_cell_state), next_hidden_state})
+  );
+}
+
+vector<value_t> fused_coupled_lstm_cell::project_inputs(const vector<value_t>& xs) {
+  auto[Wx, Wh, b] = expanded_weights();
+  auto ret = project_lstm_inputs(xs, Wx, b, output_size_m);
+  // every timestep carries the expanded hidden-to-hidden weights along, so that they are expanded once per sequence
+  value_t expanded_Wh(Wh);
+  for(auto&& projected_x:ret) {
+    projected_x = value_t({projected_x, expanded_Wh});
+  }
+  return ret;
+}
+
+pair<value_t, value_t> fused_coupled_lstm_cell::transduce_projected_impl(const value_t& prev_state, const value_t& projected_x) {
+  auto&&[cell_state, hidden_state] = prev_state.as_tuple<2>();
+  auto&&[projected, Wh] = projected_x.as_tuple<2>();
+
+  auto gates = dynet::affine_transform_activation(
+    {projected.as_symbolic_tensor(), Wh.as_symbolic_tensor(), hidden_state.as_symbolic_tensor()},
+    dynet::AffineActivation::lstm_gates);
+  auto next_cell_state = dynet::vanilla_lstm_c(cell_state.as_symbolic_tensor(), gates);
+  auto next_hidden_state = value_t(dynet::vanilla_lstm_h(next_cell_state, gates));
+
+  return make_pair(
+    next_hidden_state,
+    value_t({value_t(next_cell_state), next_hidden_state})
+  );
+}
+
+value_t fused_coupled_lstm_cell::default_initial_state() const {
+  auto zeros = value_t(dynet::zeros(*dynet_computation_graph::p(), {(unsigned)output_size_m}));
+  return value_t({zeros, zeros});
+}
+
+string fused_coupled_lstm_cell::default_name() const {
+  return "fused_coupled_lstm_cell";
+}
+
+fused_gru_cell::fused_gru_cell(unsigned long input_size, unsigned long output_size)
+  : input_size_m(input_size), output_size_m(output_size),
+    gates_Wx_m({(long)output_size * 2, (long)input_size}),
+    gates_Wh_m({(long)output_size * 2, (long)output_size}),
+    candidate_Wx_m({(long)output_size, (long)input_size}),
+    candidate_Wh_m({(long)output_size, (long)output_size}),
+    gates_b_m({(long)output_size * 2}),
+    candidate_b_m({(long)output_size}) {
+
+}
+
+fused_gru_cell::fused_gru_cell(const gru_cell& cell)
+  : fused_gru_cell(cell.input_size_m, cell.output_size_m) {
+  stack_gate_weights({&cell.pre_input_gate_m, &cell.output_gate_m}, {0, 0},
+                     output_size_m, input_size_m, gates_Wx_m, gates_Wh_m, gates_b_m);
+  stack_gate_weights({&cell.input_fc_m}, {0},
+                     output_size_m, input_size_m, candidate_Wx_m, candidate_Wh_m, candidate_b_m);
+}
+
+pair<value_t, value_t> fused_gru_cell::transduce_impl(const value_t& prev_state, const value_t& x) {
+  auto H = (unsigned)output_size_m;
+  auto&& h = prev_state.as_symbolic_tensor();
+  auto&& x_ = x.as_symbolic_tensor();
+  auto gates = dynet::affine_transform_activation(
+    {gates_b_m.as_symbolic_tensor(), gates_Wx_m.as_symbolic_tensor(), x_, gates_Wh_m.as_symbolic_tensor(), h},
+    dynet::AffineActivation::logistic);
+  auto pre_input_gate_coef = dynet::pick_range(gates, 0, H);
+  auto output_gate_coef = dynet::pick_range(gates, H, H * 2);
+  auto output_candidate = dynet::affine_transform_activation(
+    {candidate_b_m.as_symbolic_tensor(), candidate_Wx_m.as_symbolic_tensor(), x_, candidate_Wh_m.as_symbolic_tensor(), dynet::cmult(h, pre_input_gate_coef)},
+    dynet::AffineActivation::tanh);
+  auto output_hidden = value_t(h + dynet::cmult(output_gate_coef, output_candidate - h));
+  return std::make_pair(output_hidden, output_hidden);
+}
+
+vector<value_t> fused_gru_cell::project_inputs(const vector<value_t>& xs) {
+  auto projected_gates = project_all_timesteps(xs, gates_Wx_m.as_symbolic_tensor(), gates_b_m.as_symbolic_tensor());
+  auto projected_candidates = project_all_timesteps(xs, candidate_Wx_m.as_symbolic_tensor(), candidate_b_m.as_symbolic_tensor());
+  vector<value_t> ret;
+  ret.reserve(xs.size());
+  for(unsigned long t = 0; t < xs.size(); ++t) {
+    ret.push_back(value_t({projected_gates[t], projected_candidates[t]}));
+  }
+  return ret;
+}
+
+pair<value_t, value_t> fused_gru_cell::transduce_projected_impl(const value_t& prev_state, const value_t& projected_x) {
+  auto H = (unsigned)output_size_m;
+  auto&&[projected_gates, projected_candidate] = projected_x.as_tuple<2>();
+  auto&& h = prev_state.as_symbolic_tensor();
+  auto gates = dynet::affine_transform_activation(
+    {projected_gates.as_symbolic_tensor(), gates_Wh_m.as_symbolic_tensor(), h},
+    dynet::AffineActivation::logistic);
+  auto pre_input_gate_coef = dynet::pick_range(gates, 0, H);
+  auto output_gate_coef = dynet::pick_range(gates, H, H * 2);
+  auto output_candidate = dynet::affine_transform_activation(
+    {projected_candidate.as_symbolic_tensor(), candidate_Wh_m.as_symbolic_tensor(), dynet::cmult(h, pre_input_gate_coef)},
+    dynet::AffineActivation::tanh);
+  auto output_hidden = value_t(h + dynet::cmult(output_gate_coef, output_candidate - h));
+  return std::make_pair(output_hidden, output_hidden);
+}
+
+value_t fused_gru_cell::default_initial_state() const {
+  return value_t(dynet::zeros(*dynet_computation_graph::p(), {(unsigned)output_size_m}));
+}
+
+string fused_gru_cell::default_name() const {
+  return "fused_gru_cell";
+}
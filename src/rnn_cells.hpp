@@ -8,6 +8,7 @@
 #define LEGO_RNN_CELLS_HPP
 #include "backprop_trainable_parameter.hpp"
 #include "dense_model.hpp"
+#include <array>
 namespace tg {
   class rnn_cell_base {
   public:
@@ -49,6 +50,38 @@ namespace tg {
      */
     virtual value_t default_initial_state() const = 0;
 
+    /**
+     * \brief Convert this cell into its fused-gate counterpart
+     *
+     * The fused-gate cell computes the same function from the same weights,
+     * with all the gates stacked into one matrix multiplication.
+     *
+     * \return The fused-gate cell, or nullptr if this cell has no fused-gate counterpart
+     */
+    virtual std::shared_ptr<rnn_cell_base> to_fused_gates() const;
+
+    /**
+     * \brief Compute the input-to-hidden part of this cell for all timesteps up front
+     *
+     * The input-to-hidden part does not depend on the previous state,
+     * so it can be computed for the whole sequence as one matrix-matrix multiplication instead of one matrix-vector multiplication per timestep.
+     *
+     * \param xs the inputs of all timesteps
+     * \return the projected input of each timestep, to be passed to transduce_projected_impl().
+     *         Empty if this cell does not separate the input-to-hidden part.
+     */
+    virtual std::vector<value_t> project_inputs(const std::vector<value_t>& xs);
+
+    /**
+     * Apply this RNN cell for one timestep, on an input computed by project_inputs()
+     * \param prev_state state from previous timestep.
+     *                   IMPORTANT! Passing NULL will give an error.
+     * \param projected_x the current projected input
+     * \return (1) the current output
+     *         (2) state for next timestep
+     */
+    virtual std::pair<value_t, value_t> transduce_projected_impl(const value_t& prev_state, const value_t& projected_x);
+
   };
 
   class naive_rnn_cell :public rnn_cell_base {
@@ -93,7 +126,11 @@ namespace tg {
 
     value_t default_initial_state() const override;
 
+    std::shared_ptr<rnn_cell_base> to_fused_gates() const override;
+
     std::string default_name() const;
+
+    friend class fused_vanilla_lstm_cell;
   };
 
   class coupled_lstm_cell :public rnn_cell_base {
@@ -116,7 +153,11 @@ namespace tg {
 
     value_t default_initial_state() const override;
 
+    std::shared_ptr<rnn_cell_base> to_fused_gates() const override;
+
     std::string default_name() const;
+
+    friend class fused_coupled_lstm_cell;
   };
 
   class gru_cell :public rnn_cell_base {
@@ -139,6 +180,149 @@ namespace tg {
 
     value_t default_initial_state() const override;
 
+    std::shared_ptr<rnn_cell_base> to_fused_gates() const override;
+
+    std::string default_name() const;
+
+    friend class fused_gru_cell;
+  };
+
+  /**
+   * \brief A vanilla LSTM cell with all four gates stacked into one matrix multiplication
+   *
+   * Computes the same function as vanilla_lstm_cell, using the fused dynet::vanilla_lstm_gates, dynet::vanilla_lstm_c and dynet::vanilla_lstm_h nodes.
+   * The gates are stacked in the order of input gate, forget gate, output gate and input candidate.
+   * Like dynet::vanilla_lstm_gates, the forget gate has a constant 1 added to its bias.
+   */
+  class fused_vanilla_lstm_cell :public rnn_cell_base {
+    unsigned long input_size_m{};
+    unsigned long output_size_m{};
+    backprop_trainable_parameter Wx_m, Wh_m;
+    backprop_trainable_bias_parameter b_m;
+  public:
+    template<typename Archive>
+    void serialize(Archive& ar) {
+      ar(cereal::base_class<rnn_cell_base>(this), input_size_m, output_size_m, Wx_m, Wh_m, b_m);
+    }
+    fused_vanilla_lstm_cell() = default;
+    fused_vanilla_lstm_cell(const fused_vanilla_lstm_cell&) = default;
+    fused_vanilla_lstm_cell(fused_vanilla_lstm_cell&&) noexcept = default;
+    fused_vanilla_lstm_cell& operator=(const fused_vanilla_lstm_cell&) = default;
+    fused_vanilla_lstm_cell& operator=(fused_vanilla_lstm_cell&&) noexcept = default;
+    fused_vanilla_lstm_cell(unsigned long input_size, unsigned long output_size);
+
+    /**
+     * \brief Convert from a vanilla LSTM cell, copying its weights
+     * \param cell The cell to convert from
+     */
+    explicit fused_vanilla_lstm_cell(const vanilla_lstm_cell& cell);
+
+    std::pair<value_t, value_t> transduce_impl(const value_t& prev_state, const value_t& x) override;
+
+    std::vector<value_t> project_inputs(const std::vector<value_t>& xs) override;
+
+    std::pair<value_t, value_t> transduce_projected_impl(const value_t& prev_state, const value_t& projected_x) override;
+
+    value_t default_initial_state() const override;
+
+    std::string default_name() const;
+  };
+
+  /**
+   * \brief A coupled LSTM cell with all its gates stacked into one matrix multiplication
+   *
+   * Computes the same function as coupled_lstm_cell. The weights are stacked in the order of forget gate, output gate and input candidate.
+   *
+   * The input gate of a coupled LSTM is 1 - forget gate = logistic(-(forget gate pre-activation)),
+   * so the cell runs on the fused vanilla LSTM nodes, with the input gate weights tied to the negated forget gate weights.
+   */
+  class fused_coupled_lstm_cell :public rnn_cell_base {
+    unsigned long input_size_m{};
+    unsigned long output_size_m{};
+    backprop_trainable_parameter Wx_m, Wh_m;
+    backprop_trainable_bias_parameter b_m;
+  public:
+    template<typename Archive>
+    void serialize(Archive& ar) {
+      ar(cereal::base_class<rnn_cell_base>(this), input_size_m, output_size_m, Wx_m, Wh_m, b_m);
+    }
+    fused_coupled_lstm_cell() = default;
+    fused_coupled_lstm_cell(const fused_coupled_lstm_cell&) = default;
+    fused_coupled_lstm_cell(fused_coupled_lstm_cell&&) noexcept = default;
+    fused_coupled_lstm_cell& operator=(const fused_coupled_lstm_cell&) = default;
+    fused_coupled_lstm_cell& operator=(fused_coupled_lstm_cell&&) noexcept = default;
+    fused_coupled_lstm_cell(unsigned long input_size, unsigned long output_size);
+
+    /**
+     * \brief Convert from a coupled LSTM cell, copying its weights
+     * \param cell The cell to convert from
+     */
+    explicit fused_coupled_lstm_cell(const coupled_lstm_cell& cell);
+
+    /**
+     * \brief Apply this cell for one timestep, expanding the weights for this timestep only
+     *
+     * generic_rnn_model goes through project_inputs() instead, which expands the weights once per sequence.
+     */
+    std::pair<value_t, value_t> transduce_impl(const value_t& prev_state, const value_t& x) override;
+
+    /**
+     * \brief Project the inputs of all timesteps, see rnn_cell_base::project_inputs()
+     * \return For each timestep, the tuple of the projected input and the expanded hidden-to-hidden weights (shared by all timesteps)
+     */
+    std::vector<value_t> project_inputs(const std::vector<value_t>& xs) override;
+
+    std::pair<value_t, value_t> transduce_projected_impl(const value_t& prev_state, const value_t& projected_x) override;
+
+    value_t default_initial_state() const override;
+
+    std::string default_name() const;
+
+  private:
+    /**
+     * \brief Get the input-to-hidden weights, hidden-to-hidden weights and bias of all four vanilla LSTM gates
+     * \return The expanded weights, in the current computation graph
+     */
+    std::array<dynet::Expression, 3> expanded_weights() const;
+  };
+
+  /**
+   * \brief A GRU cell with its reset gate and update gate stacked into one matrix multiplication
+   *
+   * Computes the same function as gru_cell. The input candidate depends on the reset gate, so it takes a second matrix multiplication.
+   * Each matrix multiplication is fused with its activation, without concatenating the hidden state and the input.
+   */
+  class fused_gru_cell :public rnn_cell_base {
+    unsigned long input_size_m{};
+    unsigned long output_size_m{};
+    backprop_trainable_parameter gates_Wx_m, gates_Wh_m, candidate_Wx_m, candidate_Wh_m;
+    backprop_trainable_bias_parameter gates_b_m, candidate_b_m;
+  public:
+    template<typename Archive>
+    void serialize(Archive& ar) {
+      ar(cereal::base_class<rnn_cell_base>(this), input_size_m, output_size_m, gates_Wx_m, gates_Wh_m, gates_b_m, candidate_Wx_m, candidate_Wh_m, candidate_b_m);
+    }
+    fused_gru_cell() = default;
+    fused_gru_cell(const fused_gru_cell&) = default;
+    fused_gru_cell(fused_gru_cell&&) noexcept = default;
+    fused_gru_cell& operator=(const fused_gru_cell&) = default;
+    fused_gru_cell& operator=(fused_gru_cell&&) noexcept = default;
+    fused_gru_cell(unsigned long input_size, unsigned long output_size);
+
+    /**
+     * \brief Convert from a GRU cell, copying its weights
+     * \param cell The cell to convert from
+     */
+    explicit fused_gru_cell(const gru_cell& cell);
+
+    std::pair<value_t, value_t> transduce_impl(const value_t& prev_state, const value_t& x) override;
+
+    std::vector<value_t> project_inputs(const std::vector<value_t>& xs) override;
+
+    std::pair<value_t, value_t> transduce_projected_impl(const value_t& prev_state, const value_t& projected_x) override;
+
+    value_t default_initial_state() const override;
+
     std::string default_name() const;
   };
 }
@@ -147,5 +331,8 @@ CEREAL_REGISTER_TYPE(tg::naive_rnn_cell)
 CEREAL_REGISTER_TYPE(tg::vanilla_lstm_cell)
 CEREAL_REGISTER_TYPE(tg::coupled_lstm_cell)
 CEREAL_REGISTER_TYPE(tg::gru_cell)
+CEREAL_REGISTER_TYPE(tg::fused_vanilla_lstm_cell)
+CEREAL_REGISTER_TYPE(tg::fused_coupled_lstm_cell)
+CEREAL_REGISTER_TYPE(tg::fused_gru_cell)
 
 #endif //LEGO_RNN_CELLS_HPP
@@ -8,6 +8,11 @@
 using namespace std;
 
 tg::value_t tg::dict_model::transduce(const tg::value_t& in0) {
+  if (in0.is_interned_symbol() && has_interned_index_m) {
+    auto ret = interned_index_m.find(in0.symbol_id());
+    if (ret == interned_index_m.end()) return value_t(vocab_m.size());
+    return value_t(ret->second);
+  }
   if (in0.is_symbol()) {
     // convert symbol to ID if input is of symbol type
     auto ret = reverse_index_m.find(in0.as_symbol());
@@ -16,8 +21,8 @@ tg::value_t tg::dict_model::transduce(const tg::value_t& in0) {
   } else {
     // convert ID to symbol if input is of type scalar
     unsigned long index = in0.as_integer();
-    if (index >= vocab_m.size()) return value_t(unk_token_m);
-    return value_t(vocab_m[index]);
+    if (index >= vocab_values_m.size()) return unk_value_m;
+    return vocab_values_m[index];
   }
 }
 
@@ -34,4 +39,17 @@ tg::dict_model::dict_model(std::vector<std::string> _vocab, std::string unk_toke
         token);
     reverse_index_m[token] = i;
   }
+  build_interned_index();
+}
+
+void tg::dict_model::build_interned_index() {
+  vocab_values_m.clear();
+  interned_index_m.clear();
+  has_interned_index_m = is_symbol_interning_enabled();
+  unk_value_m = value_t(unk_token_m);
+  for (unsigned long i = 0; i < vocab_m.size(); ++i) {
+    value_t value(vocab_m[i]);
+    if (has_interned_index_m) interned_index_m[value.symbol_id()] = i;
+    vocab_values_m.push_back(move(value));
+  }
 }
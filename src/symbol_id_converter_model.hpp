@@ -14,10 +14,27 @@ namespace tg {
     std::string unk_token_m;
     std::vector<std::string> vocab_m;
     std::unordered_map<std::string, unsigned long> reverse_index_m;
+
+    // The vocabulary and the unknown token as symbol values, interned if symbol interning was enabled when built
+    std::vector<value_t> vocab_values_m;
+    value_t unk_value_m;
+
+    // Maps the ID of an interned symbol to its index in the vocabulary.
+    // Only built if symbol interning was enabled, otherwise interned symbols are looked up by their strings.
+    std::unordered_map<unsigned long, unsigned long> interned_index_m;
+    bool has_interned_index_m{false};
+
+    void build_interned_index();
   public:
     template<typename Archive>
-    void serialize(Archive& ar) {
+    void save(Archive& ar) const {
+      ar(unk_token_m, vocab_m, reverse_index_m);
+    }
+
+    template<typename Archive>
+    void load(Archive& ar) {
       ar(unk_token_m, vocab_m, reverse_index_m);
+      build_interned_index();
     }
     dict_model() = default;
     dict_model(const dict_model&) = default;
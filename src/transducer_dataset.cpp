@@ -3,7 +3,18 @@
 //
 
 #include "include/transducer_dataset.hpp"
+#include "value_binary_codec.hpp"
+#include "chunked_archive.hpp"
 #include <fstream>
+#include <algorithm>
+#include <numeric>
+#include <cstring>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 using namespace tg;
 using namespace std;
@@ -21,13 +32,13 @@ void tg::transducer_dataset_vec_impl::apply_emplace_back(std::vector<value_t> da
   datums.push_back(move(datum));
 }
 
-const std::vector<value_t>& transducer_dataset_vec_impl::at(unsigned long i) const& {
+transducer_dataset::datum_ref transducer_dataset_vec_impl::at(unsigned long i) const {
   if(i >= size()) {
     stringstream ss;
     ss << "Cannot access datum #" << i << " from dataset of size "<<size() << endl;
     throw_with_nested(std::runtime_error(ss.str()));
   }
-  return datums.at(i);
+  return datum_ref(datums[i]);
 }
 
 
@@ -39,13 +50,80 @@ unsigned long transducer_dataset_vec_impl::arity() const {
   return arity_m;
 }
 
+namespace __private_transducer_dataset {
+  /**
+   * \brief How many datums to put into a chunk when saving a dataset
+   *
+   * Aims at a few chunks per serialization thread so that the work is balanced, but not too small chunks.
+   */
+  unsigned long datums_per_chunk(unsigned long num_datums) {
+    constexpr unsigned long MIN_DATUMS_PER_CHUNK = 1024;
+    auto num_chunks = get_num_serialization_threads() * 4;
+    return std::max((num_datums + num_chunks - 1) / num_chunks, MIN_DATUMS_PER_CHUNK);
+  }
+}
+
 void transducer_dataset_vec_impl::save_to_stream(ostream& os) const {
-  cereal::BinaryOutputArchive ar(os);
-  ar << *this;
+  using namespace __private_transducer_dataset;
+  // chunk #0 holds (arity, number of datums, datums per chunk), and the rest holds the datums
+  uint64_t len = datums.size();
+  uint64_t chunk_size = datums_per_chunk(len);
+  vector<function<void(string&)>> encoders;
+  encoders.emplace_back([&](string& out) {
+    uint64_t header[3] = {arity_m, len, chunk_size};
+    out.append(reinterpret_cast<const char*>(header), sizeof(header));
+  });
+  for(uint64_t begin=0; begin<len; begin+=chunk_size) {
+    encoders.emplace_back([&, begin](string& out) {
+      auto end = std::min(begin + chunk_size, len);
+      for(auto i=begin; i<end; ++i) {
+        for(auto&& value:datums[i]) {
+          encode_value_binary(value, out);
+        }
+      }
+    });
+  }
+  chunked_archive::write(os, encoders);
+}
+
+void transducer_dataset_vec_impl::load_chunked(std::istream& is) {
+  auto chunks = chunked_archive::read(is);
+  uint64_t header[3];
+  if(chunks.empty() || chunks[0].size() != sizeof(header)) {
+    throw_with_nested(std::runtime_error("Corrupted dataset: bad header"));
+  }
+  memcpy(header, chunks[0].data(), sizeof(header));
+  auto [arity, len, chunk_size] = header;
+  if(chunk_size == 0 || chunks.size() - 1 != len / chunk_size + (len % chunk_size != 0)) {
+    throw_with_nested(std::runtime_error("Corrupted dataset: wrong number of chunks"));
+  }
+  // every value takes at least its type tag
+  for(unsigned long chunk_id = 0; chunk_id + 1 < chunks.size(); ++chunk_id) {
+    auto num_datums = std::min(chunk_size, len - chunk_id * chunk_size);
+    if(arity > 0 && num_datums > chunks[chunk_id + 1].size() / arity) {
+      throw_with_nested(std::runtime_error("Corrupted dataset: chunk #" + to_string(chunk_id) + " is too short"));
+    }
+  }
+  arity_m = arity;
+  datums.assign(len, vector<value_t>());
+  chunked_archive::parallel_run(chunks.size() - 1, [&](unsigned long chunk_id) {
+    auto& chunk = chunks[chunk_id + 1];
+    const char* cursor = chunk.data();
+    const char* limit = chunk.data() + chunk.size();
+    auto begin = chunk_id * chunk_size;
+    auto end = std::min(begin + chunk_size, len);
+    for(auto i=begin; i<end; ++i) {
+      auto& datum = datums[i];
+      datum.reserve(arity);
+      for(unsigned long j=0; j<arity; ++j) {
+        datum.push_back(decode_value_binary(cursor, limit));
+      }
+    }
+  });
 }
 
 void transducer_dataset_vec_impl::save_to_file(const string& path) const {
-  ofstream ofs(path);
+  ofstream ofs(path, std::ios::binary);
   if(!ofs.is_open()) {
     throw std::runtime_error("Cannot write to file :" + path);
   }
@@ -65,7 +143,7 @@ unsigned long transducer_dataset_ref_impl::size() const {
   return indices_m.size();
 }
 
-const vector<value_t>& transducer_dataset_ref_impl::at(unsigned long i) const& {
+transducer_dataset::datum_ref transducer_dataset_ref_impl::at(unsigned long i) const {
   if(i >= size()) {
     stringstream ss;
     ss << "Cannot access datum #" << i << " from dataset of size "<<size() << endl;
@@ -74,6 +152,15 @@ const vector<value_t>& transducer_dataset_ref_impl::at(unsigned long i) const& {
   return parent_m->at(indices_m[i]);
 }
 
+unsigned long transducer_dataset_ref_impl::datum_size(unsigned long i, const datum_size_fn_t& size_fn) const {
+  if(i >= size()) {
+    stringstream ss;
+    ss << "Cannot access datum #" << i << " from dataset of size "<<size() << endl;
+    throw_with_nested(std::runtime_error(ss.str()));
+  }
+  return parent_m->datum_size(indices_m[i], size_fn);
+}
+
 
 transducer_dataset_ref_impl::transducer_dataset_ref_impl(shared_ptr<const transducer_dataset> parent,
                                                          vector<unsigned long> indices) : parent_m(move(parent)),
@@ -105,6 +192,75 @@ std::vector<std::shared_ptr<transducer_dataset>> transducer_dataset::group_to_ba
   return ret;
 }
 
+std::shared_ptr<transducer_dataset> transducer_dataset::select(std::vector<unsigned long> indices) const {
+  return make_shared<transducer_dataset_ref_impl>(shared_from_this(), move(indices));
+}
+
+namespace __private_transducer_dataset {
+  /**
+   * \brief Compute the size of every datum, and optionally sort the datum indices by size (stable)
+   * \return (sizes, order) in which order lists the datum indices
+   */
+  pair<vector<unsigned long>, vector<unsigned long>> measure_datums(const transducer_dataset& dataset, const datum_size_fn_t& size_fn, bool sort_by_size) {
+    auto len = dataset.size();
+    vector<unsigned long> sizes(len);
+    for(unsigned long i=0; i<len; ++i) {
+      sizes[i] = dataset.datum_size(i, size_fn);
+    }
+    vector<unsigned long> order(len);
+    std::iota(order.begin(), order.end(), 0);
+    if(sort_by_size) {
+      std::stable_sort(order.begin(), order.end(), [&](unsigned long a, unsigned long b) {
+        return sizes[a] < sizes[b];
+      });
+    }
+    return make_pair(move(sizes), move(order));
+  }
+}
+
+std::vector<std::vector<unsigned long>>
+transducer_dataset::group_indices_to_bucketed_batch(unsigned long batch_size, const datum_size_fn_t& size_fn) const {
+  using namespace __private_transducer_dataset;
+  auto len = size();
+  auto order = measure_datums(*this, size_fn, true).second;
+
+  std::vector<std::vector<unsigned long>> ret;
+  for(unsigned long i=0; i<len; i+=batch_size) {
+    ret.emplace_back(order.begin() + i, order.begin() + std::min(i + batch_size, len));
+  }
+  return ret;
+}
+
+std::vector<std::vector<unsigned long>>
+transducer_dataset::group_indices_to_budgeted_batch(unsigned long cost_budget, const datum_size_fn_t& size_fn, bool sort_by_size) const {
+  using namespace __private_transducer_dataset;
+  auto [sizes, order] = measure_datums(*this, size_fn, sort_by_size);
+
+  std::vector<std::vector<unsigned long>> ret;
+  unsigned long batch_cost = 0;
+  for(auto&& i:order) {
+    if(ret.empty() || (!ret.back().empty() && batch_cost + sizes[i] > cost_budget)) {
+      ret.emplace_back();
+      batch_cost = 0;
+    }
+    ret.back().push_back(i);
+    batch_cost += sizes[i];
+  }
+  return ret;
+}
+
+unsigned long tg::default_datum_size(const std::vector<value_t>& datum) {
+  unsigned long ret = 0;
+  for(auto&& value:datum) {
+    ret += value.is_list() ? value.as_list().size() : 1;
+  }
+  return ret;
+}
+
+unsigned long transducer_dataset::datum_size(unsigned long i, const datum_size_fn_t& size_fn) const {
+  return size_fn(at(i));
+}
+
 bool transducer_dataset::empty() const {
   return size() == 0;
 }
@@ -118,16 +274,392 @@ void transducer_dataset::save_to_file(const std::string& path) const {
 }
 
 std::shared_ptr<transducer_dataset> transducer_dataset::load_from_stream(istream& is) {
-  cereal::BinaryInputArchive ar(is);
   auto ret = std::make_shared<transducer_dataset_vec_impl>();
-  ar >> *ret;
+  string consumed;
+  if(!chunked_archive::is_chunked(is, consumed)) {
+    chunked_archive::read_legacy(move(consumed), is, [&](cereal::BinaryInputArchive& ar) {
+      ar >> *ret;
+    });
+    return ret;
+  }
+  chunked_archive::prefixed_streambuf buffer(move(consumed), is.rdbuf());
+  istream rest(&buffer);
+  ret->load_chunked(rest);
   return ret;
 }
 
 std::shared_ptr<transducer_dataset> transducer_dataset::load_from_file(const std::string& path) {
+  if(transducer_dataset_mmap_impl::is_mmap_file(path)) {
+    return make_shared<transducer_dataset_mmap_impl>(path);
+  }
   std::ifstream ifs(path, std::ios::binary);
   if(!ifs.is_open()) {
     throw std::runtime_error("Cannot read from file: " + path);
   }
   return load_from_stream(ifs);
 }
+
+namespace __private_transducer_dataset {
+  constexpr unsigned long MMAP_HEADER_SIZE = 32;
+
+  unsigned long read_u64(const char* p) {
+    uint64_t ret;
+    memcpy(&ret, p, sizeof(uint64_t));
+    return ret;
+  }
+
+  void write_u64(ostream& os, uint64_t x) {
+    os.write(reinterpret_cast<const char*>(&x), sizeof(uint64_t));
+  }
+
+  /**
+   * \brief Whether a size function is default_datum_size(), whose results some datasets store
+   */
+  bool is_default_datum_size(const datum_size_fn_t& size_fn) {
+    auto fn = size_fn.target<unsigned long(*)(const std::vector<value_t>&)>();
+    return fn && *fn == &default_datum_size;
+  }
+
+  /**
+   * \brief Map a whole file into memory, read-only
+   * \return (data, size)
+   */
+  pair<shared_ptr<const char>, unsigned long> map_file(const string& path) {
+#ifndef _WIN32
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0) {
+      throw std::runtime_error("Cannot read from file: " + path);
+    }
+    struct stat st{};
+    if(::fstat(fd, &st) != 0) {
+      ::close(fd);
+      throw std::runtime_error("Cannot read from file: " + path);
+    }
+    auto len = (unsigned long)st.st_size;
+    void* addr = len == 0 ? nullptr : ::mmap(nullptr, len, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if(addr == MAP_FAILED) {
+      throw std::runtime_error("Cannot memory-map file: " + path);
+    }
+    if(addr) {
+      // training shuffles the datums, so readahead mostly fetches pages that are not needed soon
+      ::madvise(addr, len, MADV_RANDOM);
+    }
+    shared_ptr<const char> data((const char*)addr, [len](const char* p) {
+      if(p) ::munmap((void*)p, len);
+    });
+    return make_pair(move(data), len);
+#else
+    std::ifstream ifs(path, std::ios::binary);
+    if(!ifs.is_open()) {
+      throw std::runtime_error("Cannot read from file: " + path);
+    }
+    auto buffer = make_shared<string>(istreambuf_iterator<char>(ifs), istreambuf_iterator<char>());
+    auto len = buffer->size();
+    return make_pair(shared_ptr<const char>(buffer, buffer->data()), len);
+#endif
+  }
+}
+
+transducer_dataset::datum_ref transducer_dataset_lazy_impl::at(unsigned long i) const {
+  if(i >= size()) {
+    stringstream ss;
+    ss << "Cannot access datum #" << i << " from dataset of size "<<size() << endl;
+    throw_with_nested(std::runtime_error(ss.str()));
+  }
+  return datum_ref(materialize(i));
+}
+
+transducer_dataset_mmap_impl::transducer_dataset_mmap_impl(const std::string& path) {
+  using namespace __private_transducer_dataset;
+  tie(data_m, data_size_m) = map_file(path);
+  auto data = data_m.get();
+  if(data_size_m < MMAP_HEADER_SIZE || memcmp(data, magic, 8) != 0) {
+    throw std::runtime_error("Not a memory-mapped dataset file: " + path);
+  }
+  arity_m = read_u64(data + 8);
+  size_m = read_u64(data + 16);
+  auto index_offset = read_u64(data + 24);
+  // the index holds size + 1 offsets, followed by size datum sizes
+  // (checked as 2 * size + 1 words, without letting either side overflow)
+  if(index_offset < MMAP_HEADER_SIZE || index_offset > data_size_m || data_size_m - index_offset < sizeof(uint64_t)
+     || size_m > ((data_size_m - index_offset) / sizeof(uint64_t) - 1) / 2) {
+    throw std::runtime_error("Corrupted memory-mapped dataset file: " + path);
+  }
+  index_m = data + index_offset;
+  sizes_m = index_m + (size_m + 1) * sizeof(uint64_t);
+}
+
+unsigned long transducer_dataset_mmap_impl::arity() const {
+  return arity_m;
+}
+
+unsigned long transducer_dataset_mmap_impl::size() const {
+  return size_m;
+}
+
+vector<value_t> transducer_dataset_mmap_impl::materialize(unsigned long i) const {
+  using namespace __private_transducer_dataset;
+  auto begin = read_u64(index_m + i * sizeof(uint64_t));
+  auto end = read_u64(index_m + (i + 1) * sizeof(uint64_t));
+  // every value takes at least its type tag
+  if(begin > end || end > data_size_m || arity_m > end - begin) {
+    throw_with_nested(std::runtime_error("Corrupted memory-mapped dataset: bad offset of datum #" + to_string(i)));
+  }
+  const char* cursor = data_m.get() + begin;
+  const char* limit = data_m.get() + end;
+  vector<value_t> datum;
+  datum.reserve(arity_m);
+  for(unsigned long j=0; j<arity_m; ++j) {
+    datum.push_back(decode_value_binary(cursor, limit, data_m));
+  }
+  return datum;
+}
+
+unsigned long transducer_dataset_mmap_impl::datum_size(unsigned long i, const datum_size_fn_t& size_fn) const {
+  using namespace __private_transducer_dataset;
+  if(i >= size_m || !is_default_datum_size(size_fn)) return transducer_dataset::datum_size(i, size_fn);
+  return read_u64(sizes_m + i * sizeof(uint64_t));
+}
+
+void transducer_dataset_mmap_impl::save_to_file(const std::string& path) const {
+  write_to_file(*this, path);
+}
+
+void transducer_dataset_mmap_impl::write_to_file(const transducer_dataset& dataset, const std::string& path) {
+  using namespace __private_transducer_dataset;
+  ofstream ofs(path, std::ios::binary);
+  if(!ofs.is_open()) {
+    throw std::runtime_error("Cannot write to file :" + path);
+  }
+  auto len = dataset.size();
+  ofs.write(magic, 8);
+  write_u64(ofs, dataset.arity());
+  write_u64(ofs, len);
+  write_u64(ofs, 0); // index offset, patched below
+
+  vector<uint64_t> offsets;
+  offsets.reserve(len + 1);
+  vector<uint64_t> sizes;
+  sizes.reserve(len);
+  uint64_t offset = MMAP_HEADER_SIZE;
+  string buffer;
+  for(unsigned long i=0; i<len; ++i) {
+    buffer.clear();
+    auto datum = dataset.at(i);
+    for(auto&& value:datum) {
+      encode_value_binary(value, buffer, offset);
+    }
+    sizes.push_back(default_datum_size(datum));
+    offsets.push_back(offset);
+    ofs.write(buffer.data(), buffer.size());
+    offset += buffer.size();
+  }
+  offsets.push_back(offset);
+
+  // keep the index 8-byte aligned
+  auto padding = (8 - offset % 8) % 8;
+  ofs.write("\0\0\0\0\0\0\0", padding);
+  auto index_offset = offset + padding;
+  ofs.write(reinterpret_cast<const char*>(offsets.data()), offsets.size() * sizeof(uint64_t));
+  ofs.write(reinterpret_cast<const char*>(sizes.data()), sizes.size() * sizeof(uint64_t));
+  ofs.seekp(24);
+  write_u64(ofs, index_offset);
+  if(!ofs) {
+    throw std::runtime_error("Failed to write to file: " + path);
+  }
+}
+
+void transducer_dataset_mmap_impl::convert_from_cereal_file(const std::string& cereal_path, const std::string& mmap_path) {
+  // cereal keeps every deserialized shared pointer alive until the archive is destroyed,
+  // so decoding datum by datum would not lower the peak memory anyway
+  write_to_file(*transducer_dataset::load_from_file(cereal_path), mmap_path);
+}
+
+bool transducer_dataset_mmap_impl::is_mmap_file(const std::string& path) {
+  std::ifstream ifs(path, std::ios::binary);
+  char buffer[8];
+  if(!ifs.read(buffer, 8)) return false;
+  return memcmp(buffer, magic, 8) == 0;
+}
+
+namespace __private_transducer_dataset {
+  enum packed_tag : unsigned char {
+    PACKED_NULL = 0,
+    PACKED_INTEGER,
+    PACKED_FLOAT,
+    PACKED_TENSOR,
+    PACKED_SYMBOL,
+    PACKED_LIST
+  };
+}
+
+transducer_dataset_packed_impl::transducer_dataset_packed_impl(unsigned long arity)
+  : arity_m(arity) {
+
+}
+
+unsigned long transducer_dataset_packed_impl::arity() const {
+  return arity_m;
+}
+
+unsigned long transducer_dataset_packed_impl::size() const {
+  return datum_roots_m.size();
+}
+
+unsigned long transducer_dataset_packed_impl::allocate_nodes(unsigned long num_nodes) {
+  auto ret = tags_m.size();
+  tags_m.resize(ret + num_nodes);
+  payloads_m.resize(ret + num_nodes);
+  return ret;
+}
+
+void transducer_dataset_packed_impl::apply_emplace_back(const std::vector<value_t>& datum) {
+  if(arity_m != datum.size()) {
+    stringstream ss;
+    ss << "Cannot add datum to dataset. Dataset has arity "<< arity_m<< " but datum has arity "<<datum.size();
+    throw_with_nested(std::runtime_error(ss.str()));
+  }
+  auto root = allocate_nodes(arity_m);
+  for(unsigned long i=0; i<arity_m; ++i) {
+    pack_value(root + i, datum[i]);
+  }
+  datum_roots_m.push_back(root);
+}
+
+void transducer_dataset_packed_impl::pack_value(unsigned long node, const value_t& x) {
+  using namespace __private_transducer_dataset;
+  if(x.is_null()) {
+    tags_m[node] = PACKED_NULL;
+    return;
+  }
+  x.visit([&](auto&& v) {
+    using T = decay_t<decltype(v)>;
+    if constexpr (value_t::static_type_info<T>().is_integer) {
+      tags_m[node] = PACKED_INTEGER;
+      payloads_m[node] = (uint64_t)v;
+    }
+    else if constexpr (value_t::static_type_info<T>().is_float) {
+      tags_m[node] = PACKED_FLOAT;
+      uint64_t payload = 0;
+      memcpy(&payload, &v, sizeof(float));
+      payloads_m[node] = payload;
+    }
+    else if constexpr (value_t::static_type_info<T>().is_tensor) {
+      tags_m[node] = PACKED_TENSOR;
+      payloads_m[node] = tensors_m.size();
+      // a copy of its own, so that the dataset does not keep alive a larger array the values may be a slice of
+      tensors_m.emplace_back(tensor_t(tensor_values_t::copy_of(v.values.begin(), v.values.end()), v.shape));
+    }
+    else if constexpr (value_t::static_type_info<T>().is_symbol) {
+      tags_m[node] = PACKED_SYMBOL;
+      auto found = symbol_ids_m.find(v);
+      if(found == symbol_ids_m.end()) {
+        symbols_m.push_back(x);
+        found = symbol_ids_m.emplace(symbols_m.back().as_symbol(), symbols_m.size() - 1).first;
+      }
+      payloads_m[node] = found->second;
+    }
+    else if constexpr (value_t::static_type_info<T>().is_list) {
+      // allocate all items first, so that they are consecutive even if they contain lists themselves
+      auto first = allocate_nodes(v.size());
+      tags_m[node] = PACKED_LIST;
+      payloads_m[node] = lists_m.size();
+      lists_m.push_back(list_entry{first, v.size()});
+      for(unsigned long i=0; i<v.size(); ++i) {
+        pack_value(first + i, v[i]);
+      }
+    }
+    else {
+      throw_with_nested(std::runtime_error("Cannot add a symbolic tensor to dataset"));
+    }
+  });
+}
+
+value_t transducer_dataset_packed_impl::unpack_value(unsigned long node) const {
+  using namespace __private_transducer_dataset;
+  auto payload = payloads_m[node];
+  switch(tags_m[node]) {
+    case PACKED_INTEGER:
+      return value_t((long)payload);
+    case PACKED_FLOAT: {
+      float x;
+      memcpy(&x, &payload, sizeof(float));
+      return value_t(x);
+    }
+    case PACKED_TENSOR:
+      return tensors_m[payload];
+    case PACKED_SYMBOL:
+      return symbols_m[payload];
+    case PACKED_LIST: {
+      auto& entry = lists_m[payload];
+      list_t items;
+      items.reserve(entry.num_items);
+      for(unsigned long i=0; i<entry.num_items; ++i) {
+        items.push_back(unpack_value(entry.first_node + i));
+      }
+      return value_t(move(items));
+    }
+    default:
+      return value_t();
+  }
+}
+
+vector<value_t> transducer_dataset_packed_impl::materialize(unsigned long i) const {
+  auto root = datum_roots_m[i];
+  vector<value_t> ret;
+  ret.reserve(arity_m);
+  for(unsigned long j=0; j<arity_m; ++j) {
+    ret.push_back(unpack_value(root + j));
+  }
+  return ret;
+}
+
+unsigned long transducer_dataset_packed_impl::datum_size(unsigned long i, const datum_size_fn_t& size_fn) const {
+  using namespace __private_transducer_dataset;
+  if(i >= size() || !is_default_datum_size(size_fn)) return transducer_dataset::datum_size(i, size_fn);
+  // same as default_datum_size(), but reads the list lengths from the arenas
+  auto root = datum_roots_m[i];
+  unsigned long ret = 0;
+  for(unsigned long j=0; j<arity_m; ++j) {
+    ret += tags_m[root + j] == PACKED_LIST ? lists_m[payloads_m[root + j]].num_items : 1;
+  }
+  return ret;
+}
+
+void transducer_dataset_packed_impl::shrink_to_fit() {
+  tags_m.shrink_to_fit();
+  payloads_m.shrink_to_fit();
+  datum_roots_m.shrink_to_fit();
+  lists_m.shrink_to_fit();
+  tensors_m.shrink_to_fit();
+  symbols_m.shrink_to_fit();
+}
+
+unsigned long transducer_dataset_packed_impl::memory_usage() const {
+  unsigned long ret = tags_m.capacity() * sizeof(unsigned char)
+    + payloads_m.capacity() * sizeof(uint64_t)
+    + datum_roots_m.capacity() * sizeof(unsigned long)
+    + lists_m.capacity() * sizeof(list_entry)
+    + tensors_m.capacity() * sizeof(value_t)
+    + symbols_m.capacity() * sizeof(value_t);
+  for(auto&& x:tensors_m) {
+    auto tensor = x.as_tensor();
+    ret += sizeof(tensor_t) + tensor.values.size() * sizeof(float) + tensor.shape.size() * sizeof(long);
+  }
+  for(auto&& x:symbols_m) {
+    // stored once, the key of symbol_ids_m is a view of it
+    ret += sizeof(symbol_t) + x.as_symbol().capacity() + sizeof(std::string_view) + sizeof(uint64_t);
+  }
+  return ret;
+}
+
+std::shared_ptr<transducer_dataset_packed_impl> transducer_dataset_packed_impl::pack(const transducer_dataset& dataset) {
+  auto ret = make_shared<transducer_dataset_packed_impl>(dataset.arity());
+  auto len = dataset.size();
+  for(unsigned long i=0; i<len; ++i) {
+    ret->apply_emplace_back(dataset.at(i));
+  }
+  ret->shrink_to_fit();
+  return ret;
+}
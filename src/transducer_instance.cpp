@@ -13,6 +13,7 @@
 #include "include/wallclock_timer.hpp"
 #include "transducer_variant.hpp"
 #include "include/lego_list_operations.hpp"
+#include "numerical_health.hpp"
 
 using namespace std;
 using namespace tg;
@@ -44,6 +45,100 @@ namespace nquSSHTXgN {
       print_exception(nested_e, level + 1);
     } catch (...) {}
   }
+
+  // whether to give up instead of re-evaluating in immediate mode
+  bool is_nan_or_inf_fatal() {
+    return immediate_computation_guard::is_guarded() || numerical_health::is_enabled();
+  }
+
+  void print_quarantine(const std::vector<long>& datums, const std::vector<numerical_health::finding>& findings) {
+    cerr << "Quarantined " << datums.size() << " datum(s):";
+    for(auto&& datum:datums) {
+      cerr << " #" << datum;
+    }
+    cerr << endl << numerical_health::report(findings) << endl;
+  }
+
+  // evaluates the results of a batch
+  // when quarantining, results of datums that produce NaN or Inf are replaced with null,
+  // and then the rest are evaluated again, which only reads the values that are already computed
+  // gives up if a pass cannot quarantine any datum that is not already quarantined
+  void evaluate_batch(std::vector<value_t>& results) {
+    std::vector<bool> quarantined(results.size(), false);
+    while(true) {
+      try {
+        value_t(results).evaluate();
+        return;
+      }
+      catch(const numerical_health::non_finite_exception& e) {
+        if(!nan_or_inf_quarantine_guard::is_guarded()) throw;
+        std::vector<long> datums;
+        for(auto&& datum:numerical_health::offending_datums(e.findings)) {
+          if(datum < 0 || datum >= (long)results.size() || quarantined[datum]) continue;
+          quarantined[datum] = true;
+          datums.push_back(datum);
+        }
+        if(datums.empty()) throw;
+        for(auto&& datum:datums) {
+          results[datum] = value_t();
+        }
+        print_quarantine(datums, e.findings);
+      }
+    }
+  }
+
+  // converts what a loss transducer returns into a loss expression
+  dynet::Expression as_loss_expression(const value_t& ret) {
+    if (ret.is_symbolic_tensor() && ret.as_symbolic_tensor().dim().sum_dims() == 1) {
+      return ret.as_symbolic_tensor();
+    } else if (ret.is_any_scalar()) {
+      return dynet::input(*dynet_computation_graph::p(), ret.as_float());
+    } else {
+      stringstream ss;
+      ss << "Cannot perform backward computation because the transducer did not return a tensor of shape {1}. Got: "<<ret;
+      throw_with_nested(std::runtime_error(ss.str()));
+    }
+  }
+
+  // builds the losses of a batch, sums them up, then backpropagates
+  // when quarantining, the datums that produce NaN or Inf are left out, and the whole batch is built and run again without them,
+  // because autobatching may have computed the nodes of the healthy datums together with the quarantined ones
+  // (masking the gradient of a quarantined datum is not enough: NaN times a zero mask is still NaN in the batched nodes)
+  // gives up if a pass cannot quarantine any datum that is not already quarantined
+  scalar_t backward_batch(unsigned long num_datums, const std::function<dynet::Expression(unsigned long)>& build_loss) {
+    std::vector<bool> quarantined(num_datums, false);
+    while(true) {
+      dynet_computation_graph::discard();
+      vector<dynet::Expression> losses;
+      for(unsigned long i = 0; i < num_datums; ++i) {
+        if(quarantined[i]) continue;
+        numerical_health::begin_datum(i);
+        losses.push_back(build_loss(i));
+      }
+      numerical_health::end_datum();
+      if(losses.empty()) return 0;
+
+      auto cg = dynet_computation_graph::p();
+      auto loss = dynet::sum(losses);
+      auto loss_val = dynet::as_scalar(cg->incremental_forward(loss));
+      if(numerical_health::is_enabled() && !std::isfinite(loss_val)) {
+        auto findings = numerical_health::scan(loss.i);
+        if(!nan_or_inf_quarantine_guard::is_guarded()) throw numerical_health::non_finite_exception(move(findings));
+        std::vector<long> datums;
+        for(auto&& datum:numerical_health::offending_datums(findings)) {
+          if(datum < 0 || datum >= (long)num_datums || quarantined[datum]) continue;
+          quarantined[datum] = true;
+          datums.push_back(datum);
+        }
+        if(datums.empty()) throw numerical_health::non_finite_exception(move(findings));
+        print_quarantine(datums, findings);
+        continue;
+      }
+      block_nan_or_inf(loss_val);
+      cg->backward(loss);
+      return loss_val;
+    }
+  }
 }
 
 
@@ -81,7 +176,7 @@ tg::value_t tg::transducer_instance::apply(const std::vector<value_t>& ins) {
     return ret;
   }
   catch (const nan_or_inf_exception& e) {
-    if (immediate_computation_guard::is_guarded()) {
+    if (is_nan_or_inf_fatal()) {
       print_exception(e);
       throw std::runtime_error("");
     } else {
@@ -114,14 +209,16 @@ std::vector<value_t> transducer_instance::dynamic_batch_apply(
     std::vector<value_t> ret;
     ret.reserve(transducers.size());
     for (auto&& transducer:transducers) {
+      numerical_health::begin_datum(ret.size());
       ret.push_back(transducer._get_impl()->transduce());
     }
-    value_t(ret).evaluate();
+    numerical_health::end_datum();
+    evaluate_batch(ret);
     dynet_computation_graph::discard();
     return ret;
   }
   catch (const nan_or_inf_exception& e) {
-    if (immediate_computation_guard::is_guarded()) {
+    if (is_nan_or_inf_fatal()) {
       print_exception(e);
       throw std::runtime_error("");
     } else {
@@ -149,14 +246,16 @@ std::vector<value_t> tg::transducer_instance::batch_apply(const std::shared_ptr<
     vector<value_t> ret;
     ret.reserve(dataset->size());
     for (auto&& datum:(*dataset)) {
+      numerical_health::begin_datum(ret.size());
       ret.push_back(impl->_apply(datum));
     }
-    value_t(ret).evaluate();
+    numerical_health::end_datum();
+    evaluate_batch(ret);
     dynet_computation_graph::discard();
     return ret;
   }
   catch (const nan_or_inf_exception& e) {
-    if (immediate_computation_guard::is_guarded()) {
+    if (is_nan_or_inf_fatal()) {
       print_exception(e);
       throw std::runtime_error("");
     } else {
@@ -194,6 +293,9 @@ scalar_t transducer_instance::apply_backward(const std::vector<value_t>& ins) {
     if (ret.is_symbolic_tensor() && ret.as_symbolic_tensor().dim().sum_dims() == 1) {
       auto&& expr = ret.as_symbolic_tensor();
       auto loss_val = dynet::as_scalar(dynet_computation_graph::p()->incremental_forward(expr));
+      if (numerical_health::is_enabled() && !std::isfinite(loss_val)) {
+        throw numerical_health::non_finite_exception(numerical_health::scan(expr.i));
+      }
       block_nan_or_inf(loss_val);
       dynet_computation_graph::p()->backward(expr);
       dynet_computation_graph::discard();
@@ -209,7 +311,7 @@ scalar_t transducer_instance::apply_backward(const std::vector<value_t>& ins) {
 
   }
   catch (const nan_or_inf_exception& e) {
-    if (immediate_computation_guard::is_guarded()) {
+    if (is_nan_or_inf_fatal()) {
       print_exception(e);
       throw std::runtime_error("");
     } else {
@@ -229,9 +331,6 @@ scalar_t
 transducer_instance::dynamic_batch_backward(const std::vector<tg::dynamic_transducer_application>& loss_applications) {
   using namespace nquSSHTXgN;
   try {
-    dynet_computation_graph::discard();
-    vector<dynet::Expression> losses;
-
     // keep these transducers in memory during dynet evaluation, because constant values are stored in these transducers
     // If these constant values has gone out of scope by the time dynet evaluation happens, undefined behaviors will occur.
     std::vector<lambda_transducer_model> loss_application_transducers;
@@ -240,32 +339,14 @@ transducer_instance::dynamic_batch_backward(const std::vector<tg::dynamic_transd
       loss_application_transducers.push_back(lambda_transducer_model::from_lambda_fn<0>(loss_application));
     }
 
-    for (auto&& loss_application_transducer:loss_application_transducers) {
-
-      auto ret = loss_application_transducer.transduce();
-
-      if (ret.is_symbolic_tensor() && ret.as_symbolic_tensor().dim().sum_dims() == 1) {
-
-        losses.push_back(ret.as_symbolic_tensor());
-      } else if(ret.is_any_scalar()) {
-        losses.push_back(dynet::input(*dynet_computation_graph::p(), ret.as_float()));
-      } else {
-        stringstream ss;
-        ss << "Cannot perform backward computation because the transducer did not return a tensor of shape {1}. Got: "<<ret;
-        throw_with_nested(std::runtime_error(ss.str()));
-      }
-    }
-
-    auto loss = dynet::sum(losses);
-
-    auto loss_val = dynet::as_scalar(dynet_computation_graph::p()->incremental_forward(loss));
-    block_nan_or_inf(loss_val);
-    dynet_computation_graph::p()->backward(loss);
+    auto loss_val = backward_batch(loss_application_transducers.size(), [&](unsigned long i) {
+      return as_loss_expression(loss_application_transducers[i].transduce());
+    });
     dynet_computation_graph::discard();
     return loss_val;
   }
   catch (const nan_or_inf_exception& e) {
-    if (immediate_computation_guard::is_guarded()) {
+    if (is_nan_or_inf_fatal()) {
       print_exception(e);
       throw std::runtime_error("");
     } else {
@@ -290,36 +371,15 @@ scalar_t transducer_instance::batch_backward(const std::shared_ptr<const transdu
     throw_with_nested(std::runtime_error(ss.str()));
   }
   try {
-    dynet_computation_graph::discard();
-    vector<dynet::Expression> losses;
-
-    for (auto&& datum:(*dataset)) {
-
-      auto ret = impl->_apply(datum);
-
-      if (ret.is_symbolic_tensor() && ret.as_symbolic_tensor().dim().sum_dims() == 1) {
-
-        losses.push_back(ret.as_symbolic_tensor());
-      } else if (ret.is_any_scalar()) {
-        losses.push_back(dynet::input(*dynet_computation_graph::p(), ret.as_float()));
-      } else {
-        stringstream ss;
-        ss << "Cannot perform backward computation because the transducer did not return a tensor of shape {1}. Got: "<<ret;
-        throw_with_nested(std::runtime_error(ss.str()));
-      }
-    }
-
-    auto loss = dynet::sum(losses);
-
-    auto loss_val = dynet::as_scalar(dynet_computation_graph::p()->incremental_forward(loss));
-    block_nan_or_inf(loss_val);
-    dynet_computation_graph::p()->backward(loss);
+    auto loss_val = backward_batch(dataset->size(), [&](unsigned long i) {
+      return as_loss_expression(impl->_apply(dataset->at(i)));
+    });
 
     dynet_computation_graph::discard();
     return loss_val;
   }
   catch (const nan_or_inf_exception& e) {
-    if (immediate_computation_guard::is_guarded()) {
+    if (is_nan_or_inf_fatal()) {
       print_exception(e);
       throw std::runtime_error("");
     } else {
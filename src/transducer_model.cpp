@@ -16,6 +16,8 @@
 #include "tbd_transducer.hpp"
 #include "transducer_variant.hpp"
 #include "composed_transducer_model.hpp"
+#include "backprop_trainable_parameter.hpp"
+#include "chunked_archive.hpp"
 
 using namespace std;
 using namespace tg;
@@ -47,6 +49,11 @@ transducer_model& transducer_model::rename(const std::string& name) {
   return *this;
 }
 
+transducer_model& transducer_model::fuse_rnn_gates() {
+  impl->fuse_rnn_gates();
+  return *this;
+}
+
 transducer_model transducer_model::find_transducer_by_name(const std::string& name) {
   auto ret = impl->find_transducer_by_name(name);
   if(!ret) throw std::runtime_error("Transducer not found given name: " + name);
@@ -184,13 +191,53 @@ bool transducer_model::is_arity(unsigned long arity) const {
 }
 
 void transducer_model::save_to_stream_impl(std::ostream& os, const std::vector<transducer_model>& models) {
-  cereal::BinaryOutputArchive oa(os);
-  oa << models;
+  // chunk #0 holds the model structure, and every other chunk holds the values of a parameter
+  detached_parameter_values detached;
+  vector<function<void(string&)>> encoders;
+  {
+    stringstream ss;
+    {
+      cereal::BinaryOutputArchive oa(ss);
+      oa << models;
+    }
+    encoders.emplace_back([structure = ss.str()](string& out) {
+      out = structure;
+    });
+  }
+  encoders.insert(encoders.end(), detached.encoders.begin(), detached.encoders.end());
+  chunked_archive::write(os, encoders);
 }
 
 void transducer_model::load_from_stream_impl(std::istream& is, std::vector<transducer_model>& models) {
-  cereal::BinaryInputArchive ia(is);
-  ia >> models;
+  string consumed;
+  if(!chunked_archive::is_chunked(is, consumed)) {
+    chunked_archive::read_legacy(move(consumed), is, [&](cereal::BinaryInputArchive& ia) {
+      ia >> models;
+    });
+    return;
+  }
+  chunked_archive::prefixed_streambuf buffer(move(consumed), is.rdbuf());
+  istream rest(&buffer);
+
+  auto chunks = chunked_archive::read(rest);
+  if(chunks.empty()) {
+    throw_with_nested(std::runtime_error("Corrupted model: missing model structure"));
+  }
+  detached_parameter_values detached;
+  {
+    stringstream ss(move(chunks[0]));
+    cereal::BinaryInputArchive ia(ss);
+    ia >> models;
+  }
+  if(detached.decoders.size() != chunks.size() - 1) {
+    throw_with_nested(std::runtime_error("Corrupted model: expect " + to_string(detached.decoders.size()) + " parameter chunks, but got " + to_string(chunks.size() - 1)));
+  }
+  chunked_archive::parallel_run(detached.decoders.size(), [&](unsigned long i) {
+    if(!detached.decoders[i]) {
+      throw_with_nested(std::runtime_error("Corrupted model: missing parameter value index " + to_string(i)));
+    }
+    detached.decoders[i](chunks[i + 1]);
+  });
 }
 
 transducer_model& transducer_model::operator=(const tg::transducer_model& x) {
@@ -9,9 +9,51 @@
 #include "transducer_variant.hpp"
 #include "include/lego_list_operations.hpp"
 #include "include/lego_tensor_operations.hpp"
+#include "gradient_buffer.hpp"
+#include "include/parallel_array_map.hpp"
+#include <cmath>
 using namespace std;
 using namespace tg;
 
+namespace __private_transducer_optimizer {
+  /**
+   * \brief The gradient accumulated by the current thread in Hogwild mode
+   */
+  thread_local gradient_buffer hogwild_gradients;
+
+  /**
+   * \brief The gradient accumulated by the current thread since its last update request, when pipelined update is enabled
+   */
+  thread_local gradient_buffer pipelined_gradients;
+
+  /**
+   * \brief Calls a function before every forward pass on the current thread during its lifetime
+   */
+  class before_forward_guard {
+    std::function<void()> prev_m;
+  public:
+    explicit before_forward_guard(std::function<void()> fn) : prev_m(std::exchange(dynet::before_forward, std::move(fn))) {}
+    before_forward_guard(const before_forward_guard&) = delete;
+    before_forward_guard& operator=(const before_forward_guard&) = delete;
+    ~before_forward_guard() {
+      dynet::before_forward = std::move(prev_m);
+    }
+  };
+
+  /**
+   * \brief Count the number of lookup table rows that have non-zero gradients
+   */
+  unsigned long count_rows_touched(dynet::ParameterCollection& pc) {
+    unsigned long ret = 0;
+    for(auto&& p:pc.lookup_parameters_list()) {
+      if(!p->updated || !p->nonzero_grad) continue;
+      ret += p->all_updated ? p->values.size() : std::count(p->is_grads_non_zero.begin(), p->is_grads_non_zero.end(), true);
+    }
+    return ret;
+  }
+}
+using namespace __private_transducer_optimizer;
+
 
 void simple_sgd_optimizer::set_learning_rate_impl(float lr) {
   weights_impl.learning_rate = lr;
@@ -27,6 +69,18 @@ std::vector<dynet::Trainer *> simple_sgd_optimizer::get_impl() {
   return {&weights_impl, &bias_impl};
 }
 
+bool simple_sgd_optimizer::supports_hogwild() const {
+  return true;
+}
+
+void simple_sgd_optimizer::hogwild_update_rule(float* values, const std::vector<float>& grad, float gradient_scale, float weight_decay_scale) {
+  // same as dynet::SimpleSGDTrainer
+  const float scale = weights_impl.learning_rate * gradient_scale / weight_decay_scale;
+  for(unsigned long i=0; i<grad.size(); ++i) {
+    values[i] -= grad[i] * scale;
+  }
+}
+
 
 
 adam_optimizer::adam_optimizer(float learning_rate, float beta_1, float beta_2, float eps):tg::optimizer_base(),
@@ -47,11 +101,31 @@ std::vector<dynet::Trainer *> adam_optimizer::get_impl() {
 }
 
 
+template<typename F>
+float optimizer_base::backward_into_thread_buffer(F&& backward) {
+  if(!dynet::parameter_gradient_sink) {
+    if(hogwild_m) {
+      gradient_buffer_guard _(hogwild_gradients);
+      return backward();
+    }
+    if(max_pending_updates_m > 0) {
+      // the graph is constructed while the pending updates are still running,
+      // but the forward pass waits for them before reading the parameters
+      gradient_buffer_guard _(pipelined_gradients);
+      before_forward_guard __([this]() {wait_until_parameters_updated();});
+      return backward();
+    }
+  }
+  return backward();
+}
+
 float optimizer_base::apply_learn_from_datum(transducer_model loss_fn, const std::vector<value_t>& inputs) {
   float ret = 0;
   {
     lego_training_guard _;
-    ret = loss_fn.instantiate().apply_backward(inputs);
+    ret = backward_into_thread_buffer([&]() {
+      return loss_fn.instantiate().apply_backward(inputs);
+    });
   }
 
   update_params();
@@ -67,34 +141,48 @@ float optimizer_base::dynamic_learn_from_datum(const dynamic_transducer_applicat
       return compute_loss();
     });
 
-    ret = model.instantiate().backward();
+    ret = backward_into_thread_buffer([&]() {
+      return model.instantiate().backward();
+    });
   }
   update_params();
   return ret;
 }
 
 float optimizer_base::learn_from_batch(transducer_model loss_fn, const std::shared_ptr<const transducer_dataset>& datum_batch) {
-  float ret = 0;
-  {
-    lego_training_guard _;
-    ret = loss_fn.instantiate().batch_backward(datum_batch);
-  }
+  float ret = backward_on_batch(std::move(loss_fn), datum_batch);
   update_params();
   return ret;
 }
 
 float optimizer_base::dynamic_learn_from_batch(
   const std::vector<dynamic_transducer_application>& compute_loss_batch) {
-  float ret = 0;
-  {
-    lego_training_guard _;
-    ret = transducer_instance::dynamic_batch_backward(compute_loss_batch);
-  }
+  float ret = dynamic_backward_on_batch(compute_loss_batch);
   update_params();
   return ret;
 }
 
+float optimizer_base::backward_on_batch(transducer_model loss_fn, const std::shared_ptr<const transducer_dataset>& datum_batch) {
+  lego_training_guard _;
+  return backward_into_thread_buffer([&]() {
+    return loss_fn.instantiate().batch_backward(datum_batch);
+  });
+}
+
+float optimizer_base::dynamic_backward_on_batch(const std::vector<dynamic_transducer_application>& compute_loss_batch) {
+  lego_training_guard _;
+  return backward_into_thread_buffer([&]() {
+    return transducer_instance::dynamic_batch_backward(compute_loss_batch);
+  });
+}
+
+void optimizer_base::apply_gradients() {
+  update_params();
+}
+
 optimizer_base::~optimizer_base() {
+  stop_update_thread();
+
   // give back the control of the backprop trainable parameters
   for (backprop_trainable_parameter_base *param:weights_to_train_m) {
     param->use_internal_pc();
@@ -123,11 +211,40 @@ void optimizer_base::set_learning_rate(float lr) {
 }
 
 void optimizer_base::update_params() {
+  if(hogwild_m) {
+    hogwild_update();
+    return;
+  }
+  {
+    std::unique_lock<std::mutex> lock(update_queue_mtx_m);
+    if(max_pending_updates_m > 0) {
+      update_queue_cv_m.wait(lock, [&]() {
+        return num_pending_updates_m < max_pending_updates_m || update_error_m;
+      });
+      if(update_error_m) {
+        std::rethrow_exception(std::exchange(update_error_m, nullptr));
+      }
+      // the gradient that went into the parameters instead (through another gradient sink) is only written while no update is pending
+      if(!pipelined_gradients.empty()) {
+        pending_gradients_m.push_back(std::move(pipelined_gradients));
+        pipelined_gradients.clear();
+      }
+      ++num_pending_updates_m;
+      update_queue_cv_m.notify_all();
+      return;
+    }
+  }
+  update_params_impl();
+}
+
+void optimizer_base::update_params_impl() {
   std::lock_guard<std::mutex> lock(mtx);
   try {
+    num_rows_touched_m += count_rows_touched(weights_pc_m) + count_rows_touched(biases_pc_m);
     for(auto&& trainer:get_impl()) {
       trainer->update();
     }
+    ++num_updates_m;
   }
   catch(...) {
     weights_pc_m.reset_gradient();
@@ -136,6 +253,177 @@ void optimizer_base::update_params() {
   }
 }
 
+void optimizer_base::hogwild_update() {
+  if(hogwild_gradients.empty()) {
+    // the gradient went somewhere else (for example, into the parameters when the thread had its own gradient sink)
+    update_params_impl();
+    return;
+  }
+  auto trainers = get_impl();
+  auto trainer_of = [&](dynet::ParameterCollection* owner) -> dynet::Trainer* {
+    for(auto&& trainer:trainers) {
+      if(trainer->model == owner) return trainer;
+    }
+    return nullptr;
+  };
+
+  // clip the gradients like dynet::Trainer::clip_gradients(), with the gradient norm of every parameter collection
+  std::unordered_map<dynet::ParameterCollection*, float> gradient_scales;
+  hogwild_gradients.for_each_gradient([&](dynet::ParameterCollection* owner, float* values, const std::vector<float>& grad) {
+    if(!trainer_of(owner)) return false;
+    auto& squared_norm = gradient_scales[owner];
+    for(auto&& x:grad) {
+      squared_norm += x * x;
+    }
+    return true;
+  });
+  std::vector<dynet::Trainer*> clipped;
+  for(auto&& [owner, scale]:gradient_scales) {
+    auto trainer = trainer_of(owner);
+    float norm = std::sqrt(scale);
+    scale = 1;
+    if(!trainer || !trainer->clipping_enabled) continue;
+    if(std::isnan(norm) || std::isinf(norm)) {
+      hogwild_gradients.clear();
+      throw std::runtime_error("Magnitude of gradient is bad: " + std::to_string(norm));
+    }
+    if(norm > trainer->clip_threshold) {
+      scale = trainer->clip_threshold / norm;
+      clipped.push_back(trainer);
+    }
+  }
+
+  // like the locked update, parameters without a trainer (for example, excluded from training) are left untouched
+  num_rows_touched_m += hogwild_gradients.for_each_gradient([&](dynet::ParameterCollection* owner, float* values, const std::vector<float>& grad) {
+    if(!trainer_of(owner)) return false;
+    hogwild_update_rule(values, grad, gradient_scales[owner], owner->get_weight_decay().current_weight_decay());
+    return true;
+  });
+  hogwild_gradients.clear();
+
+  // advance the weight decay schedule like dynet::Trainer::update(). This only touches a few numbers,
+  // except for the rare rescale, which races with the lock-free updates of other threads like any Hogwild update does
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+    for(auto&& trainer:clipped) {
+      ++trainer->clips;
+    }
+    for(auto&& trainer:trainers) {
+      ++trainer->updates;
+      auto& weight_decay = trainer->model->get_weight_decay();
+      weight_decay.update_weight_decay();
+      if(weight_decay.parameters_need_rescaled()) {
+        trainer->rescale_and_reset_weight_decay();
+      }
+    }
+  }
+  ++num_updates_m;
+}
+
+bool optimizer_base::supports_hogwild() const {
+  return false;
+}
+
+void optimizer_base::hogwild_update_rule(float* values, const std::vector<float>& grad, float gradient_scale, float weight_decay_scale) {
+  throw std::runtime_error("Hogwild update is not supported by this optimizer");
+}
+
+void optimizer_base::set_hogwild(bool enabled) {
+  if(enabled && !supports_hogwild()) {
+    throw std::runtime_error("Hogwild update is not supported by this optimizer");
+  }
+  hogwild_m = enabled;
+}
+
+optimizer_update_statistics optimizer_base::update_statistics() const {
+  optimizer_update_statistics ret;
+  ret.num_updates = num_updates_m;
+  ret.num_rows_touched = num_rows_touched_m;
+  ret.seconds_elapsed = std::chrono::duration<float>(std::chrono::steady_clock::now() - statistics_start_time_m).count();
+  return ret;
+}
+
+void optimizer_base::reset_update_statistics() {
+  num_updates_m = 0;
+  num_rows_touched_m = 0;
+  statistics_start_time_m = std::chrono::steady_clock::now();
+}
+
+float optimizer_update_statistics::updates_per_second() const {
+  if(seconds_elapsed <= 0) return 0;
+  return num_updates / seconds_elapsed;
+}
+
+void optimizer_base::update_thread_loop() {
+  parallel_map_thread_pool inline_workers(1);
+  std::vector<gradient_buffer> staged_gradients;
+  std::unique_lock<std::mutex> lock(update_queue_mtx_m);
+  while(true) {
+    update_queue_cv_m.wait(lock, [&]() {
+      return num_pending_updates_m > 0 || stop_update_thread_m;
+    });
+    if(num_pending_updates_m == 0) return;
+
+    // apply the gradients of all batches pending so far in one step
+    auto num_batches = num_pending_updates_m;
+    staged_gradients.swap(pending_gradients_m);
+    lock.unlock();
+    std::exception_ptr error;
+    try {
+      gradient_buffer::reduce_into_parameters(staged_gradients, inline_workers);
+      update_params_impl();
+    }
+    catch(...) {
+      error = std::current_exception();
+    }
+    staged_gradients.clear();
+    lock.lock();
+    if(error) update_error_m = error;
+    num_pending_updates_m -= num_batches;
+    update_queue_cv_m.notify_all();
+  }
+}
+
+void optimizer_base::set_pipelined_update(unsigned long max_pending_batches) {
+  if(max_pending_batches == max_pending_updates_m) return;
+  stop_update_thread();
+  max_pending_updates_m = max_pending_batches;
+  if(max_pending_updates_m > 0) {
+    stop_update_thread_m = false;
+    update_thread_m = std::thread([this]() {
+      update_thread_loop();
+    });
+  }
+}
+
+void optimizer_base::wait_for_pending_updates() {
+  std::unique_lock<std::mutex> lock(update_queue_mtx_m);
+  update_queue_cv_m.wait(lock, [&]() {
+    return num_pending_updates_m == 0;
+  });
+  if(update_error_m) {
+    std::rethrow_exception(std::exchange(update_error_m, nullptr));
+  }
+}
+
+void optimizer_base::wait_until_parameters_updated() {
+  std::unique_lock<std::mutex> lock(update_queue_mtx_m);
+  update_queue_cv_m.wait(lock, [&]() {
+    return num_pending_updates_m == 0 || update_error_m;
+  });
+}
+
+void optimizer_base::stop_update_thread() {
+  if(!update_thread_m.joinable()) return;
+  {
+    std::lock_guard<std::mutex> lock(update_queue_mtx_m);
+    stop_update_thread_m = true;
+  }
+  update_queue_cv_m.notify_all();
+  update_thread_m.join();
+  max_pending_updates_m = 0;
+}
+
 void optimizer_base::set_weight_decay(float lambda) {
   weights_pc_m.set_weight_decay_lambda(lambda);
 }
@@ -83,6 +83,18 @@ rnn_structure_t::initialize(unsigned long input_size, unsigned long output_size,
       make_cell = [&]() { return make_shared<gru_cell>(input_size, output_size); };
       name = "gru" + name;
       break;
+    case FUSED_VANILLA_LSTM:
+      make_cell = [&]() { return make_shared<fused_vanilla_lstm_cell>(input_size, output_size); };
+      name = "fused_vanilla_lstm" + name;
+      break;
+    case FUSED_COUPLED_LSTM:
+      make_cell = [&]() { return make_shared<fused_coupled_lstm_cell>(input_size, output_size); };
+      name = "fused_coupled_lstm" + name;
+      break;
+    case FUSED_GRU:
+      make_cell = [&]() { return make_shared<fused_gru_cell>(input_size, output_size); };
+      name = "fused_gru" + name;
+      break;
     default:
       throw_with_nested(std::runtime_error("Unknown RNN cell type"));
   }
@@ -131,6 +143,18 @@ bidirectional_rnn_structure_t::initialize(unsigned long input_size, unsigned lon
       make_cell = [&](unsigned long i, unsigned long o) { return make_shared<gru_cell>(i, o / 2); };
       name = "bi_gru" + name;
       break;
+    case FUSED_VANILLA_LSTM:
+      make_cell = [&](unsigned long i, unsigned long o) { return make_shared<fused_vanilla_lstm_cell>(i, o / 2); };
+      name = "bi_fused_vanilla_lstm" + name;
+      break;
+    case FUSED_COUPLED_LSTM:
+      make_cell = [&](unsigned long i, unsigned long o) { return make_shared<fused_coupled_lstm_cell>(i, o / 2); };
+      name = "bi_fused_coupled_lstm" + name;
+      break;
+    case FUSED_GRU:
+      make_cell = [&](unsigned long i, unsigned long o) { return make_shared<fused_gru_cell>(i, o / 2); };
+      name = "bi_fused_gru" + name;
+      break;
     default:
       throw_with_nested(std::runtime_error("Unknown RNN cell type"));
   }
@@ -4,7 +4,11 @@
 
 #include "include/transducer_typed_value.hpp"
 #include "dynet_computation_graph.hpp"
+#include "numerical_health.hpp"
 #include <chrono>
+#include <atomic>
+#include <mutex>
+#include <string_view>
 #include "include/lego_guard.hpp"
 
 using namespace std;
@@ -14,16 +18,81 @@ tg::value_t::value_t() : v() {
 
 }
 
-tg::value_t::value_t(float x) : v(make_shared<varient_t>(x)) {
+tg::value_t::value_t(float x) : storage_m(storage_kind::inline_float) {
+  inline_m.scalar = x;
+}
+
+tg::value_t::value_t(double x) : value_t((scalar_t)x) {
+
+}
+
+namespace __private_transducer_typed_value {
+  std::atomic<bool> symbol_interning_enabled{false};
+}
+
+/**
+ * \brief The process-wide intern table of symbols
+ *
+ * Sharded by the hash of the symbol, so that threads interning different symbols rarely wait for each other.
+ * Entries are never freed, so interned values point to them without reference counting.
+ */
+class value_t::symbol_intern_table {
+  static constexpr unsigned long NUM_SHARDS = 64;
+  struct shard {
+    std::mutex mtx;
+    std::unordered_map<std::string_view, std::pair<unsigned long, varient_t*>> entries;
+  };
+  shard shards_m[NUM_SHARDS];
+  std::atomic<unsigned long> next_id_m{1};
+
+public:
+  static symbol_intern_table& get() {
+    static symbol_intern_table ret;
+    return ret;
+  }
 
+  std::pair<unsigned long, varient_t*> intern(const std::string& x) {
+    auto& shard = shards_m[std::hash<std::string_view>()(x) % NUM_SHARDS];
+    lock_guard<mutex> lock(shard.mtx);
+    auto found = shard.entries.find(x);
+    if(found != shard.entries.end()) return found->second;
+    auto entry = new varient_t(x);
+    auto ret = make_pair(next_id_m++, entry);
+    shard.entries.emplace(std::string_view(std::get<string>(*entry)), ret);
+    return ret;
+  }
+};
+
+void tg::set_symbol_interning(bool enabled) {
+  __private_transducer_typed_value::symbol_interning_enabled = enabled;
 }
 
-tg::value_t::value_t(double x) : v(make_shared<varient_t>((scalar_t)x)) {
+bool tg::is_symbol_interning_enabled() {
+  return __private_transducer_typed_value::symbol_interning_enabled;
+}
 
+tg::value_t::value_t(const std::string& x) {
+  if(is_symbol_interning_enabled()) {
+    *this = intern_symbol(x);
+  }
+  else {
+    v = make_shared<varient_t>(x);
+  }
 }
 
-tg::value_t::value_t(const std::string& x) : v(make_shared<varient_t>(x)) {
+value_t value_t::intern_symbol(const symbol_t& x) {
+  auto [id, entry] = symbol_intern_table::get().intern(x);
+  value_t ret;
+  // the entry is never freed, so share it without a control block
+  ret.v = std::shared_ptr<varient_t>(std::shared_ptr<varient_t>(), entry);
+  ret.storage_m = storage_kind::interned_symbol;
+  ret.inline_m.symbol_id = id;
+  return ret;
+}
 
+unsigned long value_t::symbol_id() const {
+  if(!is_interned_symbol()) throw_with_nested(std::runtime_error("Cannot get the ID of a symbol that is not interned"));
+  return inline_m.symbol_id;
 }
 
 void tg::block_nan_or_inf(float value) {
@@ -43,17 +112,28 @@ void tg::block_nan_or_inf(const std::vector<float>& values) {
   }
 }
 
+void tg::block_nan_or_inf(const tensor_values_t& values) {
+  if(numerical_health::all_finite(values.data(), values.size())) return;
+  for(auto&& v:values) {
+    block_nan_or_inf(v);
+  }
+}
+
 tg::value_t::value_t(const symbolic_tensor_t& x) : v(make_shared<varient_t>(x)) {
   if(immediate_computation_guard::is_guarded()) {
     block_nan_or_inf(dynet::as_vector(dynet_computation_graph::p()->forward(x)));
   }
 }
 
-tg::value_t::value_t(const std::vector<value_t>& xs) : v(make_shared<varient_t>(xs)) {
+tg::value_t::value_t(const std::vector<value_t>& xs) : v(make_shared<varient_t>(list_t(xs))) {
 
 }
 
-value_t::value_t(std::vector<value_t>&& xs) : v(make_shared<varient_t>(move(xs))) {
+value_t::value_t(std::vector<value_t>&& xs) : v(make_shared<varient_t>(list_t(move(xs)))) {
+
+}
+
+value_t::value_t(list_t xs) : v(make_shared<varient_t>(move(xs))) {
 
 }
 
@@ -66,8 +146,8 @@ value_t::value_t(tensor_t&& x) : v(make_shared<varient_t>(move(x))) {
 }
 
 long tg::value_t::as_integer() const {
-  if(!v) throw_with_nested(std::runtime_error("Type mismatch. Expected integer, got " + type_name()));
-  return std::visit([&](auto&& r)->long {
+  if(is_null()) throw_with_nested(std::runtime_error("Type mismatch. Expected integer, got " + type_name()));
+  return visit([&](auto&& r)->long {
     using T = std::decay_t<decltype(r)>;
     if constexpr (is_same_v<T, long>) {
       return r;
@@ -90,13 +170,13 @@ long tg::value_t::as_integer() const {
     else {
       throw_with_nested(std::runtime_error("Type mismatch. Expected integer, got " + type_name()));
     }
-  }, *v);
+  });
 
 }
 
 float tg::value_t::as_float() const {
-  if(!v) throw_with_nested(std::runtime_error("Type mismatch. Expected scalar, got " + type_name()));
-  return std::visit([&](auto&& r)->float {
+  if(is_null()) throw_with_nested(std::runtime_error("Type mismatch. Expected scalar, got " + type_name()));
+  return visit([&](auto&& r)->float {
     using T = std::decay_t<decltype(r)>;
     if constexpr (is_same_v<T, long>) {
       return r;
@@ -119,7 +199,7 @@ float tg::value_t::as_float() const {
     else {
       throw_with_nested(std::runtime_error("Type mismatch. Expected scalar, got " + type_name()));
     }
-  }, *v);
+  });
 }
 
 
@@ -130,8 +210,8 @@ const std::string& tg::value_t::as_symbol() const {
 
 
 tg::symbolic_tensor_t tg::value_t::as_symbolic_tensor() const {
-  if(!v) throw_with_nested(std::runtime_error("Type mismatch. Expected tensor, got " + type_name()));
-  return std::visit([&](auto&& r)->symbolic_tensor_t {
+  if(is_null()) throw_with_nested(std::runtime_error("Type mismatch. Expected tensor, got " + type_name()));
+  return visit([&](auto&& r)->symbolic_tensor_t {
 
     constexpr auto V = static_type_info<decltype(r)>();
 
@@ -142,17 +222,16 @@ tg::symbolic_tensor_t tg::value_t::as_symbolic_tensor() const {
       return dynet::input(*dynet_computation_graph::p(), (float)r);
     }
     if constexpr (V.is_tensor) {
-
-      return dynet::input(*dynet_computation_graph::p(), to_dynet_dim(r.shape), &r.values);
+      return tensor_input(*dynet_computation_graph::p(), r);
     }
 
     throw_with_nested(std::runtime_error("Type mismatch. Expected tensor, got " + type_name()));
-  }, *v);
+  });
 }
 
 tensor_t value_t::as_tensor() const {
-  if(!v) throw_with_nested(std::runtime_error("Type mismatch. Expected tensor, got " + type_name()));
-  return std::visit([&](auto&& r)->tensor_t {
+  if(is_null()) throw_with_nested(std::runtime_error("Type mismatch. Expected tensor, got " + type_name()));
+  return visit([&](auto&& r)->tensor_t {
     constexpr auto V = static_type_info<decltype(r)>();
     if constexpr (V.is_any_scalar) {
       return tensor_t({(float)r}, {1});
@@ -164,30 +243,31 @@ tensor_t value_t::as_tensor() const {
       throw_with_nested(std::runtime_error("Type mismatch. Expected tensor, got " + type_name()));
     }
 
-  }, *v);
+  });
 }
 
-const std::vector<tg::value_t>& tg::value_t::as_list() const & {
-  if (is_list()) return get<std::vector<value_t>>(*v);
+const list_t& tg::value_t::as_list() const & {
+  if (is_list()) return get<list_t>(*v);
   throw_with_nested(std::runtime_error("Type mismatch. Expected list, got " + type_name()));
 }
 
 list_t tg::value_t::as_list() const && {
-  if (is_list()) return move(get<std::vector<value_t>>(*v));
+  // copying a list is cheap, and the list may be shared with other values
+  if (is_list()) return get<list_t>(*v);
   throw_with_nested(std::runtime_error("Type mismatch. Expected list, got " + type_name()));
 }
 
 
 bool tg::value_t::is_integer() const {
-  return v && holds_alternative<long>(*v);
+  return storage_m == storage_kind::inline_integer || (v && holds_alternative<long>(*v));
 }
 
 bool tg::value_t::is_float() const {
-  return v && holds_alternative<float>(*v);
+  return storage_m == storage_kind::inline_float || (v && holds_alternative<float>(*v));
 }
 
 bool value_t::is_any_scalar() const {
-  if(!v) return false;
+  if(is_null()) return false;
   return this->visit([&](auto&& r)->bool{
     using T = decay_t<decltype(r)>;
     return static_type_info<T>().is_any_scalar;
@@ -195,7 +275,7 @@ bool value_t::is_any_scalar() const {
 }
 
 bool value_t::is_any_tensor() const {
-  if(!v) return false;
+  if(is_null()) return false;
   return this->visit([&](auto&& r)->bool{
     using T = decay_t<decltype(r)>;
     return static_type_info<T>().is_any_tensor;
@@ -215,11 +295,11 @@ bool value_t::is_symbolic_tensor() const {
 }
 
 bool tg::value_t::is_list() const {
-  return v && holds_alternative<std::vector<value_t>>(*v);
+  return v && holds_alternative<list_t>(*v);
 }
 
 bool tg::value_t::is_null() const {
-  return !v;
+  return storage_m == storage_kind::shared && !v;
 }
 
 std::ostream& tg::operator<<(std::ostream& os, const value_t& x) {
@@ -272,9 +352,9 @@ std::ostream& tg::operator<<(std::ostream& os, const value_t& x) {
 
 tensor_shape_t value_t::tensor_shape() const {
 
-  if(!v) throw_with_nested(std::runtime_error("Cannot get tensor dim from value of type " + type_name()));
+  if(is_null()) throw_with_nested(std::runtime_error("Cannot get tensor dim from value of type " + type_name()));
 
-  return std::visit([&](auto&& r)->tensor_shape_t {
+  return visit([&](auto&& r)->tensor_shape_t {
     using T = std::decay_t<decltype(r)>;
 
     if constexpr (is_same_v<T, symbolic_tensor_t>) {
@@ -293,13 +373,13 @@ tensor_shape_t value_t::tensor_shape() const {
       throw_with_nested(std::runtime_error("Type mismatch. Expected tensor, got " + type_name()));
     }
 
-  }, *v);
+  });
 }
 
 unsigned long value_t::tensor_rank() const {
-  if(!v) throw_with_nested(std::runtime_error("Cannot get tensor dim from value of type " + type_name()));
+  if(is_null()) throw_with_nested(std::runtime_error("Cannot get tensor dim from value of type " + type_name()));
 
-  return std::visit([&](auto&& r)->unsigned long {
+  return visit([&](auto&& r)->unsigned long {
     using T = std::decay_t<decltype(r)>;
 
     if constexpr (is_same_v<T, symbolic_tensor_t>) {
@@ -318,7 +398,7 @@ unsigned long value_t::tensor_rank() const {
       throw_with_nested(std::runtime_error("Type mismatch. Expected tensor, got " + type_name()));
     }
 
-  }, *v);
+  });
 }
 
 unsigned long value_t::tensor_num_elements() const {
@@ -426,8 +506,7 @@ value_t value_t::select_many(const std::vector<unsigned long>& indices, unsigned
 
 value_t value_t::slice(unsigned long start, unsigned long end) const {
   auto&& list = as_list();
-  auto end_itr = end >= list.size() ? list.end() : (list.begin() + end);
-  return value_t(vector<value_t>(list.begin() + start, end_itr));
+  return value_t(list.slice(start, end));
 }
 
 value_t value_t::slice(unsigned long start, unsigned long end, unsigned long axis) const {
@@ -453,7 +532,9 @@ value_t::value_t(bool x): value_t(x ? (long)1.0 : (long)0.0) {
 
 value_t::value_t(int x): value_t((long) x) {}
 
-value_t::value_t(long x): v(make_shared<varient_t>((long)x)) {}
+value_t::value_t(long x): storage_m(storage_kind::inline_integer) {
+  inline_m.integer = x;
+}
 
 value_t::value_t(unsigned int x): value_t((long) x) {}
 
@@ -474,45 +555,35 @@ void value_t::evaluate() {
 
   if(expr_holders.empty()) return;
 
-  // if there is only one symbolic tensor, evaluate it and we are done
-  if(expr_holders.size() == 1) {
-    for(auto&& var:expr_holders) {
-      auto& expr = get<symbolic_tensor_t>(*var);
-      auto dynet_tensor = dynet_computation_graph::p()->incremental_forward(expr);
-      auto vec = dynet::as_vector(dynet_tensor);
-      block_nan_or_inf(vec);
-      *var = tensor_t(vec, from_dynet_dim(expr.dim()));
-    }
-    return;
-  }
-
-  // concatenate them into a big tensor
-  vector<symbolic_tensor_t> exprs;
-  exprs.reserve(expr_holders.size());
+  // forwarding up to the latest node computes every node before it,
+  // so all the symbolic tensors are computed in one forward pass, without concatenating them into one node
+  auto cg = dynet_computation_graph::p();
+  dynet::VariableIndex latest = 0;
   for(auto&& var:expr_holders) {
-    auto& expr = get<symbolic_tensor_t>(*var);
-    exprs.push_back(dynet::reshape(expr, {expr.dim().size()}));
+    latest = std::max(latest, get<symbolic_tensor_t>(*var).i);
   }
-  auto concatenated = dynet::concatenate(exprs, 0);
+  cg->incremental_forward(latest);
 
-  // evaluate the concatenated tensor
-  auto dynet_tensor = dynet_computation_graph::p()->incremental_forward(concatenated);
-  auto concatenated_val = dynet::as_vector(dynet_tensor);
-  block_nan_or_inf(concatenated_val);
+  if(numerical_health::is_enabled()) {
+    // locate the origins before any holder is modified, so that the caller can drop the offending values and evaluate again
+    for(auto&& var:expr_holders) {
+      if(!numerical_health::all_finite(cg->get_value(get<symbolic_tensor_t>(*var)))) {
+        throw numerical_health::non_finite_exception(numerical_health::scan(latest));
+      }
+    }
+  }
 
-  // reconstruct back each individual tensors by slicing
-  // and replace the symbolic tensor with the reconstructed tensor
-  auto offset = concatenated_val.begin();
+  // copy every result out of the computation graph exactly once, straight into its tensor
   for(auto&& var:expr_holders) {
     auto& expr = get<symbolic_tensor_t>(*var);
-    auto end =  offset + expr.dim().size();
-    *var = tensor_t(vector<float>(offset, end), from_dynet_dim(expr.dim()));
-    offset = end;
+    auto tensor = tensor_t::from_dynet_tensor(cg->get_value(expr));
+    block_nan_or_inf(tensor.values);
+    *var = move(tensor);
   }
 }
 
-void value_t::collect_nested_symbolic_tensors(std::unordered_set<varient_t *>& ret) {
-  if(!v) return;
+void value_t::collect_nested_symbolic_tensors(std::unordered_set<varient_t *>& ret) const {
+  if(!v || storage_m != storage_kind::shared) return;
   visit([&](auto&& x) {
     constexpr auto traits = static_type_info<decltype(x)>();
     if constexpr (traits.is_symbolic_tensor) {
@@ -528,3 +599,80 @@ void value_t::collect_nested_symbolic_tensors(std::unordered_set<varient_t *>& r
 
 value_t::~value_t() {
 }
+
+value_list::value_list(const std::vector<value_t>& xs) {
+  for(auto&& x:xs) {
+    push_back(x);
+  }
+}
+
+value_list::value_list(std::vector<value_t>&& xs) {
+  for(auto&& x:xs) {
+    push_back(move(x));
+  }
+}
+
+value_list::operator std::vector<value_t>() const {
+  return std::vector<value_t>(begin(), end());
+}
+
+const value_t& value_list::at(unsigned long i) const {
+  if(i >= size()) {
+    stringstream ss;
+    ss << "Out of range: cannot access index " << i << " from a list of size " << size();
+    throw_with_nested(std::out_of_range(ss.str()));
+  }
+  return (*this)[i];
+}
+
+unsigned long value_list::depth_to_hold(const value_t& x) {
+  if(!x.is_list()) return 0;
+  auto&& buf = x.as_list().buffer_m;
+  return buf ? buf->depth + 1 : 0;
+}
+
+void value_list::push_back(value_t x) {
+  auto depth = depth_to_hold(x);
+  if(buffer_m && buffer_m->depth >= depth && buffer_m->try_append(end_m, move(x))) {
+    ++end_m;
+    return;
+  }
+
+  // another list has already appended after this list, or the buffer is not deep enough to hold x (or there is no buffer yet),
+  // so take a buffer of our own
+  auto fresh = make_shared<buffer>(std::max(depth, buffer_m ? buffer_m->depth : 0ul));
+  unsigned long len = 0;
+  for(auto i=begin_m; i<end_m; ++i) {
+    fresh->try_append(len++, value_t(buffer_m->item(i)));
+  }
+  fresh->try_append(len++, move(x));
+  buffer_m = move(fresh);
+  begin_m = 0;
+  end_m = len;
+}
+
+void value_list::append(const value_list& other) {
+  for(auto&& x:other) {
+    push_back(x);
+  }
+}
+
+void value_list::pop_back() {
+  if(empty()) throw_with_nested(std::out_of_range("Cannot pop from an empty list"));
+  --end_m;
+}
+
+void value_list::clear() {
+  buffer_m = nullptr;
+  begin_m = end_m = 0;
+}
+
+value_list value_list::slice(unsigned long begin, unsigned long end) const {
+  end = std::min(end, size());
+  begin = std::min(begin, end);
+  value_list ret;
+  ret.buffer_m = buffer_m;
+  ret.begin_m = begin_m + begin;
+  ret.end_m = begin_m + end;
+  return ret;
+}
@@ -4,6 +4,9 @@
 
 #include "transducer_variant.hpp"
 #include "lambda_transducer_model.hpp"
+#include "numerical_health.hpp"
+#include "graph_replay.hpp"
+#include <algorithm>
 using namespace tg;
 using namespace std;
 
@@ -31,6 +34,20 @@ std::vector<std::shared_ptr<transducer_variant>> transducer_variant::nested_tran
   });
 }
 
+void transducer_variant::fuse_rnn_gates() {
+  visit([](auto&& t) {
+    using T = std::decay_t<decltype(t)>;
+    if constexpr (std::is_same_v<T, generic_rnn_model> || std::is_same_v<T, generic_stacked_rnn_model> ||
+                  std::is_same_v<T, generic_bidirectional_rnn_model> || std::is_same_v<T, generic_stacked_bidirectional_rnn_model>) {
+      t.fuse_gates();
+    }
+    if constexpr (has_nested_transducers_v<T>) {
+      for(auto&& child: t.nested_transducers()) {
+        child->fuse_rnn_gates();
+      }
+    }
+  });
+}
 
 std::string transducer_variant::name() const {
   if(user_defined_display_name.empty()) return this->visit([&](auto&& v)->std::string {
@@ -46,6 +63,7 @@ void transducer_variant::rename(const string& name) {
 template<typename ...Args>
 value_t transducer_variant::transduce(const Args& ...args) {
   constexpr auto argc = sizeof...(args);
+  numerical_health::transducer_scope _([this]() { return name(); });
   try {
     return std::visit([&](auto&& t)->value_t {
       constexpr auto traits = transducer_traits<decltype(t)>();
@@ -81,6 +99,7 @@ template value_t transducer_variant::transduce(const value_t&, const value_t&, c
 template<typename ...Args>
 value_t transducer_variant::transduce_placeholder(const Args& ...args) {
   constexpr auto argc = sizeof...(args);
+  numerical_health::transducer_scope _([this]() { return name(); });
 
   try {
     return std::visit([&](auto&& t)->value_t {
@@ -89,8 +108,15 @@ value_t transducer_variant::transduce_placeholder(const Args& ...args) {
         throw std::runtime_error("Argument count error");
       }
       else if constexpr (traits.is_lazy) {
-        auto make_getter = [](auto&& x) {
-          return [&](){return lambda_transducer_model::evaluate_value_placeholder(x);};
+        const value_placeholder* placeholders[] = {&args...};
+        auto make_getter = [&](auto&& x) {
+          return [&]() {
+            auto&& value = lambda_transducer_model::evaluate_value_placeholder(x);
+            if(graph_replay::is_recording()) {
+              graph_replay::observe_lazy_operand(std::find(placeholders, placeholders + argc, &x) - placeholders, value);
+            }
+            return value;
+          };
         };
         return t.lazy_transduce(make_getter(args)...);
       }
@@ -142,6 +168,31 @@ value_t transducer_variant::_apply(const std::vector<value_t>& ins) {
   }
 }
 
+value_t transducer_variant::_apply(const value_t* const* ins, unsigned long num_ins) {
+  switch(num_ins) {
+    case 0:
+      return transduce();
+    case 1:
+      return transduce(*ins[0]);
+    case 2:
+      return transduce(*ins[0], *ins[1]);
+    case 3:
+      return transduce(*ins[0], *ins[1], *ins[2]);
+    case 4:
+      return transduce(*ins[0], *ins[1], *ins[2], *ins[3]);
+    case 5:
+      return transduce(*ins[0], *ins[1], *ins[2], *ins[3], *ins[4]);
+    case 6:
+      return transduce(*ins[0], *ins[1], *ins[2], *ins[3], *ins[4], *ins[5]);
+    case 7:
+      return transduce(*ins[0], *ins[1], *ins[2], *ins[3], *ins[4], *ins[5], *ins[6]);
+    case 8:
+      return transduce(*ins[0], *ins[1], *ins[2], *ins[3], *ins[4], *ins[5], *ins[6], *ins[7]);
+    default:
+      throw std::runtime_error("arity > 8 is not supported");
+  }
+}
+
 bool transducer_variant::is_arity(unsigned long arity) const {
   return std::visit([&](auto&& t)->bool {
     using transducer_T = std::decay_t<decltype(t)>;
@@ -146,6 +146,8 @@ namespace tg {
 
     value_t _apply(const std::vector<value_t>& ins);
 
+    value_t _apply(const value_t* const* ins, unsigned long num_ins);
+
     template<typename ...Args>
     value_t transduce(const Args& ...args);
 
@@ -196,6 +198,13 @@ namespace tg {
      */
     std::vector<std::shared_ptr<transducer_variant>> nested_transducers();
 
+    /**
+     * \brief Replace the RNN cells in this transducer and its nested transducers with their fused-gate counterparts
+     *
+     * See rnn_cell_base::to_fused_gates()
+     */
+    void fuse_rnn_gates();
+
   };
 
 
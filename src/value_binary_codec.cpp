@@ -0,0 +1,163 @@
+//
+// Created by Dekai WU and YAN Yuchen on 20201220.
+//
+
+#include "value_binary_codec.hpp"
+#include <cstring>
+
+using namespace tg;
+using namespace std;
+
+namespace __private_value_binary_codec {
+  enum value_tag : unsigned char {
+    NULL_TAG = 0,
+    INTEGER_TAG,
+    FLOAT_TAG,
+    TENSOR_TAG,
+    SYMBOL_TAG,
+    LIST_TAG
+  };
+
+  template<typename T>
+  void write_pod(string& out, const T& x) {
+    out.append(reinterpret_cast<const char*>(&x), sizeof(T));
+  }
+
+  void require(const char* cursor, const char* end, unsigned long num_bytes) {
+    if(cursor > end || (unsigned long)(end - cursor) < num_bytes) {
+      throw_with_nested(std::runtime_error("Cannot decode value: unexpected end of data"));
+    }
+  }
+
+  // checks that the data holds the given number of items, without overflowing when the count is corrupted
+  void require_items(const char* cursor, const char* end, uint64_t num_items, unsigned long item_size) {
+    if(cursor > end || num_items > (unsigned long)(end - cursor) / item_size) {
+      throw_with_nested(std::runtime_error("Cannot decode value: unexpected end of data"));
+    }
+  }
+
+  template<typename T>
+  T read_pod(const char*& cursor, const char* end) {
+    require(cursor, end, sizeof(T));
+    T ret;
+    memcpy(&ret, cursor, sizeof(T));
+    cursor += sizeof(T);
+    return ret;
+  }
+
+  value_t decode_value(const char*& cursor, const char* end, const shared_ptr<const void>& owner, unsigned long depth);
+}
+using namespace __private_value_binary_codec;
+
+void tg::encode_value_binary(const value_t& x, std::string& out, unsigned long base_offset) {
+  if(x.is_null()) {
+    write_pod(out, NULL_TAG);
+    return;
+  }
+  x.visit([&](auto&& v) {
+    using T = decay_t<decltype(v)>;
+    if constexpr (value_t::static_type_info<T>().is_integer) {
+      write_pod(out, INTEGER_TAG);
+      write_pod(out, (int64_t)v);
+    }
+    else if constexpr (value_t::static_type_info<T>().is_float) {
+      write_pod(out, FLOAT_TAG);
+      write_pod(out, (float)v);
+    }
+    else if constexpr (value_t::static_type_info<T>().is_tensor) {
+      write_pod(out, TENSOR_TAG);
+      write_pod(out, (uint64_t)v.shape.size());
+      for(auto&& axis:v.shape) {
+        write_pod(out, (int64_t)axis);
+      }
+      auto padding = (tensor_values_t::ALIGNMENT - (base_offset + out.size() + 1) % tensor_values_t::ALIGNMENT) % tensor_values_t::ALIGNMENT;
+      write_pod(out, (unsigned char)padding);
+      out.append(padding, '\0');
+      out.append(reinterpret_cast<const char*>(v.values.data()), v.values.size() * sizeof(float));
+    }
+    else if constexpr (value_t::static_type_info<T>().is_symbol) {
+      write_pod(out, SYMBOL_TAG);
+      write_pod(out, (uint64_t)v.size());
+      out.append(v);
+    }
+    else if constexpr (value_t::static_type_info<T>().is_list) {
+      write_pod(out, LIST_TAG);
+      write_pod(out, (uint64_t)v.size());
+      for(auto&& item:v) {
+        encode_value_binary(item, out, base_offset);
+      }
+    }
+    else {
+      throw_with_nested(std::runtime_error("Cannot encode a symbolic tensor"));
+    }
+  });
+}
+
+value_t tg::decode_value_binary(const char*& cursor, const char* end, const std::shared_ptr<const void>& owner) {
+  return decode_value(cursor, end, owner, 0);
+}
+
+value_t __private_value_binary_codec::decode_value(const char*& cursor, const char* end, const shared_ptr<const void>& owner, unsigned long depth) {
+  switch(read_pod<unsigned char>(cursor, end)) {
+    case NULL_TAG:
+      return value_t();
+    case INTEGER_TAG:
+      return value_t((long)read_pod<int64_t>(cursor, end));
+    case FLOAT_TAG:
+      return value_t(read_pod<float>(cursor, end));
+    case TENSOR_TAG: {
+      auto rank = read_pod<uint64_t>(cursor, end);
+      require_items(cursor, end, rank, sizeof(int64_t));
+      tensor_shape_t shape;
+      shape.reserve(rank);
+      uint64_t num_values = 1;
+      for(uint64_t i=0; i<rank; ++i) {
+        auto axis = read_pod<int64_t>(cursor, end);
+        if(axis < 0) {
+          throw_with_nested(std::runtime_error("Cannot decode value: negative tensor dimension"));
+        }
+        // the values must fit in the rest of the data, which also keeps the product from overflowing
+        if(axis > 0 && num_values > (unsigned long)(end - cursor) / sizeof(float) / (uint64_t)axis) {
+          throw_with_nested(std::runtime_error("Cannot decode value: unexpected end of data"));
+        }
+        num_values *= axis;
+        shape.push_back(axis);
+      }
+      auto padding = read_pod<unsigned char>(cursor, end);
+      require(cursor, end, padding);
+      cursor += padding;
+      require_items(cursor, end, num_values, sizeof(float));
+      // a region that is not aligned (or has no owner) cannot be used in place
+      auto values = owner && reinterpret_cast<uintptr_t>(cursor) % alignof(float) == 0 ?
+        tensor_values_t::view_of(owner, reinterpret_cast<const float*>(cursor), num_values) :
+        tensor_values_t::create(num_values, [&](float* out) {
+          memcpy(out, cursor, num_values * sizeof(float));
+        });
+      cursor += num_values * sizeof(float);
+      return value_t(tensor_t(move(values), move(shape)));
+    }
+    case SYMBOL_TAG: {
+      auto len = read_pod<uint64_t>(cursor, end);
+      require(cursor, end, len);
+      symbol_t symbol(cursor, len);
+      cursor += len;
+      return value_t(symbol);
+    }
+    case LIST_TAG: {
+      if(depth >= MAX_VALUE_BINARY_DEPTH) {
+        throw_with_nested(std::runtime_error("Cannot decode value: lists are nested too deeply"));
+      }
+      auto len = read_pod<uint64_t>(cursor, end);
+      // every item takes at least its type tag
+      require_items(cursor, end, len, sizeof(unsigned char));
+      list_t items;
+      items.reserve(len);
+      for(uint64_t i=0; i<len; ++i) {
+        items.push_back(decode_value(cursor, end, owner, depth + 1));
+      }
+      return value_t(move(items));
+    }
+    default:
+      throw_with_nested(std::runtime_error("Cannot decode value: unknown type tag"));
+  }
+}
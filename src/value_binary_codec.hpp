@@ -0,0 +1,60 @@
+//
+// Created by Dekai WU and YAN Yuchen on 20201220.
+//
+/// \cond SHOW_INTERNAL_IMPL
+#ifndef LEGO_VALUE_BINARY_CODEC_HPP
+#define LEGO_VALUE_BINARY_CODEC_HPP
+
+#include "include/transducer_typed_value.hpp"
+#include <string>
+
+namespace tg {
+
+  /**
+   * \brief Encode a value into a compact binary form, appending to a buffer.
+   *
+   * Unlike the cereal archive, this encoding can be decoded directly from a memory region (for example, a memory-mapped file),
+   * one value at a time, without any archive state.
+   *
+   * Every value starts with a one-byte type tag, followed by:
+   *   - null: nothing
+   *   - integer: a 64-bit signed integer
+   *   - float: a 32-bit float
+   *   - tensor: the rank (64-bit), the length of each axis (64-bit each), the number of padding bytes (8-bit),
+   *     the padding, then the values (32-bit float each)
+   *   - symbol: the length in bytes (64-bit), then the characters
+   *   - list: the number of items (64-bit), then the items
+   *
+   * The padding puts the tensor values at a multiple of tensor_values_t::ALIGNMENT bytes from the beginning of the region,
+   * so that they can be used in place when the region is aligned (see decode_value_binary()).
+   *
+   * Numbers are written in native byte order. Symbolic tensors cannot be encoded.
+   *
+   * \param x The value to encode
+   * \param out The buffer to append to
+   * \param base_offset The offset of the buffer from the beginning of the region it will be written into
+   */
+  void encode_value_binary(const value_t& x, std::string& out, unsigned long base_offset = 0);
+
+  /**
+   * \brief The maximum nesting depth of lists that decode_value_binary() accepts
+   *
+   * Guards the decoder's recursion against corrupted data.
+   */
+  constexpr unsigned long MAX_VALUE_BINARY_DEPTH = 1024;
+
+  /**
+   * \brief Decode a value encoded by encode_value_binary()
+   *
+   * When an owner of the memory region is given, tensor values are views into the region instead of copies,
+   * and keep the region alive through the owner.
+   *
+   * \param cursor Points to the beginning of the encoded value. Will be advanced past the end of it.
+   * \param end The end of the memory region, to guard against corrupted data
+   * \param owner Optional. Keeps the memory region alive.
+   * \return The decoded value
+   */
+  value_t decode_value_binary(const char*& cursor, const char* end, const std::shared_ptr<const void>& owner = nullptr);
+}
+
+#endif //LEGO_VALUE_BINARY_CODEC_HPP